@@ -4,7 +4,7 @@
 
   https://github.com/kaz-mac/NfcEasyWriter
 
-  想定するカード: MIFARE Classic 1K, NTAG213/215/216
+  想定するカード: MIFARE Classic 1K/4K, NTAG213/215/216
   想定するリーダー: M5Stack RFID 2 Unit (WS1850S)
   必要なライブラリ: MFRC522_I2C  https://github.com/kkloesener/MFRC522_I2C
 
@@ -39,6 +39,7 @@ byte MFRC522_I2C_Extend::MIFARE_Ultralight_Authenticate(byte* password, byte* pa
 	}
 
 	// Build command buffer
+  uint32_t tm = micros();
   byte command[7] = {0};
   command[0] = 0x1B; // PWD_AUTH command
   memcpy(&command[1], password, 4);
@@ -50,31 +51,481 @@ byte MFRC522_I2C_Extend::MIFARE_Ultralight_Authenticate(byte* password, byte* pa
 	}
 
 	// Transmit the buffer and receive the response, validate CRC_A.
-  return PCD_TransceiveData(command, sizeof(command), pack, packLen, NULL, 0, true);
+  result = PCD_TransceiveData(command, sizeof(command), pack, packLen, NULL, 0, true);
+  _stats.authCount++;
+  _stats.authUs += micros() - tm;
+  if (result != STATUS_OK) _stats.authFailCount++;
+  return result;
+}
+
+// NTAG21xのFAST_READで指定範囲のページをまとめて読み込む（bufferにはCRCの2バイトを含む）
+byte MFRC522_I2C_Extend::MIFARE_Ultralight_FastRead(byte startPage, byte endPage, byte* buffer, byte* bufferSize) {
+	// Sanity check
+	if (buffer == NULL || endPage < startPage || endPage - startPage + 1 > NFC_FASTREAD_MAX_PAGES) {
+		return STATUS_ERROR;
+	}
+	byte needSize = (endPage - startPage + 1) * 4 + 2;
+	if (*bufferSize < needSize) {
+		return STATUS_NO_ROOM;
+	}
+
+	// Build command buffer
+  uint32_t tm = micros();
+  byte command[5];
+  command[0] = 0x3A; // FAST_READ command
+  command[1] = startPage;
+  command[2] = endPage;
+
+	// Calculate CRC_A
+	byte result = PCD_CalculateCRC(command, 3, &command[3]);
+	if (result != STATUS_OK) {
+		return result;
+	}
+
+	// Transmit the buffer and receive the response, validate CRC_A.
+	result = PCD_TransceiveData(command, sizeof(command), buffer, bufferSize, NULL, 0, true);
+  _stats.readCount++;
+  _stats.readUs += micros() - tm;
+	if (result == STATUS_OK && *bufferSize != needSize) {
+		return STATUS_ERROR;
+	}
+	return result;
+}
+
+
+// カード検出用の割り込みを設定する（REQAの応答受信とタイマーのタイムアウトでIRQピンをLOWにする）
+void MFRC522_I2C_Extend::PCD_EnableCardDetectIrq(bool enable, uint16_t intervalMs) {
+  if (enable) {
+    // タイマーは1カウント25us（PCD_Init()のTPrescaler=0xA9）なので、REQAの応答待ちをintervalMsに延ばす
+    uint32_t reload = (uint32_t)intervalMs * 40;
+    if (reload == 0 || reload > 0xFFFF) reload = 0xFFFF;
+    PCD_WriteRegister(TReloadRegH, reload >> 8);
+    PCD_WriteRegister(TReloadRegL, reload & 0xFF);
+    PCD_WriteRegister(DivIEnReg, 0x80);   // IRQPushPull
+    PCD_WriteRegister(ComIEnReg, 0xA1);   // IRqInv（LOWで通知） RxIEn TimerIEn
+  } else {
+    PCD_WriteRegister(ComIEnReg, 0x80);   // 割り込みなし（リセット値）
+    PCD_WriteRegister(DivIEnReg, 0x00);
+    PCD_WriteRegister(CommandReg, PCD_Idle);
+    PCD_WriteRegister(TReloadRegH, 0x03);  // PCD_Init()の値（25ms）に戻す
+    PCD_WriteRegister(TReloadRegL, 0xE8);
+  }
+}
+
+// カード検出用のREQAを送信する（応答は待たない。結果はIRQで通知される）
+void MFRC522_I2C_Extend::PCD_StartCardDetect() {
+  PCD_WriteRegister(CommandReg, PCD_Idle);
+  PCD_WriteRegister(ComIrqReg, 0x7F);     // 割り込み要因をクリア
+  PCD_WriteRegister(FIFOLevelReg, 0x80);  // FIFOをクリア
+  PCD_WriteRegister(FIFODataReg, PICC_CMD_REQA);
+  PCD_WriteRegister(CommandReg, PCD_Transceive);
+  PCD_WriteRegister(BitFramingReg, 0x87); // StartSend 7ビットフレーム
+}
+
+// 割り込み要因を読み込んでクリアする
+byte MFRC522_I2C_Extend::PCD_GetIrqAndClear() {
+  byte irq = PCD_ReadRegister(ComIrqReg);
+  PCD_WriteRegister(ComIrqReg, 0x7F);
+  return irq;
+}
+
+
+// I2Cのクロックを設定する（WS1850Sは400kHzまで対応）
+void MFRC522_I2C_Extend::PCD_SetI2cClock(uint32_t hz) {
+  _wire->setClock(hz);
+}
+
+// FIFOにまとめて書き込む（1回のI2C転送）
+void MFRC522_I2C_Extend::PCD_WriteFifo(byte* data, byte length) {
+  if (length == 0) return;
+  PCD_WriteRegister(FIFODataReg, length, data);   // MFRC522はFIFODataRegへの連続書き込みでアドレスが進まない
+}
+
+// FIFOからまとめて読み込む（1回のI2C転送）
+void MFRC522_I2C_Extend::PCD_ReadFifo(byte* data, byte length, byte rxAlign) {
+  if (length == 0) return;
+  PCD_ReadRegister(FIFODataReg, length, data, rxAlign);
+}
+
+// CRC_Aのテーブル（多項式 x^16+x^12+x^5+1 をビット反転した0x8408）
+static const uint16_t crcATable[256] = {
+  0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF,
+  0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
+  0x1081, 0x0108, 0x3393, 0x221A, 0x56A5, 0x472C, 0x75B7, 0x643E,
+  0x9CC9, 0x8D40, 0xBFDB, 0xAE52, 0xDAED, 0xCB64, 0xF9FF, 0xE876,
+  0x2102, 0x308B, 0x0210, 0x1399, 0x6726, 0x76AF, 0x4434, 0x55BD,
+  0xAD4A, 0xBCC3, 0x8E58, 0x9FD1, 0xEB6E, 0xFAE7, 0xC87C, 0xD9F5,
+  0x3183, 0x200A, 0x1291, 0x0318, 0x77A7, 0x662E, 0x54B5, 0x453C,
+  0xBDCB, 0xAC42, 0x9ED9, 0x8F50, 0xFBEF, 0xEA66, 0xD8FD, 0xC974,
+  0x4204, 0x538D, 0x6116, 0x709F, 0x0420, 0x15A9, 0x2732, 0x36BB,
+  0xCE4C, 0xDFC5, 0xED5E, 0xFCD7, 0x8868, 0x99E1, 0xAB7A, 0xBAF3,
+  0x5285, 0x430C, 0x7197, 0x601E, 0x14A1, 0x0528, 0x37B3, 0x263A,
+  0xDECD, 0xCF44, 0xFDDF, 0xEC56, 0x98E9, 0x8960, 0xBBFB, 0xAA72,
+  0x6306, 0x728F, 0x4014, 0x519D, 0x2522, 0x34AB, 0x0630, 0x17B9,
+  0xEF4E, 0xFEC7, 0xCC5C, 0xDDD5, 0xA96A, 0xB8E3, 0x8A78, 0x9BF1,
+  0x7387, 0x620E, 0x5095, 0x411C, 0x35A3, 0x242A, 0x16B1, 0x0738,
+  0xFFCF, 0xEE46, 0xDCDD, 0xCD54, 0xB9EB, 0xA862, 0x9AF9, 0x8B70,
+  0x8408, 0x9581, 0xA71A, 0xB693, 0xC22C, 0xD3A5, 0xE13E, 0xF0B7,
+  0x0840, 0x19C9, 0x2B52, 0x3ADB, 0x4E64, 0x5FED, 0x6D76, 0x7CFF,
+  0x9489, 0x8500, 0xB79B, 0xA612, 0xD2AD, 0xC324, 0xF1BF, 0xE036,
+  0x18C1, 0x0948, 0x3BD3, 0x2A5A, 0x5EE5, 0x4F6C, 0x7DF7, 0x6C7E,
+  0xA50A, 0xB483, 0x8618, 0x9791, 0xE32E, 0xF2A7, 0xC03C, 0xD1B5,
+  0x2942, 0x38CB, 0x0A50, 0x1BD9, 0x6F66, 0x7EEF, 0x4C74, 0x5DFD,
+  0xB58B, 0xA402, 0x9699, 0x8710, 0xF3AF, 0xE226, 0xD0BD, 0xC134,
+  0x39C3, 0x284A, 0x1AD1, 0x0B58, 0x7FE7, 0x6E6E, 0x5CF5, 0x4D7C,
+  0xC60C, 0xD785, 0xE51E, 0xF497, 0x8028, 0x91A1, 0xA33A, 0xB2B3,
+  0x4A44, 0x5BCD, 0x6956, 0x78DF, 0x0C60, 0x1DE9, 0x2F72, 0x3EFB,
+  0xD68D, 0xC704, 0xF59F, 0xE416, 0x90A9, 0x8120, 0xB3BB, 0xA232,
+  0x5AC5, 0x4B4C, 0x79D7, 0x685E, 0x1CE1, 0x0D68, 0x3FF3, 0x2E7A,
+  0xE70E, 0xF687, 0xC41C, 0xD595, 0xA12A, 0xB0A3, 0x8238, 0x93B1,
+  0x6B46, 0x7ACF, 0x4854, 0x59DD, 0x2D62, 0x3CEB, 0x0E70, 0x1FF9,
+  0xF78F, 0xE606, 0xD49D, 0xC514, 0xB1AB, 0xA022, 0x92B9, 0x8330,
+  0x7BC7, 0x6A4E, 0x58D5, 0x495C, 0x3DE3, 0x2C6A, 0x1EF1, 0x0F78
+};
+
+// CRC_A（ISO/IEC 14443-3）をソフトウェアで計算する（resultは下位、上位の順）
+void MFRC522_I2C_Extend::calcCrcA(const byte* data, byte length, byte* result) {
+  uint16_t crc = 0x6363;   // 初期値（PCD_Init()でModeRegに設定しているものと同じ）
+  for (byte i=0; i<length; i++) {
+    crc = (crc >> 8) ^ crcATable[(crc ^ data[i]) & 0xFF];
+  }
+  result[0] = crc & 0xFF;
+  result[1] = crc >> 8;
+}
+
+// 以下はMFRC522_I2Cの同名の関数を、I2Cの転送回数を減らして実行する（統計情報も取る）
+// MFRC522_I2Cの関数は仮想関数ではないので、ライブラリ内部からの呼び出し（PICC_Select()など）には効かない
+byte MFRC522_I2C_Extend::PCD_CalculateCRC(byte* data, byte length, byte* result) {
+  uint32_t tm = micros();
+  byte res = STATUS_TIMEOUT;
+  if (_softCrc) {
+    calcCrcA(data, length, result);   // I2Cの転送なしで計算する
+    _stats.crcCount++;
+    _stats.crcUs += micros() - tm;
+    return STATUS_OK;
+  }
+  PCD_WriteRegister(CommandReg, PCD_Idle);
+  PCD_WriteRegister(DivIrqReg, 0x04);     // CRCIRqをクリア
+  PCD_WriteRegister(FIFOLevelReg, 0x80);  // FIFOをクリア（FlushBufferは書き込み専用なので読み出し不要）
+  PCD_WriteFifo(data, length);
+  PCD_WriteRegister(CommandReg, PCD_CalcCRC);
+  uint32_t deadline = micros() + 90000;   // 64バイトでも数十usで終わるので、十分長めに待つ
+  do {
+    if (PCD_ReadRegister(DivIrqReg) & 0x04) {
+      PCD_WriteRegister(CommandReg, PCD_Idle);
+      result[0] = PCD_ReadRegister(CRCResultRegL);
+      result[1] = PCD_ReadRegister(CRCResultRegH);
+      res = STATUS_OK;
+      break;
+    }
+  } while ((int32_t)(micros() - deadline) < 0);
+  _stats.crcCount++;
+  _stats.crcUs += micros() - tm;
+  return res;
+}
+
+byte MFRC522_I2C_Extend::PCD_TransceiveData(byte* sendData, byte sendLen, byte* backData, byte* backLen, byte* validBits, byte rxAlign, bool checkCRC) {
+  return PCD_CommunicateWithPICC(PCD_Transceive, 0x30, sendData, sendLen, backData, backLen, validBits, rxAlign, checkCRC);  // RxIRq IdleIRq
+}
+
+byte MFRC522_I2C_Extend::PCD_CommunicateWithPICC(byte command, byte waitIRq, byte* sendData, byte sendLen, byte* backData, byte* backLen, byte* validBits, byte rxAlign, bool checkCRC) {
+  byte txLastBits = validBits ? *validBits : 0;
+  byte bitFraming = (rxAlign << 4) + txLastBits;
+
+  // 送信の準備（ビットマスク操作の読み込みを省いて、書き込みだけにする）
+  PCD_WriteRegister(CommandReg, PCD_Idle);
+  PCD_WriteRegister(ComIrqReg, 0x7F);     // 割り込み要因をクリア
+  PCD_WriteRegister(FIFOLevelReg, 0x80);  // FIFOをクリア
+  PCD_WriteFifo(sendData, sendLen);
+  if (command == PCD_Transceive) {
+    PCD_WriteRegister(CommandReg, command);
+    PCD_WriteRegister(BitFramingReg, bitFraming | 0x80);  // StartSendも同時に立てる
+  } else {
+    PCD_WriteRegister(BitFramingReg, bitFraming);
+    PCD_WriteRegister(CommandReg, command);
+  }
+
+  // 送信が終わるまではポーリングしない（106kbpsでパリティ込み1バイト約85us）
+  delayMicroseconds((uint32_t)sendLen * 85);
+
+  // 完了を待つ（タイムアウトはMFRC522のタイマー25msで検出する。これは念のための上限）
+  uint32_t deadline = micros() + 40000;
+  byte n;
+  while (1) {
+    n = PCD_ReadRegister(ComIrqReg);
+    if (n & waitIRq) break;
+    if (n & 0x01) return STATUS_TIMEOUT;  // TimerIRq
+    if ((int32_t)(micros() - deadline) >= 0) return STATUS_TIMEOUT;
+  }
+
+  byte errorRegValue = PCD_ReadRegister(ErrorReg);
+  if (errorRegValue & 0x13) return STATUS_ERROR;  // BufferOvfl ParityErr ProtocolErr
+
+  // 受信データをまとめて読み込む（有効ビット数が不要ならControlRegは読まない）
+  byte _validBits = 0;
+  if (backData && backLen) {
+    n = PCD_ReadRegister(FIFOLevelReg);
+    if (n > *backLen) return STATUS_NO_ROOM;
+    *backLen = n;
+    PCD_ReadFifo(backData, n, rxAlign);
+    if (validBits || checkCRC) {
+      _validBits = PCD_ReadRegister(ControlReg) & 0x07;
+      if (validBits) *validBits = _validBits;
+    }
+  }
+
+  if (errorRegValue & 0x08) return STATUS_COLLISION;  // CollErr
+
+  // CRC_Aの確認
+  if (backData && backLen && checkCRC) {
+    if (*backLen == 1 && _validBits == 4) return STATUS_MIFARE_NACK;
+    if (*backLen < 2 || _validBits != 0) return STATUS_CRC_WRONG;
+    byte controlBuffer[2];
+    n = PCD_CalculateCRC(&backData[0], *backLen - 2, &controlBuffer[0]);
+    if (n != STATUS_OK) return n;
+    if ((backData[*backLen - 2] != controlBuffer[0]) || (backData[*backLen - 1] != controlBuffer[1])) {
+      return STATUS_CRC_WRONG;
+    }
+  }
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C_Extend::PCD_MIFARE_Transceive(byte* sendData, byte sendLen, bool acceptTimeout) {
+  if (sendData == NULL || sendLen > 16) return STATUS_INVALID;
+  byte cmdBuffer[18];
+  memcpy(cmdBuffer, sendData, sendLen);
+  byte result = PCD_CalculateCRC(cmdBuffer, sendLen, &cmdBuffer[sendLen]);
+  if (result != STATUS_OK) return result;
+  sendLen += 2;
+
+  // 応答はACK/NAKの4ビットのみ
+  byte cmdBufferSize = sizeof(cmdBuffer);
+  byte validBits = 0;
+  result = PCD_CommunicateWithPICC(PCD_Transceive, 0x30, cmdBuffer, sendLen, cmdBuffer, &cmdBufferSize, &validBits);
+  if (acceptTimeout && result == STATUS_TIMEOUT) return STATUS_OK;
+  if (result != STATUS_OK) return result;
+  if (cmdBufferSize != 1 || validBits != 4) return STATUS_ERROR;
+  if (cmdBuffer[0] != MF_ACK) return STATUS_MIFARE_NACK;
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C_Extend::PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key* key, Uid* uid) {
+  uint32_t tm = micros();
+  byte sendData[12];
+  sendData[0] = command;
+  sendData[1] = blockAddr;
+  memcpy(&sendData[2], key->keyByte, MF_KEY_SIZE);
+  memcpy(&sendData[8], &uid->uidByte[uid->size - 4], 4);  // UIDの最後の4バイト
+  byte res = PCD_CommunicateWithPICC(PCD_MFAuthent, 0x10, sendData, sizeof(sendData));  // IdleIRq
+  _stats.authCount++;
+  _stats.authUs += micros() - tm;
+  if (res != STATUS_OK) _stats.authFailCount++;
+  return res;
+}
+
+byte MFRC522_I2C_Extend::MIFARE_Read(byte blockAddr, byte* buffer, byte* bufferSize) {
+  if (buffer == NULL || *bufferSize < 18) return STATUS_NO_ROOM;
+  uint32_t tm = micros();
+  buffer[0] = PICC_CMD_MF_READ;
+  buffer[1] = blockAddr;
+  byte res = PCD_CalculateCRC(buffer, 2, &buffer[2]);
+  if (res == STATUS_OK) res = PCD_TransceiveData(buffer, 4, buffer, bufferSize, NULL, 0, true);
+  _stats.readCount++;
+  _stats.readUs += micros() - tm;
+  return res;
+}
+
+byte MFRC522_I2C_Extend::MIFARE_Write(byte blockAddr, byte* buffer, byte bufferSize) {
+  if (buffer == NULL || bufferSize < 16) return STATUS_INVALID;
+  uint32_t tm = micros();
+  byte cmdBuffer[2] = { PICC_CMD_MF_WRITE, blockAddr };
+  byte res = PCD_MIFARE_Transceive(cmdBuffer, 2);
+  if (res == STATUS_OK) res = PCD_MIFARE_Transceive(buffer, bufferSize);
+  _stats.writeCount++;
+  _stats.writeUs += micros() - tm;
+  return res;
+}
+
+byte MFRC522_I2C_Extend::MIFARE_Ultralight_Write(byte page, byte* buffer, byte bufferSize) {
+  if (buffer == NULL || bufferSize < 4) return STATUS_INVALID;
+  uint32_t tm = micros();
+  byte cmdBuffer[6] = { PICC_CMD_UL_WRITE, page };
+  memcpy(&cmdBuffer[2], buffer, 4);
+  byte res = PCD_MIFARE_Transceive(cmdBuffer, 6);
+  _stats.writeCount++;
+  _stats.writeUs += micros() - tm;
+  return res;
+}
+
+// 以下はMFRC522_I2Cの同名の関数を、統計情報を取りながら実行する
+byte MFRC522_I2C_Extend::PICC_Select(Uid* uid, byte validBits) {
+  uint32_t tm = micros();
+  byte res = MFRC522_I2C::PICC_Select(uid, validBits);
+  _stats.selectCount++;
+  _stats.selectUs += micros() - tm;
+  return res;
+}
+
+bool MFRC522_I2C_Extend::PICC_ReadCardSerial() {
+  uint32_t tm = micros();
+  bool res = MFRC522_I2C::PICC_ReadCardSerial();
+  _stats.selectCount++;
+  _stats.selectUs += micros() - tm;
+  return res;
 }
 
 
 // 初期化
 void NfcEasyWriter::init() {
   mfrc522.PCD_Init_without_resetpin();   // RFID2（MFRC522）初期化
+  _selected = false;
+  _authSectorCL = -1;
+  _authedUL = false;
+  _irqArmed = false;   // リセットで割り込みの設定も消える
 }
 
 // 読み書きできる状態になるまで待つ
 bool NfcEasyWriter::waitCard(uint32_t timeout) {
   uint32_t tm = millis() + timeout;
   bool stat = false;
+  _selected = false;
+  _authSectorCL = -1;   // 再選択すると認証は解除される
+  _authedUL = false;
+  if (_irqDetect) {
+    // IRQで検出する（待っている間はI2Cの通信をしない）
+    _irqArmed = false;
+    while (!stat) {
+      if (pollCardIrq()) {
+        stat = true;
+        break;
+      } else if (timeout > 0 && tm < millis()) {
+        mfrc522.PCD_EnableCardDetectIrq(false);
+        _irqArmed = false;
+        break;
+      }
+      delay(1);
+    }
+    return stat;
+  }
   while (!stat) {
     if (mfrc522.PICC_IsNewCardPresent() && mfrc522.PICC_ReadCardSerial()) {
       stat = true;
+      _selected = true;
       break;
     } else if (timeout > 0 && tm < millis()) {
       break;
     }
-    delay(100);
+    delay(_detectInterval);
   }
   return stat;
 }
 
+// マウント中のカードと通信できる状態にする（選択中なら何もしない、通信エラー後は同じカードを選択し直す）
+bool NfcEasyWriter::selectCard() {
+  if (_selected) return true;
+  if (mfrc522.uid.size == 0) return false;
+
+  uint32_t tm = millis() + _reselectTimeout;
+  do {
+    if (reselectCard()) return true;
+  } while (millis() < tm);
+  if (_debug) sp("カードを選択できません");
+  return false;
+}
+
+// マウント中のカードを選択し直す（待たずに1回だけ試す）
+bool NfcEasyWriter::reselectCard() {
+  if (_selected) return true;
+  if (mfrc522.uid.size == 0) return false;
+  stopAuthCL();
+  _authedUL = false;   // 選択し直すとUltralightの認証も解除される
+
+  // WUPAで起こして（HALT状態のカードも応答する）、UIDを指定して選択する
+  byte atqa[2];
+  byte atqaSize = sizeof(atqa);
+  byte result = mfrc522.PICC_WakeupA(atqa, &atqaSize);
+  if (result == MFRC522_I2C::STATUS_OK || result == MFRC522_I2C::STATUS_COLLISION) {
+    MFRC522_I2C::Uid uid = mfrc522.uid;
+    if (mfrc522.PICC_Select(&uid, uid.size * 8) == MFRC522_I2C::STATUS_OK
+        && uid.size == mfrc522.uid.size && memcmp(uid.uidByte, mfrc522.uid.uidByte, uid.size) == 0) {
+      mfrc522.uid.sak = uid.sak;
+      _selected = true;
+      if (_debug) sp("カードを選択し直しました");
+      return true;
+    }
+  }
+  return false;
+}
+
+NfcEasyWriter* NfcEasyWriter::_irqInstance = nullptr;
+
+// IRQピンの割り込み処理
+void IRAM_ATTR NfcEasyWriter::irqHandler() {
+  if (_irqInstance != nullptr) _irqInstance->_irqFlag = true;
+}
+
+// IRQによるカード検出を使う（irqPin=-1の場合は自前の割り込み処理からnotifyIrq()を呼ぶ）
+bool NfcEasyWriter::beginIrqDetect(int8_t irqPin) {
+  if (irqPin >= 0) {
+    if (_irqInstance != nullptr && _irqInstance != this) return false;  // IRQピンを使えるのは1インスタンスのみ
+    _irqInstance = this;
+    pinMode(irqPin, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(irqPin), irqHandler, FALLING);
+  }
+  _irqPin = irqPin;
+  _irqFlag = false;
+  _irqArmed = false;
+  _irqDetect = true;
+  return true;
+}
+
+// IRQによるカード検出をやめる
+void NfcEasyWriter::endIrqDetect() {
+  if (_irqPin >= 0) {
+    detachInterrupt(digitalPinToInterrupt(_irqPin));
+    if (_irqInstance == this) _irqInstance = nullptr;
+  }
+  if (_irqArmed) mfrc522.PCD_EnableCardDetectIrq(false);
+  _irqPin = -1;
+  _irqArmed = false;
+  _irqDetect = false;
+}
+
+// IRQによるカード検出を進める（待たない。カードを検出して選択できたらtrue。マウントしていない間に呼ぶ）
+bool NfcEasyWriter::pollCardIrq() {
+  if (!_irqDetect) return false;
+  if (!_irqArmed) {
+    // 割り込みを設定してREQAを送信する
+    mfrc522.PCD_EnableCardDetectIrq(true, _irqInterval);
+    _irqFlag = false;
+    mfrc522.PCD_StartCardDetect();
+    _irqArmed = true;
+    return false;
+  }
+  if (!_irqFlag) return false;
+  _irqFlag = false;
+
+  byte irq = mfrc522.PCD_GetIrqAndClear();
+  if (irq & 0x20) {
+    // RxIRq ATQAを受信した（カードはREADY状態なのでそのまま選択する）
+    mfrc522.PCD_EnableCardDetectIrq(false);
+    _irqArmed = false;
+    if (mfrc522.PICC_ReadCardSerial()) {
+      _selected = true;
+      _authSectorCL = -1;
+      _authedUL = false;
+      if (_debug) sp("card detected by IRQ");
+      return true;
+    }
+    return false;   // 選択に失敗したら次の呼び出しで検出からやり直す
+  }
+  if (irq & 0x01) {
+    // TimerIRq 応答なしで_irqIntervalが経過したので送り直す
+    mfrc522.PCD_StartCardDetect();
+  }
+  return false;
+}
+
 // カードをマウントする（読み書きできる状態になるまで待つ）
 bool NfcEasyWriter::mountCard(uint32_t timeout, ProtectMode mode) {
   bool stat;
@@ -86,41 +537,360 @@ bool NfcEasyWriter::mountCard(uint32_t timeout, ProtectMode mode) {
 
   // カード情報を取得する
   init();
+  _fastReadNgUL = false;
   stat = waitCard(timeout);  // 読み書きできる状態になるまで待つ
-  if (stat) {
-    _cardType = checkCardType(mfrc522);
-    if (_cardType == CardType::Classic) {
+  if (stat) stat = mountDetected(mode);
+  _lastProtectMode = (mode != PRT_AUTO) ? mode : PRT_NOPASS_RW;
+  return stat;
+}
+
+// 検出したカードの種類を判定してマウントする（waitCard()の後に実行する）
+bool NfcEasyWriter::mountDetected(ProtectMode mode, bool async) {
+  bool stat = true;
+  _highWaterLoaded = false;   // ハイウォーターマークは使うときに読み込む
+  _configValidUL = false;
+  _cardType = checkCardType(mfrc522);
+  if (_cardType == CardType::Classic) {
+    // 4Kならセクター39まで使う（_maxSectorCLはそのままにして、カードに合わせた値を別に持つ）
+    _classic4K = (mfrc522.PICC_GetType(mfrc522.uid.sak) == MFRC522_I2C::PICC_TYPE_MIFARE_4K);
+    uint16_t last = (_classic4K) ? 39 : 15;
+    _lastSectorCL = (_maxSectorCL < last) ? _maxSectorCL : last;
+    _mounted = true;
+    _core = selectCore();
+    if (_debug) sp("Mifare Classic mounted");
+  } else if (_cardType == CardType::Ultralight) {
+    _ntagType = getNtagTypeUL(mode);  // NTAGの容量タイプを取得する
+    // ページ設定値を更新する
+    if (_ntagType != NT_UNKNOWN) {
+      _maxPageUL = getMaxPageUL(_ntagType);
+      _configPageUL = getConfigPageUL(_ntagType);
       _mounted = true;
-      if (_debug) sp("Mifare Classic mounted");
-    } else if (_cardType == CardType::Ultralight) {
-      _ntagType = getNtagTypeUL(mode);  // NTAGの容量タイプを取得する
-      // ページ設定値を更新する
-      if (_ntagType != NT_UNKNOWN) {
-        _maxPageUL = getMaxPageUL(_ntagType);
-        _configPageUL = getConfigPageUL(_ntagType);
-        _mounted = true;
-        if (_debug) sp("Mifare Ultralight mounted");
-      } else {
-        stat = false;
+      _core = selectCore();
+      // 設定ページ（AUTH0/ACCESS/PWD/PACK）をまとめて読み込んでおく（読めなくてもマウントは成功）
+      if (_configCacheUL) {
+        ULConfig ulconf;
+        readConfigDataUL(&ulconf, (mode != PRT_AUTO) ? mode : PRT_NOPASS_RW);
       }
+      if (_debug) sp("Mifare Ultralight mounted");
+    } else {
+      stat = false;
     }
-    // if (!stat && _debug) sp("mount failed");
   }
-  _lastProtectMode = (mode != PRT_AUTO) ? mode : PRT_NOPASS_RW;
+  // if (!stat && _debug) sp("mount failed");
+  // RAMシャドウはUIDで管理する（中身は読み書きしたときに読み込む）
+  if (_mounted && _shadowEnabled) checkShadow();
+  // 完全性チェックのタグを読み込んで、チェックする範囲が壊れていないか確認する
+  if (_mounted && _integrity && !async) verifyIntegrity(mode);
   return stat;
 }
 
-// カードのマウントを解除する
-void NfcEasyWriter::unmountCard() {
+// カードのマウントを解除する（wait=falseならカードが離れるのを待たない）
+void NfcEasyWriter::unmountCard(bool wait) {
+  if (_shadowEnabled && _mounted) flush();  // RAMシャドウの未書き込みデータを書き込む
   mfrc522.PICC_HaltA();
+  stopAuthCL();   // HALTは認証中なら暗号化して送る必要があるので、認証の終了はHALTの後
+  _authedUL = false;
+  _selected = false;
   _lastProtectMode = PRT_NOPASS_RW;
   _cardType = UnknownCard;
   _ntagType = NT_UNKNOWN;
+  _classic4K = false;
+  _core = nullptr;
+  _highWaterLoaded = false;
+  _tagLoaded = false;
+  _configValidUL = false;
   _mounted = false;
-  delay(50);
+  if (wait) delay(50);
   if (_debug) sp("unmounted");
 }
 
+// フィールド内の全てのカードを検出する（検出したカードはHALT状態になる）　戻り値は検出した枚数
+uint8_t NfcEasyWriter::inventory(CardInfo* cards, uint8_t maxCards) {
+  if (_mounted) unmountCard(false);
+  init();
+  uint8_t count = 0;
+  uint8_t fail = 0;
+  bool wakeup = true;
+
+  // 応答したカードをアンチコリジョンで1枚ずつ選択してHALTする（HALTしたカードはREQAに応答しなくなる）
+  // 最初だけWUPAにして、以前にHALTしたカードも含める
+  while (count < maxCards && fail < 3) {
+    byte atqa[2];
+    byte atqaSize = sizeof(atqa);
+    byte result = (wakeup) ? mfrc522.PICC_WakeupA(atqa, &atqaSize) : mfrc522.PICC_RequestA(atqa, &atqaSize);
+    if (result == MFRC522_I2C::STATUS_TIMEOUT) break;   // 応答なし＝全て検出した
+    if (result != MFRC522_I2C::STATUS_OK && result != MFRC522_I2C::STATUS_COLLISION) {
+      fail++;
+      continue;
+    }
+    MFRC522_I2C::Uid uid;
+    memset(&uid, 0, sizeof(uid));
+    if (mfrc522.PICC_Select(&uid) != MFRC522_I2C::STATUS_OK) {
+      fail++;   // 通信エラー（次のREQAでやり直す）
+      continue;
+    }
+    mfrc522.PICC_HaltA();
+    wakeup = false;
+
+    // HALTできずに同じカードが応答した場合は終わる
+    bool dup = false;
+    for (uint8_t i=0; i<count; i++) {
+      if (cards[i].uid.size == uid.size && memcmp(cards[i].uid.uidByte, uid.uidByte, uid.size) == 0) dup = true;
+    }
+    if (dup) break;
+    cards[count].uid = uid;
+    cards[count].cardType = getCardTypeBySak(uid.sak);
+    if (_debug) {
+      spf("inventory %d: SAK=%02X UID=", count, uid.sak);
+      printDump1Line(uid.uidByte, uid.size);
+    }
+    count++;
+    fail = 0;
+  }
+  mfrc522.uid.size = 0;
+  _selected = false;
+  return count;
+}
+
+// UIDを指定してカードをマウントする（inventory()で検出したカードを1枚ずつ読み書きする）
+bool NfcEasyWriter::mountCardByUid(const MFRC522_I2C::Uid& uid, ProtectMode mode) {
+  if (_mounted) unmountCard(false);   // マウント中のカードはHALTする
+
+  // WUPAで起こしてUIDを指定して選択する（他のカードはREADY→IDLEに戻る）
+  stopAuthCL();
+  _selected = false;
+  _fastReadNgUL = false;
+  mfrc522.uid = uid;
+  bool stat = selectCard() && mountDetected(mode);
+  _lastProtectMode = (mode != PRT_AUTO) ? mode : PRT_NOPASS_RW;
+  return stat;
+}
+
+// 非同期でカードをマウントする（待たずに戻る。poll()で進める。事前にinit()を実行しておく）
+bool NfcEasyWriter::startMount(uint32_t timeout, ProtectMode mode) {
+  if (isBusy()) return false;
+  if (_mounted) unmountCard(false);
+
+  // mountCard()と違ってMFRC522はリセットしない（リセットにはdelay()が必要なため）
+  stopAuthCL();
+  _selected = false;
+  _fastReadNgUL = false;
+  _irqArmed = false;
+  _asyncJob = AJ_MOUNT;
+  _asyncMode = mode;
+  _asyncTimeout = timeout;
+  _asyncStart = millis();
+  _asyncLastTry = _asyncStart - _detectInterval;  // 最初のpoll()ですぐに検出を試す
+  _asyncState = AS_DETECT;
+  return true;
+}
+
+// 非同期でカードからデータを読み込む（待たずに戻る。poll()で進める。dataは完了まで保持すること）
+bool NfcEasyWriter::startRead(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode) {
+  if (isBusy() || !isMounted() || data == nullptr) return false;
+  _asyncJob = AJ_READ;
+  _asyncMode = (mode == PRT_AUTO) ? _lastProtectMode : mode;
+  _asyncVaddr = vaddr;
+  _asyncData = reinterpret_cast<byte *>(data);
+  _asyncSize = dataSize;
+  _asyncDone = 0;
+  _asyncRetried = false;
+  _asyncStart = millis();
+  _asyncState = (_selected) ? AS_AUTH : AS_SELECT;
+  return true;
+}
+
+// 非同期でデータをカードに書き込む（待たずに戻る。poll()で進める。dataは完了まで保持すること）
+bool NfcEasyWriter::startWrite(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode) {
+  if (_integrity) return false;   // 完全性チェックのタグを更新できないので使えない
+  if (! startRead(vaddr, data, dataSize, mode)) return false;
+  _asyncJob = AJ_WRITE;
+  _asyncMarked = false;
+  _diffSkipCount = 0;
+  return true;
+}
+
+// 非同期処理を1ステップ進める（delay()は使わない。1回の処理はカードとの通信1～2回分）
+AsyncState NfcEasyWriter::poll() {
+  bool protect = (_asyncMode == PRT_PASSWD_RW || _asyncMode == PRT_PASSWD_RO);
+  bool res;
+  bool error = false;
+  switch (_asyncState) {
+    // カードの検出を待つ
+    case AS_DETECT:
+      if (_irqDetect) {
+        if (pollCardIrq()) _asyncState = AS_TYPE;  // 検出と選択を済ませている
+      } else if (millis() - _asyncLastTry >= _detectInterval) {
+        _asyncLastTry = millis();
+        if (mfrc522.PICC_IsNewCardPresent()) _asyncState = AS_SELECT;
+      }
+      if (_asyncState == AS_DETECT && _asyncTimeout > 0 && millis() - _asyncStart >= _asyncTimeout) {
+        if (_irqArmed) mfrc522.PCD_EnableCardDetectIrq(false);
+        _irqArmed = false;
+        finishAsync(false);
+      }
+      break;
+
+    // カードを選択する（マウント時は検出したカード、読み書き時はマウント中のカードを選択し直す）
+    case AS_SELECT:
+      if (_asyncJob == AJ_MOUNT) {
+        _authSectorCL = -1;
+        _authedUL = false;
+        _selected = mfrc522.PICC_ReadCardSerial();
+        _asyncState = (_selected) ? AS_TYPE : AS_DETECT;
+      } else if (reselectCard()) {
+        _asyncState = AS_AUTH;
+      } else if (millis() - _asyncStart >= _reselectTimeout) {
+        finishAsync(false);
+      }
+      break;
+
+    // カードの種類を判定する（Ultralightはパスワード認証と容量の読み込みを含む）
+    case AS_TYPE:
+      res = mountDetected(_asyncMode, true);
+      _lastProtectMode = (_asyncMode != PRT_AUTO) ? _asyncMode : PRT_NOPASS_RW;
+      _corrupted = false;
+      if (res && _integrity && prepareIntegrity()) {
+        // 完全性チェックは次のステップから少しずつ読み込む（タグ、チェックする範囲の順）
+        _asyncDone = 0;
+        _asyncSize = _tagCount * sizeof(uint32_t) + _tagSize;
+        _asyncCrc = 0;
+        _asyncBad = false;
+        _asyncState = AS_VERIFY;
+      } else {
+        finishAsync(res);
+      }
+      break;
+
+    // [完全性チェック] タグかチェックする範囲をreadStream()の1回分ずつ読み込む（読めなければチェックせずにマウントする）
+    case AS_VERIFY: {
+      size_t tagBytes = _tagCount * sizeof(uint32_t);
+      bool tagPhase = (_asyncDone < tagBytes);
+      uint16_t base = (tagPhase) ? _tagAddr : _tagVaddr;
+      size_t offset = (tagPhase) ? _asyncDone : _asyncDone - tagBytes;
+      size_t total = (tagPhase) ? tagBytes : _tagSize;
+      uint16_t unit = (isClassic()) ? _writeLengthCL : _writeLengthUL;
+      size_t len = getStreamChunk() - (base + offset) % unit;
+      if (len > total - offset) len = total - offset;
+      byte buff[NFC_STREAM_CHUNK];
+      byte* dst = (tagPhase) ? reinterpret_cast<byte *>(_tags) + offset : buff;
+      bool retry = _retryOnError;
+      _retryOnError = false;   // 選択し直して待つとステップの時間が延びるので、やり直さない
+      res = readData(base + offset, dst, len, _asyncMode);
+      _retryOnError = retry;
+      if (! res) {
+        if (_debug) sp("完全性チェックのタグを読み込めません");
+        finishAsync(true);   // mountCard()と同じく、マウントは成功（タグは書き込み時に読み直す）
+        break;
+      }
+      if (! tagPhase && ! scanIntegrity(offset, buff, len, &_asyncCrc)) _asyncBad = true;
+      _asyncDone += len;
+      if (_asyncDone >= _asyncSize) {
+        _tagLoaded = true;
+        _corrupted = _asyncBad;
+        if (_debug) spf("完全性チェック tags=%d %s\n", _tagCount, (_corrupted ? "壊れた領域あり" : "ok"));
+        finishAsync(true);
+      }
+      break;
+    }
+
+    // [Classic] 次に読み書きするブロックのセクターを認証する（認証済みなら省略する）
+    case AS_AUTH:
+      // 書き込みは最初に1回だけ、範囲全体でハイウォーターマークを更新する（このステップはそれだけで戻る）
+      if (_asyncJob == AJ_WRITE && ! _asyncMarked && useHighWater() && !(_shadowEnabled && checkShadow())) {
+        if (raiseHighWater(_asyncVaddr + _asyncSize, _asyncMode)) _asyncMarked = true;
+        else error = true;
+        break;
+      }
+      _asyncState = AS_TRANSFER;
+      if (isClassic() && _asyncDone < _asyncSize && !(_shadowEnabled && checkShadow())) {
+        PhyAddr pa = addr2PhysicalAddr(_asyncVaddr + _asyncDone, CardType::Classic);
+        if (! authSectorCL(pa.sector, protect, (protect) ? &_authKeyB : &_authKeyA)) {
+          stopAuthCL();
+          _selected = false;  // 認証に失敗するとカードはIDLEに戻る
+          error = true;
+        }
+      }
+      break;
+
+    // 1ブロック（Ultralightの書き込みは1ページ）ずつ読み書きする
+    case AS_TRANSFER:
+      if (_asyncDone >= _asyncSize) {
+        finishAsync(checkAsyncRead());
+      } else if (_shadowEnabled && checkShadow()) {
+        // RAMシャドウ経由なら一度に処理する
+        res = (_asyncJob == AJ_READ) ? readShadow(_asyncVaddr, _asyncData, _asyncSize, _asyncMode)
+                                     : writeShadow(_asyncVaddr, _asyncData, _asyncSize, _asyncMode);
+        finishAsync(res);
+      } else {
+        uint16_t unit = (_asyncJob == AJ_READ) ? _readLength : (isClassic()) ? _writeLengthCL : _writeLengthUL;
+        uint16_t vaddr = _asyncVaddr + _asyncDone;
+        size_t len = unit - vaddr % unit;
+        if (len > _asyncSize - _asyncDone) len = _asyncSize - _asyncDone;
+        if (_asyncJob == AJ_READ) {
+          res = (this->*(_core->read))(vaddr, _asyncData + _asyncDone, len, _asyncMode);
+        } else {
+          res = (this->*(_core->write))(vaddr, _asyncData + _asyncDone, len, _asyncMode);
+        }
+        if (res) {
+          _asyncDone += len;
+          _asyncRetried = false;
+          if (_asyncDone >= _asyncSize) finishAsync(checkAsyncRead());
+          else _asyncState = AS_AUTH;
+        } else {
+          error = true;
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  // 通信エラー（カードの置き直しなど）の場合は、選択し直して1回だけやり直す
+  if (error) {
+    if (!_selected && _retryOnError && !_asyncRetried) {
+      _asyncRetried = true;
+      mfrc522._stats.retryCount++;
+      _asyncStart = millis();
+      _asyncState = AS_SELECT;
+    } else {
+      finishAsync(false);
+    }
+  }
+  return _asyncState;
+}
+
+// 非同期で読み込んだデータを完全性チェックのタグと比べる（readData()と同じ。書き込みは常にtrue）
+bool NfcEasyWriter::checkAsyncRead() {
+  if (_asyncJob != AJ_READ || ! _integrity || ! _tagLoaded) return true;
+  _corrupted = ! checkIntegrity(_asyncVaddr, _asyncData, _asyncSize);
+  if (_corrupted && _debug) sp("壊れたデータを検出しました");
+  return ! _corrupted;
+}
+
+// 非同期処理を実行中か？
+bool NfcEasyWriter::isBusy() {
+  return (_asyncState != AS_IDLE && _asyncState != AS_DONE && _asyncState != AS_FAILED);
+}
+
+// 非同期処理を中止する
+void NfcEasyWriter::cancelAsync() {
+  if (_asyncState == AS_DETECT && _irqArmed) {
+    mfrc522.PCD_EnableCardDetectIrq(false);
+    _irqArmed = false;
+  }
+  _asyncJob = AJ_NONE;
+  _asyncState = AS_IDLE;
+}
+
+// 非同期処理を終了する（状態を更新してコールバックを呼ぶ）
+void NfcEasyWriter::finishAsync(bool success) {
+  _asyncState = (success) ? AS_DONE : AS_FAILED;
+  if (_debug) spf("非同期処理 %d %s\n", _asyncJob, (success) ? "成功" : "失敗");
+  if (_asyncCallback != nullptr) _asyncCallback(_asyncJob, success);
+}
+
 // UIDを文字列で返す
 String NfcEasyWriter::getUidString() {
   String text = "";
@@ -137,8 +907,12 @@ String NfcEasyWriter::getUidString() {
 
 // カードの種類を大まかに判定する
 CardType NfcEasyWriter::checkCardType(MFRC522_I2C &mfrc522) {
+  return getCardTypeBySak(mfrc522.uid.sak);
+}
+
+CardType NfcEasyWriter::getCardTypeBySak(byte sak) {
   CardType cardType = CardType::UnknownCard;
-  byte piccType = mfrc522.PICC_GetType(mfrc522.uid.sak);
+  byte piccType = mfrc522.PICC_GetType(sak);
   if (piccType == MFRC522_I2C::PICC_TYPE_MIFARE_1K ||
       piccType == MFRC522_I2C::PICC_TYPE_MIFARE_4K) {
     cardType = CardType::Classic;          // Mifare Classic
@@ -168,7 +942,7 @@ bool NfcEasyWriter::isUltralight() {
 // [Ultralight] NTAGの容量タイプを取得する
 NtagType NfcEasyWriter::getNtagTypeUL(ProtectMode mode) {
   if (mode == PRT_AUTO) mode = _lastProtectMode;
-  if (!waitCard(5000)) return NT_UNKNOWN;  // 読み書きできる状態になるまで待つ
+  if (!selectCard()) return NT_UNKNOWN;  // 通信できる状態にする
   NtagType ntag = NT_UNKNOWN;
   byte data[16];
 
@@ -183,6 +957,7 @@ NtagType NfcEasyWriter::getNtagTypeUL(ProtectMode mode) {
       spn("getUltralightSize(): ");
       printDump1Line(data, sizeof(data));
     }
+    memcpy(_ccUL, &data[3*4], sizeof(_ccUL));   // CCを記録しておく
     if (data[3*4] == 0xE1) {
       switch (data[3*4+2]) {  // Page 3 Byte 2 : CC 
         case 0x12: ntag = NT_NTAG213; break;
@@ -221,10 +996,12 @@ uint8_t NfcEasyWriter::getConfigPageUL(NtagType ntag) {
 uint16_t NfcEasyWriter::getVCapacities() {
   uint16_t size = 0;
   if (isClassic()) {
-    size = (_maxSectorCL - _minSectorCL + 1) * 16 * 3;
+    size = nfcDataSizeCL(_minSectorCL, _lastSectorCL);
   } else if (isUltralight()) {
     size = (_maxPageUL - _minPageUL + 1) * 4;
   }
+  // ハイウォーターマークを使う場合は、最後のブロック/ページを記録に使う
+  if (useHighWater()) size -= (isClassic()) ? _writeLengthCL : _writeLengthUL;
   return size;
 }
 
@@ -238,25 +1015,122 @@ bool NfcEasyWriter::rawReadUL(byte* data, size_t dataSize, uint8_t page) {
     memcpy(data, buff, dataSize);
     return true;
   }
+  _selected = false;  // NAKでカードはIDLEに戻る
   return false;
 }
 
 // [Ultralight] 物理アドレス指定　1ページ(4バイト)書き込む
 bool NfcEasyWriter::rawWriteUL(byte* data, size_t dataSize, uint8_t page) {
   if (data == nullptr || dataSize != 4) return false;
-  return (mfrc522.MIFARE_Ultralight_Write(page, data, _writeLengthUL) == MFRC522_I2C::STATUS_OK);
+  // 使用範囲のページならハイウォーターマークも更新する（記録のページや設定ページは範囲外なので更新しない）
+  if (useHighWater() && page >= _minPageUL && (page - _minPageUL) * _writeLengthUL < getVCapacities()) {
+    if (! raiseHighWater((page - _minPageUL + 1) * _writeLengthUL)) return false;
+  }
+  if (mfrc522.MIFARE_Ultralight_Write(page, data, _writeLengthUL) == MFRC522_I2C::STATUS_OK) return true;
+  _selected = false;  // NAKでカードはIDLEに戻る
+  return false;
+}
+
+// [Ultralight] 物理アドレス指定　複数ページをまとめて読み込む（FAST_READ、非対応ならREAD）
+bool NfcEasyWriter::readPagesUL(byte* data, uint8_t startPage, uint16_t pageNum, bool protect, uint16_t* readNum) {
+  if (data == nullptr) return false;
+  byte buffer[NFC_FASTREAD_MAX_PAGES * 4 + 2];
+  byte bufferSize;
+  uint16_t done = 0;
+  bool res = true;
+
+  while (res && done < pageNum) {
+    uint8_t page = startPage + done;
+    uint16_t num = pageNum - done;
+    bool fastFailed = false;
+
+    // FAST_READでまとめて読む
+    if (_fastReadUL && !_fastReadNgUL) {
+      if (num > NFC_FASTREAD_MAX_PAGES) num = NFC_FASTREAD_MAX_PAGES;
+      bufferSize = sizeof(buffer);
+      if (mfrc522.MIFARE_Ultralight_FastRead(page, page + num - 1, buffer, &bufferSize) == MFRC522_I2C::STATUS_OK) {
+        memcpy(data + done * 4, buffer, num * 4);
+        done += num;
+        continue;
+      }
+      // NAKを受けたカードはIDLEに戻るので、選択し直してからREADで読み直す
+      if (_debug) spf("FAST_READ失敗 page=%d-%d READで読み直します\n", page, page + num - 1);
+      _selected = false;
+      if (!selectCard() || (protect && !authUL(true))) {
+        res = false;
+        break;
+      }
+      fastFailed = true;
+    }
+
+    // READで4ページずつ読む（FAST_READ失敗時はその範囲を読み直す）
+    uint16_t end = (fastFailed) ? done + num : pageNum;
+    while (done < end) {
+      uint16_t n = (end - done < 4) ? end - done : 4;
+      bufferSize = sizeof(buffer);
+      if (mfrc522.MIFARE_Read(startPage + done, buffer, &bufferSize) != MFRC522_I2C::STATUS_OK) {
+        _selected = false;  // NAKでカードはIDLEに戻る
+        res = false;
+        break;
+      }
+      memcpy(data + done * 4, buffer, n * 4);
+      done += n;
+    }
+    // READで全部読めたのにFAST_READで読めない ＝ FAST_READ非対応のカード
+    if (res && fastFailed) {
+      _fastReadNgUL = true;
+      if (_debug) sp("FAST_READ非対応のカードのため、以降はREADで読みます");
+    }
+  }
+
+  if (readNum != nullptr) *readNum = done;
+  return res;
 }
 
-// 仮想アドレスから物理アドレスに変換する
+// [Classic] セクター単位で認証する（同じセクター・同じキーで認証済みなら省略する）
+bool NfcEasyWriter::authSectorCL(uint16_t sector, bool useKeyB, MFRC522_I2C::MIFARE_Key* key) {
+  byte usekey = (useKeyB) ? MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_B : MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_A;
+  // Crypto1のセッションはセクター内の全ブロックで有効なので、同じ条件なら再認証しない
+  if (_authSectorCL == sector && _authCmdCL == usekey && memcmp(_authKeyCL.keyByte, key->keyByte, sizeof(_authKeyCL.keyByte)) == 0) {
+    _authSkipCountCL++;
+    return true;
+  }
+  _authSectorCL = -1;
+  if (mfrc522.PCD_Authenticate(usekey, nfcSectorFirstBlockCL(sector), key, &(mfrc522.uid)) != MFRC522_I2C::STATUS_OK) {
+    mfrc522.PCD_StopCrypto1();
+    _selected = false;   // 認証失敗でカードはIDLEに戻る
+    return false;
+  }
+  _authSectorCL = sector;
+  _authCmdCL = usekey;
+  _authKeyCL = *key;
+  return true;
+}
+
+// [Classic] 認証を終了する
+void NfcEasyWriter::stopAuthCL() {
+  mfrc522.PCD_StopCrypto1();
+  // カード側は認証状態のままなので、平文で通信するには選択し直す必要がある
+  if (_authSectorCL >= 0) _selected = false;
+  _authSectorCL = -1;
+}
+
+// 仮想アドレスから物理アドレスに変換する（マウント中のカードはプロファイルの変換を使う）
 PhyAddr NfcEasyWriter::addr2PhysicalAddr(uint16_t vaddr, CardType cardtype) {
-  PhyAddr pa;
-  if (cardtype == CardType::Classic) {
-    pa.sector = vaddr / (3 * _writeLengthCL);
-    pa.block = (vaddr - pa.sector * (3 * _writeLengthCL)) / _writeLengthCL;
-    pa.sector += _minSectorCL;
-    pa.blockAddr = pa.sector * 4 + pa.block; 
-  } else if (cardtype == CardType::Ultralight) {
-    pa.blockAddr = vaddr / _writeLengthUL + _minPageUL;
+  if (_core != nullptr && cardtype == _cardType) return (this->*(_core->addr))(vaddr);
+  if (cardtype == CardType::Classic) return addrCore<NfcProfileClassicCustom>(vaddr);
+  if (cardtype == CardType::Ultralight) return addrCore<NfcProfileUltralightCustom>(vaddr);
+  PhyAddr pa = { 0, 0, 0 };
+  return pa;
+}
+
+// [プロファイル] 仮想アドレスから物理アドレスに変換する（使用範囲が定数なら計算もコンパイル時に決まる）
+template <typename P> PhyAddr NfcEasyWriter::addrCore(uint16_t vaddr) {
+  PhyAddr pa = { 0, 0, 0 };
+  if (P::type == CardType::Classic) {
+    pa = nfcAddrToPhysicalCL(vaddr, (P::fixed) ? P::first : _minSectorCL);
+  } else {
+    pa.blockAddr = vaddr / P::writeLength + ((P::fixed) ? P::first : _minPageUL);
     if (pa.blockAddr > 255) pa.blockAddr = 255;
   }
   return pa;
@@ -267,23 +1141,59 @@ bool NfcEasyWriter::readData(uint16_t vaddr, void* data, size_t dataSize, Protec
   if (! isMounted()) return false;
   if (mode == PRT_AUTO) mode = _lastProtectMode;
 
+  if (_shadowEnabled && checkShadow()) {
+    return readShadow(vaddr, reinterpret_cast<byte *>(data), dataSize, mode);  // RAMシャドウ経由
+  }
+
+  // ハイウォーターマークより後ろは書き込まれていない（0のまま）ので、カードから読まない
+  size_t readSize = dataSize;
+  if (useHighWater() && vaddr + dataSize <= getVCapacities()) {
+    uint16_t used = getUsedSize(mode);
+    if (vaddr + dataSize > used) {
+      readSize = (vaddr < used) ? used - vaddr : 0;
+      memset(reinterpret_cast<byte *>(data) + readSize, 0, dataSize - readSize);
+      if (readSize == 0) return true;
+    }
+  }
+
+  if (! transferData(false, vaddr, reinterpret_cast<byte *>(data), readSize, mode)) return false;
+
+  // 完全性チェックのタグと比べる（壊れていればfalseを返して_corruptedをtrueにする）
+  if (_integrity && _tagLoaded) {
+    _corrupted = ! checkIntegrity(vaddr, reinterpret_cast<byte *>(data), dataSize);
+    if (_corrupted) {
+      if (_debug) sp("壊れたデータを検出しました");
+      return false;
+    }
+  }
+  return true;
+}
+
+// 読み書きの本体（通信エラーなら選択し直して1回だけやり直す。RAMシャドウや完全性チェックは通さない）
+bool NfcEasyWriter::transferData(bool write, uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
   bool res = false;
-  if (_cardType == CardType::Classic) {
-    res = readDataCL(vaddr, reinterpret_cast<byte *>(data), dataSize, mode);
-  } else if (_cardType == CardType::Ultralight) {
-    res = readDataUL(vaddr, reinterpret_cast<byte *>(data), dataSize, mode);
+  if (_core == nullptr) return false;
+  for (uint8_t i=0; i<2; i++) {
+    res = (write) ? (this->*(_core->write))(vaddr, data, dataSize, mode) : (this->*(_core->read))(vaddr, data, dataSize, mode);
+    // 通信エラー（カードの置き直しなど）の場合は、選択し直して1回だけやり直す
+    if (res || _selected || !_retryOnError || i > 0) break;
+    mfrc522._stats.retryCount++;
   }
   return res;
 }
 
-// [Classic] カードからバイト配列型へデータを読み込む
+// [Classic] カードからバイト配列型へデータを読み込む（マウント時に選んだプロファイルの本体を呼ぶ）
 bool NfcEasyWriter::readDataCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
-  if (! isClassic()) return false;
+  if (! isClassic() || _core == nullptr) return false;
+  return (this->*(_core->read))(vaddr, data, dataSize, mode);
+}
+
+// [プロファイル][Classic] カードからバイト配列型へデータを読み込む
+template <typename P> bool NfcEasyWriter::readCoreCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
   if (mode == PRT_AUTO) mode = _lastProtectMode;
-  if (vaddr % _writeLengthCL != 0) return false;  // 16バイト単位ではないアドレスは拒否
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
+  if (!selectCard()) return false;  // 通信できる状態にする
 
-  // ブロックごとのループ
+  // ブロックごとのループ（ブロックの途中から/途中までの場合は必要な部分だけコピーする）
   size_t cplen;
   byte buffer[18];
   byte bufferSize = sizeof(buffer);
@@ -294,23 +1204,22 @@ bool NfcEasyWriter::readDataCL(uint16_t vaddr, byte* data, size_t dataSize, Prot
 
   while (remain > 0) {
     // 読み込みセクタ/ブロックまたはページを求める
-    PhyAddr pa = addr2PhysicalAddr(vaddr + index, CardType::Classic);
+    PhyAddr pa = addrCore<P>(vaddr + index);
     if (_debug) {
       String keyStr = (protect ? "B" : "A");
-      spf("Index=%d 読み込み元 Sector/Block=%d/%d -> blockAddr=%d key=%s\n", index, pa.sector, pa.block, pa.blockAddr, keyStr);
+      spf("Index=%d 読み込み元 Sector/Block=%d/%d -> blockAddr=%d key=%s\n", (int)index, pa.sector, pa.block, pa.blockAddr, keyStr.c_str());
     }
-    // 認証
-    auto usekey = (protect) ? MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_B : MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_A;
-    auto keyRead = (protect) ? _authKeyB : _authKeyA;
-    if (mfrc522.PCD_Authenticate(usekey, pa.blockAddr, &keyRead, &(mfrc522.uid)) != MFRC522_I2C::STATUS_OK) { // 認証
+    // 認証（セクターが変わったときだけ）
+    if (! authSectorCL(pa.sector, protect, (protect) ? &_authKeyB : &_authKeyA)) {
       if (_debug) sp("  認証失敗");
       abort = true;
     }
     // 読み込み実行
     if (!abort && mfrc522.MIFARE_Read(pa.blockAddr, buffer, &bufferSize) == MFRC522_I2C::STATUS_OK) {
         // データをコピー
-        cplen = ((remain - _readLength) < 0) ? remain : _readLength;
-        memcpy(((byte*)data) + index, buffer, cplen);
+        size_t offset = (vaddr + index) % P::writeLength;
+        cplen = ((remain - (int)(P::writeLength - offset)) < 0) ? remain : P::writeLength - offset;
+        memcpy(((byte*)data) + index, buffer + offset, cplen);
         if (_debug) {
           spn("  Data: ");
           printDump1Line(buffer, sizeof(buffer));
@@ -324,186 +1233,1031 @@ bool NfcEasyWriter::readDataCL(uint16_t vaddr, byte* data, size_t dataSize, Prot
     remain -= cplen;
   }//while-remain
 
-  // 認証終了
-  mfrc522.PCD_StopCrypto1();
-  if (abort) return false;
+  // 認証は次の読み書きのために維持する（失敗時はカードがIDLEに戻っているので終了する）
+  if (abort) {
+    stopAuthCL();
+    _selected = false;
+    return false;
+  }
 
   return true;
 }
 
-// [Ultralight] カードからバイト配列型へデータを読み込む
+// [Ultralight] カードからバイト配列型へデータを読み込む（マウント時に選んだプロファイルの本体を呼ぶ）
 bool NfcEasyWriter::readDataUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
-  if (! isUltralight()) return false;
+  if (! isUltralight() || _core == nullptr) return false;
+  return (this->*(_core->read))(vaddr, data, dataSize, mode);
+}
+
+// [プロファイル][Ultralight] カードからバイト配列型へデータを読み込む
+template <typename P> bool NfcEasyWriter::readCoreUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
   if (mode == PRT_AUTO) mode = _lastProtectMode;
-  if (vaddr % _writeLengthUL != 0) return false;  // 4バイト単位ではないアドレスは拒否
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
+  if (!selectCard()) return false;  // 通信できる状態にする
 
-  // ブロックごとのループ
-  size_t cplen;
-  byte buffer[18];
-  byte bufferSize = sizeof(buffer);
-  int remain = dataSize;
-  size_t index = 0;
-  bool abort = false;
+  // 準備（ページの途中から/途中までの場合は、前後の余分なバイトも含めてページ単位で読む）
+  bool protect = (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO);
+  PhyAddr pa = addrCore<P>(vaddr);
+  size_t head = vaddr % P::writeLength;
+  uint16_t pageNum = (head + dataSize + P::writeLength - 1) / P::writeLength;
+  byte buffer[NFC_FASTREAD_MAX_PAGES * 4];
+  size_t index = 0;   // ページ単位で読む範囲の先頭からの位置
 
   // 認証がかかっている場合は、まず認証する
-  if (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO) {
+  if (protect) {
     if (! authUL(true)) return false;   
   }
 
-  // ブロックごとのループ　最小読み込み単位ごとに分割して読み込む
+  // FAST_READで読める単位ごとにまとめて読み込む
+  while (index < head + dataSize) {
+    uint16_t page = pa.blockAddr + index / P::writeLength;
+    uint16_t num = pageNum - index / P::writeLength;
+    if (num > NFC_FASTREAD_MAX_PAGES) num = NFC_FASTREAD_MAX_PAGES;
+    if (_debug) {
+      spf("Index=%d 読み込み元 Page=%d-%d\n", (int)index, page, page + num - 1);
+    }
+    if (page > 255 || ! readPagesUL(buffer, page, num, protect)) {
+      if (_debug) sp(".. 読み込み失敗");
+      return false;
+    }
+    // データをコピー
+    size_t skip = (index < head) ? head - index : 0;
+    size_t cplen = (head + dataSize - index < (size_t)num * 4) ? head + dataSize - index : num * 4;
+    memcpy(data + index + skip - head, buffer + skip, cplen - skip);
+    if (_debug) {
+      spn("  Data: ");
+      printDump1Line(buffer, num * 4);
+    }
+    index += cplen;
+  }
+
+  return true;
+}
+
+// [共通] バイト配列型のデータをカードに書き込む
+bool NfcEasyWriter::writeData(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode) {
+  if (! isMounted()) return false;
+  if (mode == PRT_AUTO) mode = _lastProtectMode;
+  if (_debug) Serial.println("Total Data size="+String(dataSize));
+  _diffSkipCount = 0;
+
+  if (_shadowEnabled && checkShadow()) {
+    return writeShadow(vaddr, reinterpret_cast<byte *>(data), dataSize, mode);  // RAMシャドウに書き込むだけ（flush()で反映）
+  }
+
+  // 完全性チェックの範囲に書き込む場合は、タグも更新する（タグの記録場所には書き込めない）
+  if (_integrity) {
+    if (! _tagLoaded) verifyIntegrity(mode);  // タグを読めていなければ読み直す
+    uint16_t tagEnd = _tagAddr + _tagCount * 4;
+    if (_tagCount > 0 && vaddr < tagEnd && vaddr + dataSize > _tagAddr) return false;
+    if (_tagCount > 0 && vaddr < _tagVaddr + _tagSize && vaddr + dataSize > _tagVaddr) {
+      if (! _tagLoaded) return false;
+      if (! raiseHighWater(tagEnd, mode)) return false;   // タグまで含めて使用中の範囲にする
+      return writeDataTagged(vaddr, reinterpret_cast<byte *>(data), dataSize, mode);
+    }
+  }
+
+  return transferData(true, vaddr, reinterpret_cast<byte *>(data), dataSize, mode);
+}
+
+// [Classic] バイト配列型のデータをカードに書き込む（マウント時に選んだプロファイルの本体を呼ぶ）
+bool NfcEasyWriter::writeDataCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
+  if (! isClassic() || _core == nullptr) return false;
+  return (this->*(_core->write))(vaddr, data, dataSize, mode);
+}
+
+// [プロファイル][Classic] バイト配列型のデータをカードに書き込む
+template <typename P> bool NfcEasyWriter::writeCoreCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
+  if (mode == PRT_AUTO) mode = _lastProtectMode;
+  if (!selectCard()) return false;  // 通信できる状態にする
+  const uint16_t first = (P::fixed) ? P::first : _minSectorCL;   // 使用するセクターの範囲
+  const uint16_t last = (P::fixed) ? P::last : _lastSectorCL;
+  if (! raiseHighWater(vaddr + dataSize, mode)) return false;  // 入口で範囲全体について更新済みなら何もしない
+
+  // 準備
+  byte buffer[P::writeLength];
+  int remain = dataSize;
+  size_t index = 0;
+  bool abort = false;
+  bool protect = (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO);
+  bool diff = _diffWrite;
+
+  // ブロックごとのループ　最小書き込み単位ごとに分割して書き込む
   while (remain > 0) {
-    // 読み込みセクタ/ブロックまたはページを求める
-    PhyAddr pa = addr2PhysicalAddr(vaddr + index, CardType::Ultralight);
+    // ブロックの途中から/途中までの場合は、残りの部分をカードの内容と合わせる
+    size_t offset = (vaddr + index) % P::writeLength;
+    size_t cplen = ((remain - (int)(P::writeLength - offset)) < 0) ? remain : P::writeLength - offset;
+    bool partial = (cplen < P::writeLength);
+
+    // 書き込みセクタ/ブロックを求める
+    PhyAddr pa = addrCore<P>(vaddr + index);
+    if (pa.sector > last) return false;
+    if (pa.sector < first) return false;
+    if (pa.block >= nfcSectorBlocksCL(pa.sector) - 1) return false;   // セクタートレーラーには書き込まない
     if (_debug) {
-      spf("Index=%d 読み込み元 Page=%d\n", index, pa.blockAddr);
+      String keyStr = (protect ? "B" : "A");
+      spf("Index=%d 書き込み先 Sector/Block=%d/%d -> blockAddr=%d key=%s offset=%d\n", (int)index, pa.sector, pa.block, pa.blockAddr, keyStr.c_str(), (int)offset);
     }
-    // 読み込み実行
-    if (!abort && mfrc522.MIFARE_Read(pa.blockAddr, buffer, &bufferSize) == MFRC522_I2C::STATUS_OK) {
-        // データをコピー
-        cplen = ((remain - _readLength) < 0) ? remain : _readLength;
-        memcpy(((byte*)data) + index, buffer, cplen);
-        if (_debug) {
-          spn("  Data: ");
-          printDump1Line(buffer, sizeof(buffer));
-        }
+
+    // 認証（セクターが変わったときだけ）
+    bool authed = authSectorCL(pa.sector, protect, (protect) ? &_authKeyB : &_authKeyA);
+
+    // 同じ認証のまま現在の内容を読み込む（途中からのブロックと差分書き込みの場合）
+    byte rbuff[18];
+    byte rbuffSize = sizeof(rbuff);
+    bool current = false;
+    if (authed && (partial || diff)) {
+      if (mfrc522.MIFARE_Read(pa.blockAddr, rbuff, &rbuffSize) == MFRC522_I2C::STATUS_OK) {
+        current = true;
+      } else if (partial) {
+        if (_debug) sp("  読み込み失敗");  // 合わせる内容がわからないので書き込めない
+        authed = false;
+      } else {
+        // 読めない場合はカードがIDLEに戻るので、選択し直して以降は通常の書き込みにする
+        if (_debug) sp("  読み込み失敗 差分書き込みを中止");
+        diff = false;
+        stopAuthCL();
+        authed = selectCard() && authSectorCL(pa.sector, protect, (protect) ? &_authKeyB : &_authKeyA);
+      }
+    }
+    if (current) memcpy(buffer, rbuff, P::writeLength);
+    else memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer + offset, ((byte*)data) + index, cplen);
+    if (_debug) {
+      spn("  Data: ");
+      printDump1Line(buffer, sizeof(buffer));
+    }
+
+    // 差分書き込み　カードの内容と同じなら書き込まない
+    if (authed && diff && current) {
+      if (memcmp(rbuff, buffer, P::writeLength) == 0) {
+        if (_debug) sp("  同じ内容のため省略");
+        _diffSkipCount++;
+        index += cplen;
+        remain -= cplen;
+        continue;
+      }
+    }
+
+    if (authed) {
+      // 書き込み
+      if (mfrc522.MIFARE_Write(pa.blockAddr, buffer, P::writeLength) == MFRC522_I2C::STATUS_OK) {
+        if (_debug) sp("  書き込み成功");
+      } else {
+        if (_debug) sp("  書き込み失敗");
+        abort = true;
+      }
     } else {
-      if (_debug) sp(".. 読み込み失敗");
+      if (_debug) sp("  認証失敗");
       abort = true;
     }
+
     if (abort) break;
     index += cplen;
     remain -= cplen;
   }//while-remain
-  if (abort) return false;
 
-  return true;
+  // 認証は次の読み書きのために維持する（失敗時はカードがIDLEに戻っているので終了する）
+  if (abort) {
+    stopAuthCL();
+    _selected = false;
+    return false;
+  }
+
+  return true;
+}
+
+// [Ultralight] バイト配列型のデータをカードに書き込む（マウント時に選んだプロファイルの本体を呼ぶ）
+bool NfcEasyWriter::writeDataUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
+  if (! isUltralight() || _core == nullptr) return false;
+  return (this->*(_core->write))(vaddr, data, dataSize, mode);
+}
+
+// [プロファイル][Ultralight] バイト配列型のデータをカードに書き込む
+template <typename P> bool NfcEasyWriter::writeCoreUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
+  if (mode == PRT_AUTO) mode = _lastProtectMode;
+  if (!selectCard()) return false;  // 通信できる状態にする
+  if (dataSize == 0) return true;
+  const uint16_t first = (P::fixed) ? P::first : _minPageUL;   // 使用するページの範囲
+  const uint16_t last = (P::fixed) ? P::last : _maxPageUL;
+  if (! raiseHighWater(vaddr + dataSize, mode)) return false;  // 入口で範囲全体について更新済みなら何もしない
+
+  // 準備
+  byte buffer[P::writeLength];
+  PhyAddr pa = addrCore<P>(vaddr);
+  size_t head = vaddr % P::writeLength;  // 先頭ページの途中から書き込む場合のバイト数
+  uint16_t pageNum = (head + dataSize + P::writeLength - 1) / P::writeLength;
+  bool partial = (head != 0 || (head + dataSize) % P::writeLength != 0);
+  bool protect = (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO);
+  bool diff = _diffWrite;
+  bool res = true;
+  if (pa.blockAddr < first || pa.blockAddr + pageNum - 1 > last) return false;
+
+  // 認証がかかっている場合は、まず認証する
+  if (protect) {
+    if (! authUL(true)) return false;   
+  }
+
+  // 書き込む範囲の現在の内容をまとめて読み込んでおく（差分書き込みと、ページの途中から/途中までの場合）
+  // 途中のページを合わせるだけなら、FAST_READ1回で読めない範囲は先頭と最後のページだけ読む
+  byte* current = nullptr;
+  if (diff || partial) {
+    current = (byte*) calloc(pageNum, P::writeLength);
+    if (current == nullptr) return false;
+    bool rres;
+    if (diff || pageNum <= NFC_FASTREAD_MAX_PAGES) {
+      rres = readPagesUL(current, pa.blockAddr, pageNum, protect);
+    } else {
+      rres = (head == 0 || readPagesUL(current, pa.blockAddr, 1, protect))
+        && ((head + dataSize) % P::writeLength == 0 || readPagesUL(current + (pageNum - 1) * P::writeLength, pa.blockAddr + pageNum - 1, 1, protect));
+    }
+    if (! rres) {
+      _selected = false;
+      if (partial) {
+        if (_debug) sp("読み込み失敗");  // 合わせる内容がわからないので書き込めない
+        free(current);
+        return false;
+      }
+      // 読めない場合はカードがIDLEに戻るので、選択し直して通常の書き込みにする
+      if (_debug) sp("読み込み失敗 差分書き込みを中止");
+      free(current);
+      current = nullptr;
+      diff = false;
+      if (!selectCard() || (protect && !authUL(true))) return false;
+    }
+  }
+
+  // ページごとのループ　最小書き込み単位ごとに分割して書き込む
+  for (uint16_t p=0; p<pageNum; p++) {
+    size_t sta = (p == 0) ? head : 0;  // ページ内の書き込み範囲
+    size_t end = (p == pageNum - 1) ? (head + dataSize - 1) % P::writeLength + 1 : P::writeLength;
+    size_t index = p * P::writeLength + sta - head;
+    if (current != nullptr) memcpy(buffer, current + p * P::writeLength, P::writeLength);
+    else memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer + sta, ((byte*)data) + index, end - sta);
+    uint16_t page = pa.blockAddr + p;
+    if (_debug) {
+      spf("Index=%d 書き込み先 Page=%d\n", (int)index, page);
+      spn("  Data: ");
+      printDump1Line(buffer, sizeof(buffer));
+    }
+
+    // 書き込み（差分書き込みでカードの内容と同じなら省略）
+    if (diff && memcmp(current + p * P::writeLength, buffer, P::writeLength) == 0) {
+      if (_debug) sp("..同じ内容のため省略");
+      _diffSkipCount++;
+    } else if (mfrc522.MIFARE_Ultralight_Write(page, buffer, P::writeLength)  == MFRC522_I2C::STATUS_OK) {
+      if (_debug) sp("..ok");
+    } else {
+      if (_debug) sp(".. 書き込み失敗");
+      _selected = false;  // NAKでカードはIDLEに戻る
+      res = false;
+      break;
+    }
+  }
+
+  free(current);
+  return res;
+}
+
+// readStream()/writeStream()で1回に読み書きするバイト数（Classicは3ブロック、UltralightはFAST_READ 1回分）
+uint16_t NfcEasyWriter::getStreamChunk() {
+  if (isClassic()) return _writeLengthCL * 3;
+  return (NFC_FASTREAD_MAX_PAGES * _writeLengthUL <= NFC_STREAM_CHUNK) ? NFC_FASTREAD_MAX_PAGES * _writeLengthUL : NFC_STREAM_CHUNK;
+}
+
+// Streamとの受け渡し（readStream()/writeStream()用）
+static bool streamWriteFunc(void* ctx, size_t /*offset*/, byte* buff, size_t len) {
+  return (reinterpret_cast<Stream*>(ctx)->write(buff, len) == len);
+}
+static bool streamReadFunc(void* ctx, size_t /*offset*/, byte* buff, size_t len) {
+  return (reinterpret_cast<Stream*>(ctx)->readBytes(buff, len) == len);
+}
+
+// カードから少しずつ読み込んで、関数やStreamに渡す（データ全体のバッファを用意しなくてよい）
+bool NfcEasyWriter::readStream(uint16_t vaddr, size_t dataSize, NfcStreamFunc func, void* ctx, ProtectMode mode) {
+  if (! isMounted() || func == nullptr) return false;
+  byte buff[NFC_STREAM_CHUNK];
+  uint16_t unit = (isClassic()) ? _writeLengthCL : _writeLengthUL;
+  size_t chunk = getStreamChunk();
+  for (size_t offset=0; offset<dataSize; ) {
+    size_t len = chunk - (vaddr + offset) % unit;   // 2回目以降は書き込み単位の境界から読む
+    if (len > dataSize - offset) len = dataSize - offset;
+    if (! readData(vaddr + offset, buff, len, mode)) return false;
+    if (! func(ctx, offset, buff, len)) return false;
+    offset += len;
+  }
+  return true;
+}
+bool NfcEasyWriter::readStream(uint16_t vaddr, size_t dataSize, Stream& stream, ProtectMode mode) {
+  return readStream(vaddr, dataSize, streamWriteFunc, &stream, mode);
+}
+
+// 関数やStreamから少しずつ受け取って、カードに書き込む（データ全体のバッファを用意しなくてよい）
+bool NfcEasyWriter::writeStream(uint16_t vaddr, size_t dataSize, NfcStreamFunc func, void* ctx, ProtectMode mode) {
+  if (! isMounted() || func == nullptr) return false;
+  byte buff[NFC_STREAM_CHUNK];
+  uint16_t unit = (isClassic()) ? _writeLengthCL : _writeLengthUL;
+  size_t chunk = getStreamChunk();
+  uint16_t skip = 0;
+  // ハイウォーターマークは範囲全体で1回だけ更新する（RAMシャドウ経由ならflush()で更新する）
+  if (! (_shadowEnabled && checkShadow()) && ! raiseHighWater(vaddr + dataSize, mode)) return false;
+  for (size_t offset=0; offset<dataSize; ) {
+    size_t len = chunk - (vaddr + offset) % unit;   // 2回目以降は書き込み単位の境界から書き込む
+    if (len > dataSize - offset) len = dataSize - offset;
+    if (! func(ctx, offset, buff, len)) return false;
+    if (! writeData(vaddr + offset, buff, len, mode)) return false;
+    skip += _diffSkipCount;
+    offset += len;
+  }
+  _diffSkipCount = skip;
+  return true;
+}
+bool NfcEasyWriter::writeStream(uint16_t vaddr, size_t dataSize, Stream& stream, ProtectMode mode) {
+  return writeStream(vaddr, dataSize, streamReadFunc, &stream, mode);
+}
+
+// 指定した範囲を同じ値で埋める（バッファは最初に1回だけ埋めて使い回す）
+bool NfcEasyWriter::fillData(uint16_t vaddr, size_t dataSize, byte value, ProtectMode mode) {
+  if (! isMounted()) return false;
+  byte buff[NFC_STREAM_CHUNK];
+  memset(buff, value, sizeof(buff));
+  uint16_t unit = (isClassic()) ? _writeLengthCL : _writeLengthUL;
+  size_t chunk = getStreamChunk();
+  uint16_t skip = 0;
+  if (! (_shadowEnabled && checkShadow()) && ! raiseHighWater(vaddr + dataSize, mode)) return false;
+  for (size_t offset=0; offset<dataSize; ) {
+    size_t len = chunk - (vaddr + offset) % unit;
+    if (len > dataSize - offset) len = dataSize - offset;
+    if (! writeData(vaddr + offset, buff, len, mode)) return false;
+    skip += _diffSkipCount;
+    offset += len;
+  }
+  _diffSkipCount = skip;
+  return true;
+}
+
+// ハイウォーターマークの記録 [0xFE, 下位, 上位, チェック]（0で埋めたブロック/ページは記録なしになる）
+static void packHighWater(byte* rec, uint16_t used) {
+  rec[0] = 0xFE;
+  rec[1] = used & 0xFF;
+  rec[2] = used >> 8;
+  rec[3] = rec[1] ^ rec[2] ^ 0xA5;
+}
+
+// 使用中の範囲のサイズ（ハイウォーターマーク）を取得する　使わない場合や記録が無い場合は容量を返す
+uint16_t NfcEasyWriter::getUsedSize(ProtectMode mode) {
+  uint16_t cap = getVCapacities();
+  if (! useHighWater()) return cap;
+  if (mode == PRT_AUTO) mode = _lastProtectMode;
+  if (! _highWaterLoaded) loadHighWater(mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO);
+  return (_highWaterMark >= 0 && _highWaterMark < cap) ? _highWaterMark : cap;
+}
+
+// ハイウォーターマークを使うか？
+bool NfcEasyWriter::useHighWater() {
+  return (_highWater && isMounted());
+}
+
+// ハイウォーターマークの記録場所（使用範囲の最後のブロック/ページ）
+// セクター0のMADやページ4のNDEFなど、ライブラリが使わない場所には書き込まない
+PhyAddr NfcEasyWriter::getHighWaterAddr() {
+  return addr2PhysicalAddr(getVCapacities(), _cardType);
+}
+
+// ハイウォーターマークをカードから読み込む（記録が無ければ-1）
+bool NfcEasyWriter::loadHighWater(bool protect) {
+  if (! isMounted()) return false;
+  if (!selectCard()) return false;  // 通信できる状態にする
+  byte buffer[18];
+  byte bufferSize = sizeof(buffer);
+  PhyAddr pa = getHighWaterAddr();
+  bool res;
+  if (isClassic()) {
+    // データと同じキーで読む
+    res = authSectorCL(pa.sector, protect, (protect) ? &_authKeyB : &_authKeyA)
+      && mfrc522.MIFARE_Read(pa.blockAddr, buffer, &bufferSize) == MFRC522_I2C::STATUS_OK;
+    if (! res) {
+      stopAuthCL();
+      _selected = false;
+    }
+  } else {
+    res = (! protect || authUL(true)) && readPagesUL(buffer, pa.blockAddr, 1, protect);
+  }
+  if (! res) {
+    if (_debug) sp("ハイウォーターマークの読み込み失敗");
+    return false;   // 読めなかった場合は次回読み直す
+  }
+  uint16_t used = buffer[1] | (buffer[2] << 8);
+  byte rec[4];
+  packHighWater(rec, used);
+  _highWaterMark = (memcmp(rec, buffer, sizeof(rec)) == 0) ? used : -1;
+  _highWaterLoaded = true;
+  if (_debug) spp("high water mark", _highWaterMark);
+  return true;
+}
+
+// ハイウォーターマークをカードに書き込む
+bool NfcEasyWriter::storeHighWater(uint16_t used, bool protect) {
+  if (! isMounted()) return false;
+  if (!selectCard()) return false;  // 通信できる状態にする
+  byte buffer[16];
+  memset(buffer, 0, sizeof(buffer));
+  packHighWater(buffer, used);
+  PhyAddr pa = getHighWaterAddr();
+  bool res;
+  if (isClassic()) {
+    // 記録用のブロックなので、残りの12バイトは0にする
+    res = authSectorCL(pa.sector, protect, (protect) ? &_authKeyB : &_authKeyA)
+      && mfrc522.MIFARE_Write(pa.blockAddr, buffer, _writeLengthCL) == MFRC522_I2C::STATUS_OK;
+    if (! res) {
+      stopAuthCL();
+      _selected = false;
+    }
+  } else {
+    res = (! protect || authUL(true)) && rawWriteUL(buffer, _writeLengthUL, pa.blockAddr);
+  }
+  _highWaterMark = used;
+  _highWaterLoaded = res;   // 書き込めたかわからない場合は次回読み直す
+  if (_debug) spf("high water mark=%d %s\n", used, (res ? "ok" : "書き込み失敗"));
+  return res;
+}
+
+// 書き込む範囲がハイウォーターマークを超える場合は、データより先に記録を更新する
+// （先に更新しておけば、途中でカードが離れても書き込んだデータは必ず使用中の範囲に入る）
+// ブロック/ページごとに呼ぶと記録を何度も書き込むので、writeData()などの入口で範囲全体について1回だけ呼ぶ
+bool NfcEasyWriter::raiseHighWater(uint16_t end, ProtectMode mode) {
+  if (! useHighWater()) return true;
+  if (end > getVCapacities()) return false;   // 範囲外の書き込みは失敗するので、記録も更新しない
+  if (mode == PRT_AUTO) mode = _lastProtectMode;
+  bool protect = (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO);
+  if (! _highWaterLoaded && ! loadHighWater(protect)) return false;
+  if (_highWaterMark < 0 || end <= _highWaterMark) return true;   // 記録が無い場合は全領域を使用中とみなす
+  uint16_t unit = (isClassic()) ? _writeLengthCL : _writeLengthUL;
+  return storeHighWater((end + unit - 1) / unit * unit, protect);
+}
+
+// 差分書き込み（カードの内容と同じブロック/ページは書き込まない）　戻り値は省略した書き込み回数、失敗時は-1
+int NfcEasyWriter::writeDataDiff(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode) {
+  bool backup = _diffWrite;
+  _diffWrite = true;
+  bool res = writeData(vaddr, data, dataSize, mode);
+  _diffWrite = backup;
+  return (res) ? _diffSkipCount : -1;
+}
+
+// 圧縮データの形式
+//   ヘッダ  [0]形式 NFC_PACK_RAW=無圧縮 NFC_PACK_LZ=圧縮  [1-3]圧縮後のサイズ(下位12bit)と元のサイズ(上位12bit)
+//   圧縮データは以下の制御バイトの並び
+//     0x00-0x7F  続く(c+1)バイトはそのまま（1～128バイト）
+//     0x80-0x9F  0が(c-0x80+2)バイト続く（2～33バイト）
+//     0xA0-0xFF  次のバイトをoとして、(o+1)バイト前から(c-0xA0+3)バイトをコピーする（3～98バイト、距離1～256）
+#define NFC_PACK_RAW  0xC0
+#define NFC_PACK_LZ   0xC1
+
+// データを圧縮する（LZ77＋ゼロの連続）　戻り値は圧縮後のバイト数、dstに収まらなければ0
+size_t NfcEasyWriter::compressData(const byte* src, size_t srcSize, byte* dst, size_t dstSize) {
+  size_t pos = 0, out = 0;
+  size_t litStart = 0, litLen = 0;   // まだ出力していないそのままのバイト
+  while (pos <= srcSize) {
+    size_t zeroLen = 0, matchLen = 0, matchDist = 0;
+    if (pos < srcSize) {
+      // 0の連続
+      while (pos + zeroLen < srcSize && src[pos + zeroLen] == 0 && zeroLen < 33) zeroLen++;
+      // 256バイト前までで一番長く一致する場所
+      for (size_t dist=1; dist<=256 && dist<=pos; dist++) {
+        size_t len = 0;
+        while (pos + len < srcSize && src[pos + len] == src[pos + len - dist] && len < 98) len++;
+        if (len > matchLen) {
+          matchLen = len;
+          matchDist = dist;
+          if (len == 98) break;
+        }
+      }
+    }
+
+    // そのままのバイトを出力する（一致が見つかった、128バイトたまった、最後まで来た）
+    bool useZero = (zeroLen >= 2 && zeroLen + 1 >= matchLen);   // 1バイトで表せるので少し短くても優先する
+    bool useMatch = (! useZero && matchLen >= 3);
+    if (litLen > 0 && (useZero || useMatch || litLen == 128 || pos == srcSize)) {
+      if (out + 1 + litLen > dstSize) return 0;
+      dst[out++] = litLen - 1;
+      memcpy(&dst[out], &src[litStart], litLen);
+      out += litLen;
+      litLen = 0;
+    }
+    if (pos == srcSize) break;
+
+    if (useZero) {
+      if (out + 1 > dstSize) return 0;
+      dst[out++] = 0x80 + zeroLen - 2;
+      pos += zeroLen;
+    } else if (useMatch) {
+      if (out + 2 > dstSize) return 0;
+      dst[out++] = 0xA0 + matchLen - 3;
+      dst[out++] = matchDist - 1;
+      pos += matchLen;
+    } else {
+      if (litLen == 0) litStart = pos;
+      litLen++;
+      pos++;
+    }
+  }
+  return out;
+}
+
+// 圧縮したデータを展開する　戻り値は展開したバイト数、壊れたデータやdstに収まらなければ0
+size_t NfcEasyWriter::decompressData(const byte* src, size_t srcSize, byte* dst, size_t dstSize) {
+  size_t pos = 0, out = 0;
+  while (pos < srcSize) {
+    byte c = src[pos++];
+    if (c < 0x80) {
+      size_t len = c + 1;
+      if (pos + len > srcSize || out + len > dstSize) return 0;
+      memcpy(&dst[out], &src[pos], len);
+      pos += len;
+      out += len;
+    } else if (c < 0xA0) {
+      size_t len = c - 0x80 + 2;
+      if (out + len > dstSize) return 0;
+      memset(&dst[out], 0, len);
+      out += len;
+    } else {
+      if (pos >= srcSize) return 0;
+      size_t len = c - 0xA0 + 3;
+      size_t dist = src[pos++] + 1;
+      if (dist > out || out + len > dstSize) return 0;
+      for (size_t i=0; i<len; i++, out++) dst[out] = dst[out - dist];  // 重なっていてもよいように1バイトずつ
+    }
+  }
+  return out;
+}
+
+// 圧縮してカードに書き込む（先頭4バイトはヘッダ）　戻り値はヘッダを含めて書き込んだバイト数、失敗時は-1
+int NfcEasyWriter::writeCompressed(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode) {
+  if (! isMounted()) return -1;
+  if (dataSize == 0 || dataSize > NFC_PACK_MAXSIZE) return -1;
+  byte* buff = (byte*) malloc(NFC_PACK_HEADER + dataSize);
+  if (buff == nullptr) {
+    if (_debug) sp("メモリが確保できません");
+    return -1;
+  }
+
+  // 圧縮して小さくならなければそのまま書き込む
+  size_t packSize = compressData(reinterpret_cast<byte *>(data), dataSize, &buff[NFC_PACK_HEADER], dataSize - 1);
+  buff[0] = NFC_PACK_LZ;
+  if (packSize == 0) {
+    memcpy(&buff[NFC_PACK_HEADER], data, dataSize);
+    packSize = dataSize;
+    buff[0] = NFC_PACK_RAW;
+  }
+  buff[1] = packSize & 0xFF;
+  buff[2] = ((packSize >> 8) & 0x0F) | ((dataSize & 0x0F) << 4);
+  buff[3] = dataSize >> 4;
+  int writeSize = NFC_PACK_HEADER + packSize;
+  if (_debug) spf("圧縮 %d -> %d bytes\n", (int)dataSize, (int)packSize);
+
+  bool res = (vaddr + writeSize <= getVCapacities()) && writeData(vaddr, buff, writeSize, mode);
+  free(buff);
+  return (res) ? writeSize : -1;
+}
+
+// writeCompressed()で書き込んだデータを読み込んで展開する　戻り値は展開したバイト数、失敗時は-1
+int NfcEasyWriter::readCompressed(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode) {
+  byte head[NFC_PACK_HEADER];
+  if (! readData(vaddr, head, sizeof(head), mode)) return -1;
+  size_t packSize = head[1] | ((head[2] & 0x0F) << 8);
+  size_t rawSize = (head[2] >> 4) | (head[3] << 4);
+  if ((head[0] != NFC_PACK_LZ && head[0] != NFC_PACK_RAW) || packSize == 0 || rawSize == 0) {
+    if (_debug) sp("圧縮データではありません");
+    return -1;
+  }
+  if (rawSize > dataSize || vaddr + NFC_PACK_HEADER + packSize > getVCapacities()) return -1;
+
+  // 無圧縮ならそのまま読み込む
+  if (head[0] == NFC_PACK_RAW) {
+    if (packSize != rawSize) return -1;
+    return (readData(vaddr + NFC_PACK_HEADER, data, rawSize, mode)) ? rawSize : -1;
+  }
+
+  byte* buff = (byte*) malloc(packSize);
+  if (buff == nullptr) {
+    if (_debug) sp("メモリが確保できません");
+    return -1;
+  }
+  bool res = readData(vaddr + NFC_PACK_HEADER, buff, packSize, mode);
+  if (res) res = (decompressData(buff, packSize, reinterpret_cast<byte *>(data), rawSize) == rawSize);
+  free(buff);
+  return (res) ? rawSize : -1;
+}
+
+// ビットマップの操作（RAMシャドウ、完全性チェック用）
+static inline bool bitGet(const uint8_t* map, uint16_t n) { return (map[n >> 3] >> (n & 7)) & 1; }
+static inline void bitSet(uint8_t* map, uint16_t n) { map[n >> 3] |= (1 << (n & 7)); }
+static inline void bitClear(uint8_t* map, uint16_t n) { map[n >> 3] &= ~(1 << (n & 7)); }
+
+// RAMシャドウを使用する/使用を止める（止める場合は未書き込みのデータを書き込んでから）
+bool NfcEasyWriter::enableShadow(bool enable) {
+  bool res = true;
+  if (enable) {
+    if (_integrity) return false;   // 完全性チェックとは併用できない
+    _shadowEnabled = true;
+    if (isMounted()) res = checkShadow();
+  } else {
+    if (_shadow != nullptr && isMounted()) res = flush();
+    _shadowEnabled = false;
+    free(_shadow);
+    free(_shadowValid);
+    free(_shadowDirty);
+    _shadow = nullptr;
+    _shadowValid = _shadowDirty = nullptr;
+    _shadowSize = 0;
+  }
+  return res;
+}
+
+// RAMシャドウの未書き込みデータをカードに書き込む
+bool NfcEasyWriter::flush(ProtectMode mode) {
+  if (_shadow == nullptr) return true;
+  if (! isMounted()) return false;
+  if (mode == PRT_AUTO) mode = _lastProtectMode;
+  uint16_t units = _shadowSize / _shadowUnit;
+  bool res = true;
+
+  // 未書き込みのデータがあれば、カードが入れ替わっていないか確認する
+  bool dirty = false;
+  for (uint16_t i=0; i<(units + 7) / 8; i++) dirty |= (_shadowDirty[i] != 0);
+  if (! dirty) return true;
+  if (!selectCard()) return false;
+  if (_shadowUid.size != mfrc522.uid.size || memcmp(_shadowUid.uidByte, mfrc522.uid.uidByte, mfrc522.uid.size) != 0) {
+    if (_debug) sp("RAMシャドウと別のカードのため書き込みません");
+    return false;
+  }
+
+  // ハイウォーターマークは最後の未書き込みの単位までで1回だけ更新する
+  uint16_t last = units;
+  while (last > 0 && ! bitGet(_shadowDirty, last - 1)) last--;
+  if (! raiseHighWater(last * _shadowUnit, mode)) return false;
+
+  // 連続した未書き込みの単位をまとめて書き込む
+  _diffSkipCount = 0;
+  for (uint16_t u=0; u<units; ) {
+    if (! bitGet(_shadowDirty, u)) {
+      u++;
+      continue;
+    }
+    uint16_t end = u;
+    while (end < units && bitGet(_shadowDirty, end)) end++;
+    uint16_t vaddr = u * _shadowUnit;
+    size_t len = (end - u) * _shadowUnit;
+    if (_debug) spf("flush vaddr=%d size=%d\n", vaddr, (int)len);
+    bool wres = (this->*(_core->write))(vaddr, _shadow + vaddr, len, mode);
+    if (wres) {
+      for (uint16_t i=u; i<end; i++) bitClear(_shadowDirty, i);
+    } else {
+      res = false;  // 失敗した単位は未書き込みのまま残す
+    }
+    u = end;
+  }
+  return res;
+}
+
+// RAMシャドウの内容を破棄する（未書き込みのデータも破棄する）
+void NfcEasyWriter::invalidateShadow() {
+  if (_shadow == nullptr) return;
+  size_t mapSize = (_shadowSize / _shadowUnit + 7) / 8;
+  memset(_shadowValid, 0, mapSize);
+  memset(_shadowDirty, 0, mapSize);
 }
 
-// [共通] バイト配列型のデータをカードに書き込む
-bool NfcEasyWriter::writeData(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode) {
+// RAMシャドウがマウント中のカードのものか確認する（UIDや容量が違えば作り直す）
+bool NfcEasyWriter::checkShadow() {
   if (! isMounted()) return false;
-  if (mode == PRT_AUTO) mode = _lastProtectMode;
-  if (_debug) Serial.println("Total Data size="+String(dataSize));
+  uint16_t size = getVCapacities();
+  uint16_t unit = (isClassic()) ? _writeLengthCL : _writeLengthUL;
+  bool sameCard = (_shadowUid.size == mfrc522.uid.size && memcmp(_shadowUid.uidByte, mfrc522.uid.uidByte, mfrc522.uid.size) == 0);
+
+  // 容量が変わったら確保し直す
+  if (_shadow == nullptr || _shadowSize != size || _shadowUnit != unit) {
+    free(_shadow);
+    free(_shadowValid);
+    free(_shadowDirty);
+    size_t mapSize = (size / unit + 7) / 8;
+    _shadow = (byte*) malloc(size);
+    _shadowValid = (uint8_t*) calloc(mapSize, 1);
+    _shadowDirty = (uint8_t*) calloc(mapSize, 1);
+    if (_shadow == nullptr || _shadowValid == nullptr || _shadowDirty == nullptr) {
+      if (_debug) sp("RAMシャドウのメモリが確保できません");
+      enableShadow(false);
+      return false;
+    }
+    _shadowSize = size;
+    _shadowUnit = unit;
+    sameCard = false;
+  }
 
-  bool res = false;
-  if (_cardType == CardType::Classic) {
-    res = writeDataCL(vaddr, reinterpret_cast<byte *>(data), dataSize, mode);
-  } else if (_cardType == CardType::Ultralight) {
-    res = writeDataUL(vaddr, reinterpret_cast<byte *>(data), dataSize, mode);
+  // 別のカードなら中身を破棄する
+  if (! sameCard) {
+    if (_debug) sp("RAMシャドウを初期化します");
+    invalidateShadow();
+    _shadowUid = mfrc522.uid;
   }
-  return res;
+  return true;
 }
 
-// [Classic] バイト配列型のデータをカードに書き込む
-bool NfcEasyWriter::writeDataCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
-  if (! isClassic()) return false;
-  if (mode == PRT_AUTO) mode = _lastProtectMode;
-  if (vaddr % _writeLengthCL != 0) return false;  // 16バイト単位ではないアドレスは拒否
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
-
-  // 準備
-  byte buffer[_writeLengthCL];
-  int remain = dataSize;
-  size_t index = 0;
-  bool abort = false;
-  bool protect = (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO);
-
-  // ブロックごとのループ　最小書き込み単位ごとに分割して書き込む
-  while (remain > 0) {
-    memset(buffer, 0, sizeof(buffer));
-    size_t cplen = ((remain - _writeLengthCL) < 0) ? remain : _writeLengthCL;
-    memcpy(buffer, ((byte*)data) + index, cplen);
+// RAMシャドウを経由して読み込む（未読み込みの範囲だけカードから読む）
+bool NfcEasyWriter::readShadow(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
+  if (dataSize == 0) return true;
+  if (vaddr + dataSize > _shadowSize) {   // 範囲外は直接読む
+    return (this->*(_core->read))(vaddr, data, dataSize, mode);
+  }
 
-    // 書き込みセクタ/ブロックを求める
-    PhyAddr pa = addr2PhysicalAddr(vaddr + index, CardType::Classic);
-    if (pa.sector > _maxSectorCL) return false;
-    if (pa.sector < _minSectorCL) return false;
-    if (pa.block >= 3) return false;
-    if (_debug) {
-      String keyStr = (protect ? "B" : "A");
-      spf("Index=%d 書き込み先 Sector/Block=%d/%d -> blockAddr=%d key=%s\n", index, pa.sector, pa.block, pa.blockAddr, keyStr);
-      spn("  Data: ");
-      printDump1Line(buffer, sizeof(buffer));
+  // 未読み込みの単位の範囲を求める
+  uint16_t uSta = vaddr / _shadowUnit;
+  uint16_t uEnd = (vaddr + dataSize - 1) / _shadowUnit;
+  int16_t first = -1, last = -1;
+  for (uint16_t u=uSta; u<=uEnd; u++) {
+    if (! bitGet(_shadowValid, u)) {
+      if (first < 0) first = u;
+      last = u;
     }
+  }
 
-    // 認証
-    auto usekey = (protect) ? MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_B : MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_A;
-    auto keyWrite = (protect) ? _authKeyB : _authKeyA;
-    if (mfrc522.PCD_Authenticate(usekey, pa.blockAddr, &keyWrite, &(mfrc522.uid)) == MFRC522_I2C::STATUS_OK) {
-      // 書き込み
-      if (mfrc522.MIFARE_Write(pa.blockAddr, buffer, _writeLengthCL) == MFRC522_I2C::STATUS_OK) {
-        if (_debug) sp("  書き込み成功");
-      } else {
-        if (_debug) sp("  書き込み失敗");
-        abort = true;
+  // カードから読み込む（未書き込みのデータは上書きしない）
+  if (first >= 0) {
+    size_t len = (last - first + 1) * _shadowUnit;
+    byte* buff = (byte*) malloc(len);
+    if (buff == nullptr) return false;
+    bool res = (this->*(_core->read))(first * _shadowUnit, buff, len, mode);
+    if (res) {
+      for (uint16_t u=first; u<=last; u++) {
+        if (bitGet(_shadowValid, u)) continue;
+        memcpy(_shadow + u * _shadowUnit, buff + (u - first) * _shadowUnit, _shadowUnit);
+        bitSet(_shadowValid, u);
       }
-    } else {
-      if (_debug) sp("  認証失敗");
-      abort = true;
     }
+    free(buff);
+    if (! res) return false;
+  }
 
-    if (abort) break;
-    index += cplen;
-    remain -= cplen;
-  }//while-remain
+  memcpy(data, _shadow + vaddr, dataSize);
+  return true;
+}
 
-  // 認証終了
-  mfrc522.PCD_StopCrypto1();
-  if (abort) return false;
+// RAMシャドウに書き込む（カードにはflush()で書き込む）
+bool NfcEasyWriter::writeShadow(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
+  if (vaddr + dataSize > _shadowSize) return false;
+  if (dataSize == 0) return true;
+
+  // 単位の途中から/途中までの場合は、未読み込みなら先にカードから読み込んで合わせる
+  uint16_t uSta = vaddr / _shadowUnit;
+  uint16_t uEnd = (vaddr + dataSize - 1) / _shadowUnit;
+  byte buffer[16];
+  if (vaddr % _shadowUnit != 0 && ! bitGet(_shadowValid, uSta)) {
+    if (! readShadow(uSta * _shadowUnit, buffer, _shadowUnit, mode)) return false;
+  }
+  if ((vaddr + dataSize) % _shadowUnit != 0 && ! bitGet(_shadowValid, uEnd)) {
+    if (! readShadow(uEnd * _shadowUnit, buffer, _shadowUnit, mode)) return false;
+  }
 
+  // 単位ごとにコピーする
+  for (uint16_t u=uSta; u<=uEnd; u++) {
+    size_t sta = (u == uSta) ? vaddr % _shadowUnit : 0;
+    size_t end = (u == uEnd) ? (vaddr + dataSize - 1) % _shadowUnit + 1 : _shadowUnit;
+    if (sta != 0 || end != _shadowUnit) memcpy(buffer, _shadow + u * _shadowUnit, _shadowUnit);
+    memcpy(buffer + sta, data + u * _shadowUnit + sta - vaddr, end - sta);
+    // 差分書き込み　カードの内容と同じなら未書き込みにしない
+    if (_diffWrite && bitGet(_shadowValid, u) && ! bitGet(_shadowDirty, u) && memcmp(_shadow + u * _shadowUnit, buffer, _shadowUnit) == 0) {
+      _diffSkipCount++;
+      continue;
+    }
+    memcpy(_shadow + u * _shadowUnit, buffer, _shadowUnit);
+    bitSet(_shadowValid, u);
+    bitSet(_shadowDirty, u);
+  }
   return true;
 }
 
-// [Ultralight] バイト配列型のデータをカードに書き込む
-bool NfcEasyWriter::writeDataUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
-  if (! isUltralight()) return false;
-  if (mode == PRT_AUTO) mode = _lastProtectMode;
-  if (vaddr % _writeLengthUL != 0) return false;  // 4バイト単位ではないアドレスは拒否
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
+// 完全性チェックを使う（vaddrからsizeバイトをregionSizeごとにCRC-32でチェックする。タグはその直後に記録する）
+// マウント中なら続けてタグを読み込む　戻り値はタグを読み込めたか（マウント前は設定だけ）
+bool NfcEasyWriter::beginIntegrity(uint16_t vaddr, uint16_t size, uint16_t regionSize) {
+  if (_shadowEnabled) return false;   // RAMシャドウとは併用できない
+  endIntegrity();
+  _tagVaddr = vaddr;
+  _tagSpan = size;
+  _tagRegionSet = regionSize;
+  _integrity = true;
+  if (! isMounted()) return true;
+  verifyIntegrity();
+  return _tagLoaded;
+}
 
-  // 準備
-  byte buffer[_writeLengthUL];
-  int remain = dataSize;
-  size_t index = 0;
+// 完全性チェックを止める
+void NfcEasyWriter::endIntegrity() {
+  free(_tags);
+  free(_tagBad);
+  _tags = nullptr;
+  _tagBad = nullptr;
+  _tagCount = 0;
+  _tagLoaded = false;
+  _corrupted = false;
+  _integrity = false;
+}
 
-  // 認証がかかっている場合は、まず認証する
-  if (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO) {
-    if (! authUL(true)) return false;   
+// チェックする範囲とタグの数を求めてメモリを確保する
+bool NfcEasyWriter::prepareIntegrity() {
+  _tagLoaded = false;
+  if (! isMounted()) return false;
+  uint16_t unit = (isClassic()) ? _writeLengthCL : _writeLengthUL;
+  uint16_t region = (_tagRegionSet > 0) ? _tagRegionSet : (isClassic()) ? _writeLengthCL * 3 : NFC_FASTREAD_MAX_PAGES * _writeLengthUL;
+  uint16_t capacity = getVCapacities();
+  uint16_t avail = (_tagVaddr < capacity) ? capacity - _tagVaddr : 0;
+  if (_tagVaddr % unit != 0 || region % unit != 0 || region == 0 || region > NFC_TAG_MAX_REGION) {
+    if (_debug) sp("完全性チェックのアドレスかサイズが書き込み単位に合っていません");
+    return false;
   }
 
-  // ブロックごとのループ　最小書き込み単位ごとに分割して書き込む
-  while (remain > 0) {
-    for (int i=0; i<_writeLengthUL; i++) {
-      buffer[i] = 0;
+  // サイズの指定が無ければ、タグの記録場所を除いた残り全部をチェックする
+  uint16_t size = _tagSpan;
+  if (size == 0) {
+    uint16_t tagBytes = ((avail + region - 1) / region * 4 + unit - 1) / unit * unit;
+    size = (avail > tagBytes) ? avail - tagBytes : 0;
+  }
+  uint16_t count = (size + region - 1) / region;
+  uint16_t addr = (_tagVaddr + size + unit - 1) / unit * unit;   // タグは書き込み単位の境界から記録する
+  if (count == 0 || addr + count * 4 > capacity) {
+    if (_debug) sp("完全性チェックの領域が足りません");
+    return false;
+  }
+
+  // タグの数が変わったら確保し直す
+  if (_tags == nullptr || _tagCount != count) {
+    free(_tags);
+    free(_tagBad);
+    _tags = (uint32_t*) malloc(count * sizeof(uint32_t));
+    _tagBad = (uint8_t*) malloc((count + 7) / 8);
+    if (_tags == nullptr || _tagBad == nullptr) {
+      if (_debug) sp("完全性チェックのメモリが確保できません");
+      free(_tags);
+      free(_tagBad);
+      _tags = nullptr;
+      _tagBad = nullptr;
+      _tagCount = 0;
+      return false;
     }
-    size_t cplen = ((remain - _writeLengthUL) < 0) ? remain : _writeLengthUL;
-    memcpy(buffer, ((byte*)data) + index, cplen);
+  }
+  _tagCount = count;
+  _tagRegion = region;
+  _tagSize = size;
+  _tagAddr = addr;
+  memset(_tagBad, 0, (count + 7) / 8);
+  return true;
+}
 
-    // 書き込みページを求める
-    PhyAddr pa = addr2PhysicalAddr(vaddr + index, CardType::Ultralight);
-    if (pa.blockAddr > _maxPageUL) return false;
-    if (pa.blockAddr < _minPageUL) return false;
-    if (_debug) {
-      spf("Index=%d 書き込み先 Page=%d\n", index, pa.blockAddr);
-      spn("  Data: ");
-      printDump1Line(buffer, sizeof(buffer));
+// verifyIntegrity()で読み込んだデータを領域ごとにCRC-32を計算してタグと比べる
+struct NfcTagScan {
+  NfcEasyWriter* nfc;
+  uint32_t crc;   // 計算中の領域のCRC-32
+  bool bad;       // 壊れた領域があった
+};
+static bool tagScanFunc(void* ctx, size_t offset, byte* buff, size_t len) {
+  NfcTagScan* scan = reinterpret_cast<NfcTagScan*>(ctx);
+  if (! scan->nfc->scanIntegrity(offset, buff, len, &scan->crc)) scan->bad = true;
+  return true;
+}
+
+// チェックする範囲の先頭からoffsetの位置のデータを、領域ごとにタグと比べる（領域の途中まではcrcに計算中の値を残す）
+// 壊れた領域があればfalse
+bool NfcEasyWriter::scanIntegrity(size_t offset, const byte* data, size_t len, uint32_t* crc) {
+  bool res = true;
+  while (len > 0) {
+    uint16_t r = offset / _tagRegion;
+    size_t end = (r + 1) * _tagRegion;
+    if (end > _tagSize) end = _tagSize;
+    size_t n = (end - offset < len) ? end - offset : len;
+    *crc = calcCrc32(data, n, *crc);
+    data += n;
+    offset += n;
+    len -= n;
+    if (offset == end) {
+      if (_tags[r] != 0 && _tags[r] != *crc) {
+        bitSet(_tagBad, r);
+        res = false;
+      }
+      *crc = 0;
     }
+  }
+  return res;
+}
 
-    // 書き込み
-    if (mfrc522.MIFARE_Ultralight_Write(pa.blockAddr, buffer, _writeLengthUL)  == MFRC522_I2C::STATUS_OK) {
-      if (_debug) sp("..ok");
-    } else {
-      if (_debug) sp(".. 書き込み失敗");
-      return false;
+// チェックする範囲をまとめて読み込んでタグと比べる（マウント時に自動で行う）　壊れた領域があればfalse
+bool NfcEasyWriter::verifyIntegrity(ProtectMode mode) {
+  _corrupted = false;
+  if (! _integrity || ! prepareIntegrity()) return false;
+  if (! readData(_tagAddr, _tags, _tagCount * sizeof(uint32_t), mode)) return false;
+  NfcTagScan scan = { this, 0, false };
+  if (! readStream(_tagVaddr, _tagSize, tagScanFunc, &scan, mode)) return false;
+  _tagLoaded = true;
+  _corrupted = scan.bad;
+  if (_debug) spf("完全性チェック tags=%d %s\n", _tagCount, (_corrupted ? "壊れた領域あり" : "ok"));
+  return ! _corrupted;
+}
+
+// 指定した範囲に壊れた領域があるか（最後に確認した結果を返す。カードは読まない）
+bool NfcEasyWriter::isCorrupted(uint16_t vaddr, size_t dataSize) {
+  if (! _integrity || ! _tagLoaded || dataSize == 0) return false;
+  if (vaddr >= _tagVaddr + _tagSize || vaddr + dataSize <= _tagVaddr) return false;
+  uint16_t r0 = (vaddr > _tagVaddr) ? (vaddr - _tagVaddr) / _tagRegion : 0;
+  uint16_t r1 = ((vaddr + dataSize < _tagVaddr + _tagSize) ? vaddr + dataSize - 1 - _tagVaddr : _tagSize - 1) / _tagRegion;
+  for (uint16_t r=r0; r<=r1; r++) {
+    if (bitGet(_tagBad, r)) return true;
+  }
+  return false;
+}
+
+// 読み込んだデータをタグと比べる（領域全体を読んだ場合はCRC-32を計算し、一部だけの場合は最後に確認した結果を使う）
+bool NfcEasyWriter::checkIntegrity(uint16_t vaddr, const byte* data, size_t dataSize) {
+  uint16_t spanEnd = _tagVaddr + _tagSize;
+  if (dataSize == 0 || vaddr >= spanEnd || vaddr + dataSize <= _tagVaddr) return true;
+  uint16_t r0 = (vaddr > _tagVaddr) ? (vaddr - _tagVaddr) / _tagRegion : 0;
+  uint16_t r1 = ((vaddr + dataSize < spanEnd) ? vaddr + dataSize - 1 - _tagVaddr : _tagSize - 1) / _tagRegion;
+  for (uint16_t r=r0; r<=r1; r++) {
+    uint16_t rs = _tagVaddr + r * _tagRegion;
+    uint16_t re = (rs + _tagRegion < spanEnd) ? rs + _tagRegion : spanEnd;
+    if (rs >= vaddr && re <= vaddr + dataSize && _tags[r] != 0) {
+      if (calcCrc32(data + (rs - vaddr), re - rs) == _tags[r]) bitClear(_tagBad, r);
+      else bitSet(_tagBad, r);
     }
-    index += cplen;
-    remain -= cplen;
-  }//while-remain
+  }
+  return ! isCorrupted(vaddr, dataSize);
+}
 
+// 完全性チェックの範囲に書き込む（データを書き込んでからタグを書き込む）
+// 途中でカードが離れた場合は、次に読み込んだときに壊れた領域として検出される
+bool NfcEasyWriter::writeDataTagged(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode) {
+  uint16_t end = vaddr + dataSize;
+  uint16_t spanEnd = _tagVaddr + _tagSize;
+  uint16_t r0 = (vaddr > _tagVaddr) ? (vaddr - _tagVaddr) / _tagRegion : 0;
+  uint16_t r1 = ((end < spanEnd) ? end - 1 - _tagVaddr : _tagSize - 1) / _tagRegion;
+  uint16_t rs = _tagVaddr + r0 * _tagRegion;
+  uint16_t re = (_tagVaddr + (r1 + 1) * _tagRegion < spanEnd) ? _tagVaddr + (r1 + 1) * _tagRegion : spanEnd;
+
+  // 書き込む範囲の前後で、同じ領域に入る部分を読み込む（領域の単位で書き込めば読まない）
+  byte head[NFC_TAG_MAX_REGION], tail[NFC_TAG_MAX_REGION];
+  uint16_t headLen = (vaddr > rs) ? vaddr - rs : 0;
+  uint16_t tailLen = (re > end) ? re - end : 0;
+  if (headLen > 0 && ! transferData(false, rs, head, headLen, mode)) return false;
+  if (tailLen > 0 && ! transferData(false, end, tail, tailLen, mode)) return false;
+
+  // 新しいタグを計算する
+  for (uint16_t r=r0; r<=r1; r++) {
+    uint16_t s = _tagVaddr + r * _tagRegion;
+    uint16_t e = (s + _tagRegion < spanEnd) ? s + _tagRegion : spanEnd;
+    uint16_t ds = (s > vaddr) ? s : vaddr;
+    uint16_t de = (e < end) ? e : end;
+    uint32_t crc = 0;
+    if (s < vaddr) crc = calcCrc32(head, vaddr - s, crc);
+    crc = calcCrc32(data + (ds - vaddr), de - ds, crc);
+    if (e > end) crc = calcCrc32(tail, e - end, crc);
+    _tags[r] = crc;
+  }
+
+  // データ、タグの順に書き込む（失敗したらタグを読み直す）
+  // 省略した書き込み回数はデータの分だけにする（タグの書き込みで増えた分は戻す）
+  byte* tagData = reinterpret_cast<byte*>(_tags + r0);
+  size_t tagLen = (r1 - r0 + 1) * sizeof(uint32_t);
+  bool res = transferData(true, vaddr, data, dataSize, mode);
+  uint16_t skip = _diffSkipCount;
+  if (res) res = transferData(true, _tagAddr + r0 * sizeof(uint32_t), tagData, tagLen, mode);
+  _diffSkipCount = skip;
+
+  // タグだけ読み直して、最後まで書き込めたか確認する（データ全体は読み直さない）
+  for (size_t offset=0; res && _tagVerify && offset<tagLen; ) {
+    byte check[NFC_TAG_MAX_REGION];
+    size_t len = (tagLen - offset < sizeof(check)) ? tagLen - offset : sizeof(check);
+    res = transferData(false, _tagAddr + r0 * sizeof(uint32_t) + offset, check, len, mode) && memcmp(check, tagData + offset, len) == 0;
+    offset += len;
+  }
+  if (! res) {
+    if (_debug) sp("完全性チェックのタグの書き込み失敗");
+    _tagLoaded = false;
+    return false;
+  }
+  for (uint16_t r=r0; r<=r1; r++) bitClear(_tagBad, r);
   return true;
 }
 
+// CRC-32を計算する（crcに前回の結果を渡すと続きを計算する）
+uint32_t NfcEasyWriter::calcCrc32(const byte* data, size_t length, uint32_t crc) {
+  crc = ~crc;
+  for (size_t i=0; i<length; i++) {
+    crc ^= data[i];
+    for (uint8_t b=0; b<8; b++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
 // 認証キーを設定する（書き込みはしない）
 void NfcEasyWriter::setAuthKey(AuthKey* key) {
   memcpy(_authKeyB.keyByte, key->keyByte, sizeof(_authKeyB.keyByte));  // 6 bytes for Classic
@@ -526,22 +2280,22 @@ bool NfcEasyWriter::writeProtect(ProtectMode mode, AuthKey* key, uint16_t vaddr,
   if (! isMounted()) return false;
   if (lastmode == PRT_AUTO) lastmode = _lastProtectMode;
 
-  bool res = false;
-  if (_cardType == CardType::Classic) {
-    res = writeProtectCL(mode, key, vaddr, size, lastmode);
-  } else if (_cardType == CardType::Ultralight) {
-    res = writeProtectUL(mode, key, vaddr, false, lastmode);
-  }
-  return res;
+  if (_core == nullptr) return false;
+  return (this->*(_core->protect))(mode, key, vaddr, size, lastmode);
 }
 
-// [Classic] プロテクトモードや認証キーを書き込む（指定した仮想アドレスの範囲にあるセクター全て）
+// [Classic] プロテクトモードや認証キーを書き込む（マウント時に選んだプロファイルの本体を呼ぶ）
 bool NfcEasyWriter::writeProtectCL(ProtectMode mode, AuthKey* key, uint16_t vaddr, int size, ProtectMode lastmode) {
-  if (! isClassic()) return false;
+  if (! isClassic() || _core == nullptr) return false;
+  return (this->*(_core->protect))(mode, key, vaddr, size, lastmode);
+}
+
+// [プロファイル][Classic] プロテクトモードや認証キーを書き込む（指定した仮想アドレスの範囲にあるセクター全て）
+template <typename P> bool NfcEasyWriter::protectCoreCL(ProtectMode mode, AuthKey* key, uint16_t vaddr, int size, ProtectMode lastmode) {
   if (lastmode == PRT_AUTO) lastmode = _lastProtectMode;
   bool bfProt;//, afProt;
-  if (vaddr % 48 != 0) return false;  // セクター単位で行うのでブロックの途中からは受け付けない
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
+  if (vaddr % P::writeLength != 0 || addrCore<P>(vaddr).block != 0) return false;  // セクター単位で行うのでセクターの途中からは受け付けない
+  if (!selectCard()) return false;  // 通信できる状態にする
 
   // Access Bitの計算　運用方針：KeyAはデフォルト値のまま運用、KeyBはパスワード認証モードのときだけ使用
   uint8_t dataBit, accBit;
@@ -582,19 +2336,18 @@ bool NfcEasyWriter::writeProtectCL(ProtectMode mode, AuthKey* key, uint16_t vadd
   bool abort = false;
   // セクタごとのループ
   while (remain > 0) {
-    PhyAddr pa = addr2PhysicalAddr(vaddr + index, CardType::Classic);
-    uint16_t blockAddr = pa.sector * 4 + 3;
+    PhyAddr pa = addrCore<P>(vaddr + index);
+    uint16_t blockAddr = nfcSectorTrailerCL(pa.sector);
+    uint16_t sectorSize = (nfcSectorBlocksCL(pa.sector) - 1) * P::writeLength;   // セクターのデータ領域のサイズ 48/240
     if (_debug) {
       String keyStr = (bfProt ? "B" : "A");
-      spf("Index=%d 書き込み先 Sector/Block=%d/3 -> blockAddr=%d key=%s ", index, pa.sector, blockAddr, keyStr);
+      spf("Index=%d 書き込み先 Sector/Block=%d/%d -> blockAddr=%d key=%s ", (int)index, pa.sector, nfcSectorBlocksCL(pa.sector) - 1, blockAddr, keyStr.c_str());
     }
 
     // 認証開始
-    auto usekey = (bfProt) ? MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_B : MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_A;
-    auto keyWrite = (bfProt) ? _authKeyB : _authKeyA;
-    if (mfrc522.PCD_Authenticate(usekey, blockAddr, &keyWrite, &(mfrc522.uid)) == MFRC522_I2C::STATUS_OK) {
+    if (authSectorCL(pa.sector, bfProt, (bfProt) ? &_authKeyB : &_authKeyA)) {
       // 書き込み
-      if (mfrc522.MIFARE_Write(blockAddr, buffer, _writeLengthCL) == MFRC522_I2C::STATUS_OK) {
+      if (mfrc522.MIFARE_Write(blockAddr, buffer, P::writeLength) == MFRC522_I2C::STATUS_OK) {
         if (_debug) sp("  書き込み成功");
       } else {
         if (_debug) sp("  書き込み失敗");
@@ -605,13 +2358,17 @@ bool NfcEasyWriter::writeProtectCL(ProtectMode mode, AuthKey* key, uint16_t vadd
       abort = true;
     }
     if (abort) break;
-    index += 48;
-    remain -= 48;
+    index += sectorSize;
+    remain -= sectorSize;
   }
-  // 認証終了
-  mfrc522.PCD_StopCrypto1();
-  if (!abort) _lastProtectMode = mode;
-  return !abort;
+  // 認証は次の読み書きのために維持する（失敗時はカードがIDLEに戻っているので終了する）
+  if (abort) {
+    stopAuthCL();
+    _selected = false;
+    return false;
+  }
+  _lastProtectMode = mode;
+  return true;
 }
 
 // [Ultralight] プロテクトモードや認証キーを書き込む（指定した仮想アドレス以降のにあるページ全て）
@@ -620,7 +2377,7 @@ bool NfcEasyWriter::writeProtectUL(ProtectMode mode, AuthKey* key, uint16_t vadd
   if (lastmode == PRT_AUTO) lastmode = _lastProtectMode;
   bool bfProt, afProt, aReado;
   if (vaddr % 4 != 0 && !phyaddr) return false;  // ページ単位で行うのでページの途中からは受け付けない
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
+  if (!selectCard()) return false;  // 通信できる状態にする
   if (mode == PRT_NOPASS_RO) return false;  // UltralightにはPWなしReadonlyは無いのでエラーで返す
 
   // 準備
@@ -650,8 +2407,54 @@ bool NfcEasyWriter::writeProtectUL(ProtectMode mode, AuthKey* key, uint16_t vadd
   return res;
 }
 
+// [プロファイル][Ultralight] 仮想アドレスで指定したページ以降をプロテクトする（writeProtect()から呼ぶ）
+template <typename P> bool NfcEasyWriter::protectCoreUL(ProtectMode mode, AuthKey* key, uint16_t vaddr, int /*size*/, ProtectMode lastmode) {
+  if (vaddr % P::writeLength != 0) return false;  // ページ単位で行うのでページの途中からは受け付けない
+  return writeProtectUL(mode, key, addrCore<P>(vaddr).blockAddr, true, lastmode);
+}
+
+// プロファイルごとの読み書きの本体
+#define NFC_CORE_CL(P) { &NfcEasyWriter::addrCore<P>, &NfcEasyWriter::readCoreCL<P>, &NfcEasyWriter::writeCoreCL<P>, &NfcEasyWriter::protectCoreCL<P> }
+#define NFC_CORE_UL(P) { &NfcEasyWriter::addrCore<P>, &NfcEasyWriter::readCoreUL<P>, &NfcEasyWriter::writeCoreUL<P>, &NfcEasyWriter::protectCoreUL<P> }
+static const NfcCore nfcCoreClassic1K = NFC_CORE_CL(NfcProfileClassic1K);
+static const NfcCore nfcCoreClassic4K = NFC_CORE_CL(NfcProfileClassic4K);
+static const NfcCore nfcCoreClassicCustom = NFC_CORE_CL(NfcProfileClassicCustom);
+static const NfcCore nfcCoreNTAG213 = NFC_CORE_UL(NfcProfileNTAG213);
+static const NfcCore nfcCoreNTAG215 = NFC_CORE_UL(NfcProfileNTAG215);
+static const NfcCore nfcCoreNTAG216 = NFC_CORE_UL(NfcProfileNTAG216);
+static const NfcCore nfcCoreUltralightCustom = NFC_CORE_UL(NfcProfileUltralightCustom);
+#undef NFC_CORE_CL
+#undef NFC_CORE_UL
+
+// 使用範囲がプロファイルの初期設定と同じか？
+template <typename P> static bool nfcProfileMatch(uint16_t first, uint16_t last, NtagType ntag) {
+  return (first == P::first && last == P::last && ntag == P::ntagType);
+}
+
+// カードと使用範囲に合ったプロファイルの読み書きの本体を選ぶ（初期設定の範囲でなければNfcProfileCustom）
+const NfcCore* NfcEasyWriter::selectCore() {
+  if (isClassic()) {
+    if (nfcProfileMatch<NfcProfileClassic1K>(_minSectorCL, _lastSectorCL, NT_UNKNOWN)) return &nfcCoreClassic1K;
+    if (nfcProfileMatch<NfcProfileClassic4K>(_minSectorCL, _lastSectorCL, NT_UNKNOWN)) return &nfcCoreClassic4K;
+    return &nfcCoreClassicCustom;
+  }
+  if (isUltralight()) {
+    if (nfcProfileMatch<NfcProfileNTAG213>(_minPageUL, _maxPageUL, _ntagType)) return &nfcCoreNTAG213;
+    if (nfcProfileMatch<NfcProfileNTAG215>(_minPageUL, _maxPageUL, _ntagType)) return &nfcCoreNTAG215;
+    if (nfcProfileMatch<NfcProfileNTAG216>(_minPageUL, _maxPageUL, _ntagType)) return &nfcCoreNTAG216;
+    return &nfcCoreUltralightCustom;
+  }
+  return nullptr;
+}
+
 // [Ultralight] パスワード認証を行う
 bool NfcEasyWriter::authUL(bool checkPack) {
+  // 認証状態はHALTか選択し直すまで続くので、選択中のカードで同じパスワードで認証済みなら省略する
+  if (_authedUL && memcmp(_authKeyUL.keyByte, _authKeyB.keyByte, sizeof(_authKeyUL.keyByte)) == 0) {
+    _authSkipCountUL++;
+    return true;
+  }
+  _authedUL = false;
   byte password[4];
   byte pack[4];
   memcpy(password, _authKeyB.keyByte, sizeof(password));
@@ -662,10 +2465,19 @@ bool NfcEasyWriter::authUL(bool checkPack) {
     spf("認証結果 authUL() result=%d, send password=",result);
     printDump1Line(password, passwordLen);
   }
-  if (result != MFRC522_I2C::STATUS_OK) return false;
+  if (result != MFRC522_I2C::STATUS_OK) {
+    _selected = false;  // NAKでカードはIDLEに戻る
+    return false;
+  }
+  // PACKも一致した場合だけ認証済みにする
+  bool packOk = (pack[0] == _authKeyB.keyByte[4] && pack[1] == _authKeyB.keyByte[5]);
+  if (packOk) {
+    _authedUL = true;
+    _authKeyUL = _authKeyB;
+  }
   if (checkPack) {
     if (_debug) spf("received pack=%02X %02X\n", pack[0], pack[1]);
-    return (pack[0] == _authKeyB.keyByte[4] && pack[1] == _authKeyB.keyByte[5]);
+    return packOk;
   }
   return true;
 }
@@ -680,7 +2492,13 @@ bool NfcEasyWriter::unauthUL(ProtectMode mode) {
 bool NfcEasyWriter::readConfigDataUL(ULConfig* ulconf, ProtectMode mode) {
   if (mode == PRT_AUTO) mode = _lastProtectMode;
   if (_configPageUL == 0) return false;
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
+
+  // マウント時に読み込んだ設定情報があれば、カードを読まずに返す
+  if (_configValidUL) {
+    memcpy(ulconf, &_configUL, sizeof(ULConfig));
+    return true;
+  }
+  if (!selectCard()) return false;  // 通信できる状態にする
   memset(ulconf, 0, sizeof(ULConfig));
 
   // 認証がかかっている場合は、まず認証する
@@ -688,16 +2506,21 @@ bool NfcEasyWriter::readConfigDataUL(ULConfig* ulconf, ProtectMode mode) {
     if (! authUL(true)) return false;   
   }
 
-  // データ取得
+  // データ取得（設定ページからPACKまでの4ページ）
   byte data[16];
+  bool protect = (mode == PRT_PASSWD_RW || mode == PRT_PASSWD_RO);
   if (_debug) spf("設定情報を取得 page=%d\n", _configPageUL);
-  if (rawReadUL(data, sizeof(data), _configPageUL)) {
+  if (readPagesUL(data, _configPageUL, 4, protect)) {
     if (_debug) {
       spn("RAW Data: ");
       printDump1Line(data, sizeof(data));
       // printDumpBin(data, sizeof(data));
     }
     memcpy(ulconf, data, sizeof(ULConfig));
+    if (_configCacheUL && isMounted()) {
+      memcpy(&_configUL, data, sizeof(ULConfig));
+      _configValidUL = true;
+    }
     return true;
   } else {
     if (_debug) sp("  読み込み失敗");
@@ -720,7 +2543,7 @@ bool NfcEasyWriter::readConfigDataUL(ULConfigEx* ulconfex, ProtectMode mode) {
 bool NfcEasyWriter::writeConfigDataUL(ULConfig* ulconf, ProtectMode mode) {
   if (mode == PRT_AUTO) mode = _lastProtectMode;
   if (_configPageUL <= 3) return false;
-  if (!waitCard(5000)) return false;  // 読み書きできる状態になるまで待つ
+  if (!selectCard()) return false;  // 通信できる状態にする
   byte data[4];
 
   // 認証がかかっている場合は、まず認証する
@@ -739,6 +2562,8 @@ bool NfcEasyWriter::writeConfigDataUL(ULConfig* ulconf, ProtectMode mode) {
     }
     if (rawWriteUL(data, sizeof(data), page)) {
       if (_debug) spf(" page=%d 書き込み成功\n", page);
+      // 設定情報のコピーにも反映する（PWDとPACKはカードから読むと0なので0のまま）
+      if (_configValidUL && idx < 8) memcpy(((byte*)&_configUL) + idx, data, 4);
     } else {
       if (_debug) spf(" page=%d 書き込み失敗\n", page);
       return false;
@@ -752,17 +2577,36 @@ bool NfcEasyWriter::format(bool formatAll) {
   if (! isMounted()) return false;
   byte buff[8] = { 0xFE, 0, 0, 0, 0, 0, 0, 0 };   // Terminator TLV
 
+  // 完全性チェックのタグも0（未記録）になるので、フォーマット中はタグを更新しない
+  if (_integrity && formatAll) {
+    _integrity = false;
+    bool res = format(true);
+    _integrity = true;
+    _tagLoaded = (res && _tags != nullptr);
+    if (_tagLoaded) {
+      memset(_tags, 0, _tagCount * sizeof(uint32_t));
+      memset(_tagBad, 0, (_tagCount + 7) / 8);
+    }
+    return res;
+  }
+
   // [Ultralight] page.4のNDEFメッセージを削除する（データはpage.5から始まる）
   if (_cardType == CardType::Ultralight) {
-    if (!mfrc522.MIFARE_Ultralight_Write(4, buff, 4) == MFRC522_I2C::STATUS_OK) return false;
+    if (!rawWriteUL(buff, 4, 4)) return false;
     // if (!mfrc522.MIFARE_Ultralight_Write(5, &buff[4], 4) == MFRC522_I2C::STATUS_OK) return false;
   }
 
-  // 全領域を0で埋める
+  // ハイウォーターマークを使う場合は、使用中の範囲だけ0で埋めて、記録を0にする（記録が無ければ全領域）
+  if (useHighWater() && formatAll) {
+    uint16_t used = getUsedSize();
+    if (used > 0 && ! fillData(0, used, 0)) return false;
+    if (_shadowEnabled && ! flush()) return false;   // 0にしたデータを書き込んでから記録を更新する
+    return storeHighWater(0, _lastProtectMode == PRT_PASSWD_RW || _lastProtectMode == PRT_PASSWD_RO);
+  }
+
+  // 全領域を0で埋める（小さなバッファを使い回すので、容量分のメモリは使わない）
   if (formatAll) {
-    uint16_t totalSize = getVCapacities();  // 使用可能な容量（仮想アドレス換算）を取得する
-    byte wdata[totalSize] = {0};
-    return writeData(0, wdata, sizeof(wdata));  // 書き込み
+    return fillData(0, getVCapacities(), 0);
   }
 
   return true;
@@ -784,7 +2628,8 @@ bool NfcEasyWriter::firmwareVersionCheck() {
 bool NfcEasyWriter::recoverySectorTruckCL(uint16_t blockAddr, AuthKey* key, bool useKeyB) {
   if (! isClassic()) return false;
   if (blockAddr < 7) return false;
-  if (blockAddr % 4 != 3) return false;
+  if (blockAddr != nfcSectorTrailerCL(nfcBlockToSectorCL(blockAddr))) return false;
+  if (!selectCard()) return false;  // 通信できる状態にする
   bool abort = false;
 
   // デフォルト時データ作成
@@ -799,8 +2644,7 @@ bool NfcEasyWriter::recoverySectorTruckCL(uint16_t blockAddr, AuthKey* key, bool
   MFRC522_I2C::MIFARE_Key mifarekey;
   memcpy(&mifarekey, key, sizeof(MFRC522_I2C::MIFARE_Key));
   spf("セクタートレーラー修復 blockAddr=%d key=%s\n", blockAddr, (useKeyB?"B":"A") );
-  auto usekey = (useKeyB) ? MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_B : MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_A;
-  if (mfrc522.PCD_Authenticate(usekey, blockAddr, &mifarekey, &(mfrc522.uid)) == MFRC522_I2C::STATUS_OK) {
+  if (authSectorCL(nfcBlockToSectorCL(blockAddr), useKeyB, &mifarekey)) {
     // 書き込み
     if (mfrc522.MIFARE_Write(blockAddr, buffer, _writeLengthCL) == MFRC522_I2C::STATUS_OK) {
       if (_debug) sp("  書き込み成功");
@@ -814,7 +2658,7 @@ bool NfcEasyWriter::recoverySectorTruckCL(uint16_t blockAddr, AuthKey* key, bool
   }
 
   // 認証終了
-  mfrc522.PCD_StopCrypto1();
+  stopAuthCL();
   return !abort;
 }
 
@@ -853,12 +2697,25 @@ bool NfcEasyWriter::recoveryConfigDataUL(bool useAuth, AuthKey* key, ProtectMode
   return res;
 }
 
+// 統計情報をシリアルに出力する
+void NfcEasyWriter::printStats() {
+  NfcStats& st = mfrc522._stats;
+  spf("選択     %u回 %uus\n", st.selectCount, st.selectUs);
+  spf("認証     %u回 %uus (失敗 %u回)\n", st.authCount, st.authUs, st.authFailCount);
+  spf("読み込み %u回 %uus\n", st.readCount, st.readUs);
+  spf("書き込み %u回 %uus\n", st.writeCount, st.writeUs);
+  spf("CRC計算  %u回 %uus\n", st.crcCount, st.crcUs);
+  spf("リトライ %u回\n", st.retryCount);
+}
+
 // 全データをシリアルに出力する　デバッグ用　（MFRC522_I2Cライブラリ標準のdump結果）
 void NfcEasyWriter::dumpAllBasic() {
   if (! isMounted()) return;
   if (_cardType == CardType::Classic) {
-    if (!waitCard(5000)) return;  // 読み書きできる状態になるまで待つ
+    stopAuthCL();   // PICC_DumpToSerial()は平文で認証するので、認証中なら選択し直す
+    if (!selectCard()) return;  // 通信できる状態にする
     mfrc522.PICC_DumpToSerial(&(mfrc522.uid));
+    _selected = false;  // PICC_DumpToSerial()は最後にHALTする
   } else if (_cardType == CardType::Ultralight) {
     mfrc522.PICC_DumpMifareUltralightToSerial();  // この関数は16ページまでしか読まないので全部は見れない
   }
@@ -869,9 +2726,12 @@ void NfcEasyWriter::dumpAll(bool inProtect, uint8_t phySta, uint8_t phyEnd) {
   if (! isMounted()) return;
   byte buffer[18];
   byte bufferSize = sizeof(buffer);
-  if (!waitCard(5000)) return;  // 読み書きできる状態になるまで待つ
+  if (!selectCard()) return;  // 通信できる状態にする
   bool debugOrig = _debug;
   _debug = false;
+  // ハイウォーターマークを使う場合は、使用中の範囲より後ろのデータ領域を省略する
+  uint16_t used = getUsedSize();
+  bool skipUnused = (useHighWater() && used < getVCapacities() && !(_dbgopt & NFCOPT_DUMP_NDEF_CLASSIC));
 
   // カード情報
   spn("Card UID: ");
@@ -884,27 +2744,36 @@ void NfcEasyWriter::dumpAll(bool inProtect, uint8_t phySta, uint8_t phyEnd) {
   if (isClassic()) {
     char strs[17] = "\0";
     sp("Page/Blk|BlkAdr|  0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15 | 0123456789abcdef");
-    for (int sector=0; sector <= _maxSectorCL; sector++) {
-      for (int block=0; block<4; block++) {
+    for (int sector=0; sector <= _lastSectorCL; sector++) {
+      uint16_t blocks = nfcSectorBlocksCL(sector);   // 4Kのセクター32以降は16ブロック
+      if (skipUnused && sector >= _minSectorCL && (sector == _minSectorCL ? 0 : nfcDataSizeCL(_minSectorCL, sector - 1)) >= used) {
+        sp("---------+------+-------------------------------------------------+");
+        spf("Sector %d-%d : not used (high water mark=%d)\n", sector, _lastSectorCL, used);
+        break;
+      }
+      for (int block=0; block<blocks; block++) {
         if (block == 0) sp("---------+------+-------------------------------------------------+");
-        uint16_t blockAddr = sector * 4 + block;
-        bool protect = (inProtect && phySta <= blockAddr && blockAddr <= phyEnd && block < 3);   // プロテクト範囲はKeyBで認証する
-        auto usekey = (protect) ? MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_B : MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_A;
+        uint16_t blockAddr = nfcSectorFirstBlockCL(sector) + block;
+        bool protect = (inProtect && phySta <= blockAddr && blockAddr <= phyEnd && block < blocks - 1);   // プロテクト範囲はKeyBで認証する
+        bool useKeyB = protect;
         auto keyRead = (protect) ? _authKeyB : _authKeyA;
         if (_dbgopt & NFCOPT_DUMP_NDEF_CLASSIC) {
-          usekey = MFRC522_I2C::PICC_CMD_MF_AUTH_KEY_A;
+          useKeyB = false;
           keyRead = (sector == 0) ? _authKeyNdefClassic0 : _authKeyNdefClassic1;
         }
-        if (mfrc522.PCD_Authenticate(usekey, blockAddr, &keyRead, &(mfrc522.uid)) == MFRC522_I2C::STATUS_OK) {
+        if (authSectorCL(sector, useKeyB, &keyRead)) {
           if (mfrc522.MIFARE_Read(blockAddr, buffer, &bufferSize) == MFRC522_I2C::STATUS_OK) {
-            String pstr = (protect && block < 3) ? "*" : " ";
-            spf("%s%3d / %d |  %3d | ", pstr, sector, block, blockAddr);
+            String pstr = (protect && block < blocks - 1) ? "*" : " ";
+            spf("%s%3d /%2d |  %3d | ", pstr, sector, block, blockAddr);
             for (int i=0; i < bufferSize-2; i++) {
               spf("%02X ", buffer[i]);
               strs[i] = (buffer[i] >= 0x20 && buffer[i] <= 0x7F) ? buffer[i] : ' ';
             }
             strs[16] = '\0';
             spn("| "+String(strs)+"\n");
+          } else {
+            _authSectorCL = -1;   // 読み込み失敗でカードはIDLEに戻るので再認証が必要
+            _selected = false;
           }
         } else {
           spf("auth error %d/%d:%d\n", sector, block, blockAddr);
@@ -918,42 +2787,46 @@ void NfcEasyWriter::dumpAll(bool inProtect, uint8_t phySta, uint8_t phyEnd) {
       }
       //if (abort) break;
     }
-    mfrc522.PCD_StopCrypto1();
+    stopAuthCL();
 
   // Mifare Ultralightの場合
   } else if (isUltralight()) {
-    bool authed = false;
     char strs[5] = "\0";
+    byte data[NFC_FASTREAD_MAX_PAGES * 4];
     sp("Page : 0  1  2  3  : Text");
     uint8_t maxpage = (_dbgopt & NFCOPT_DUMP_UL255PAGE_READ) ? 255 : _maxPageUL+5;
-    for (uint8_t page=0; page<=(maxpage-2); page+=4) {
-      if (inProtect && !authed) {
-        authUL(false);  // プロテクト時は認証する
-        authed = true;
+    uint16_t lastpage = ((maxpage-2) / 4) * 4 + 3;
+    uint16_t skipPage = (skipUnused) ? _minPageUL + (used + _writeLengthUL - 1) / _writeLengthUL : 256;
+    if (inProtect) authUL(false);  // プロテクト時は認証する
+    for (uint16_t page=0; page<=lastpage; ) {
+      if (page == skipPage && page <= _maxPageUL) {
+        spf("%4d-%d : not used (high water mark=%d)\n", page, _maxPageUL, used);
+        page = _maxPageUL + 1;
+        continue;
       }
-      if (mfrc522.MIFARE_Read(page, buffer, &bufferSize) == MFRC522_I2C::STATUS_OK) {
-        for (int i=0; i < bufferSize-2; i++) {
-          if (i%4 == 0) {
-            String pstr = (inProtect && phySta <= (page+i/4)) ? "*" : " ";
-            spf("%s%3d : ", pstr, page+i/4);
-          }
-          spf("%02X ", buffer[i]);
-          strs[i%4] = (buffer[i] >= 0x20 && buffer[i] <= 0x7F) ? buffer[i] : ' ';
-          strs[4] = '\0';
-          if (i%4 == 3) {
-            spn(": "+String(strs)+"\n");
-          }
+      // 255ページまで読む場合は存在しないページで止まれるようにREADと同じ4ページ単位で読む
+      uint16_t num = (_dbgopt & NFCOPT_DUMP_UL255PAGE_READ) ? 4 : NFC_FASTREAD_MAX_PAGES;
+      if (page + num - 1 > lastpage) num = lastpage - page + 1;
+      if (page < skipPage && page + num > skipPage) num = skipPage - page;
+      uint16_t readNum = 0;
+      bool res = readPagesUL(data, page, num, inProtect, &readNum);
+      for (int i=0; i < readNum*4; i++) {
+        if (i%4 == 0) {
+          String pstr = (inProtect && phySta <= (page+i/4)) ? "*" : " ";
+          spf("%s%3d : ", pstr, page+i/4);
         }
-      } else {
-        spf("auth error %d\n", page);
-        // if (_dbgopt & NFCOPT_DUMP_AUTHFAIL_CONTINUE) { // 無意味なので廃止
-        //   unmountCard();
-        //   mountCard(5000);
-        //   authed = false;
-        //   continue;
-        // }
+        spf("%02X ", data[i]);
+        strs[i%4] = (data[i] >= 0x20 && data[i] <= 0x7F) ? data[i] : ' ';
+        strs[4] = '\0';
+        if (i%4 == 3) {
+          spn(": "+String(strs)+"\n");
+        }
+      }
+      if (!res) {
+        spf("auth error %d\n", page + readNum);
         break;
       }
+      page += num;
     }
   } else {
     sp("UnknownCard Card Type");
@@ -994,3 +2867,410 @@ void NfcEasyWriter::printDumpBin(const byte *data, size_t dataSize) {
   }
   sp("");
 }
+
+
+//
+// 追記型のレコードストア
+//
+
+// エントリの形式
+//   レコード        [0]キー [1]長さ(0xFF=削除) [2-5]シーケンス番号 [6-]データ [最後の2バイト]CRC
+//   コミットスロット [0-1]"NR" [2]バージョン [3]エントリのサイズ [4-7]コミット済みのシーケンス番号 [最後の2バイト]CRC
+static const byte recordMagic[4] = { 'N', 'R', 1, 0 };
+
+// 使用する領域を設定する（vaddrとentrySizeは書き込み単位 Classic=16 Ultralight=4 の倍数、entrySizeは64まで）
+void NfcRecordStore::begin(uint16_t vaddr, uint16_t size, uint16_t entrySize) {
+  end();
+  _vaddr = vaddr;
+  _size = size;
+  _entrySize = entrySize;
+}
+
+// メモリを解放する
+void NfcRecordStore::end() {
+  free(_image);
+  free(_state);
+  _image = nullptr;
+  _state = nullptr;
+  _slotNum = 0;
+  _loaded = false;
+}
+
+// 領域を確認してメモリを確保する
+bool NfcRecordStore::prepare() {
+  _loaded = false;
+  if (! nfc.isMounted()) return false;
+  uint16_t unit = (nfc.isClassic()) ? nfc._writeLengthCL : nfc._writeLengthUL;
+  uint16_t capacity = nfc.getVCapacities();
+  uint16_t size = (_size > 0) ? _size : ((_vaddr < capacity) ? capacity - _vaddr : 0);
+  if (_vaddr % unit != 0 || _entrySize % unit != 0 || _entrySize <= NFC_RECORD_OVERHEAD || _entrySize > NFC_RECORD_MAX_ENTRY) {
+    if (_debug) sp("レコードストアのアドレスかエントリのサイズが書き込み単位に合っていません");
+    return false;
+  }
+  if (_vaddr + size > capacity || size / _entrySize < 3) {
+    if (_debug) sp("レコードストアの領域が足りません");
+    return false;
+  }
+
+  // エントリの数が変わったら確保し直す
+  if (_image == nullptr || _slotNum != size / _entrySize) {
+    end();
+    _slotNum = size / _entrySize;
+    _image = (byte*) malloc(_slotNum * _entrySize);
+    _state = (uint8_t*) malloc(_slotNum);
+    if (_image == nullptr || _state == nullptr) {
+      if (_debug) sp("レコードストアのメモリが確保できません");
+      end();
+      return false;
+    }
+  }
+  return true;
+}
+
+// 領域を初期化する（全てのレコードを消す）
+bool NfcRecordStore::format(ProtectMode mode) {
+  if (! prepare()) return false;
+
+  // 全てのエントリを0で埋めて（CRCが合わないので空きになる）、コミットスロットAにシーケンス番号0を書き込む
+  memset(_image, 0, _slotNum * _entrySize);
+  memset(_state, RS_FREE, _slotNum);
+  memcpy(_image, recordMagic, 4);
+  _image[3] = _entrySize;
+  MFRC522_I2C_Extend::calcCrcA(_image, _entrySize - 2, &_image[_entrySize - 2]);
+  _writeCount = _slotNum;
+  if (! nfc.writeData(_vaddr, _image, _slotNum * _entrySize, mode)) return false;
+  if (nfc._shadowEnabled && ! nfc.flush(mode)) return false;
+
+  _commitSeq = 0;
+  _nextSeq = 1;
+  _commitSlot = 0;
+  _cursor = 2;
+  _uid = nfc.mfrc522.uid;
+  _loaded = true;
+  return true;
+}
+
+// カードから領域全体を読み込んで、最後にコミットした状態に戻す（未フォーマットならfalse）
+bool NfcRecordStore::load(ProtectMode mode) {
+  if (! prepare()) return false;
+
+  // 領域全体をまとめて読み込む
+  _writeCount = 0;
+  if (! nfc.readData(_vaddr, _image, _slotNum * _entrySize, mode)) return false;
+
+  // コミットスロットA/Bのうち、CRCが正しくてシーケンス番号が大きい方を採用する
+  int8_t cslot = -1;
+  _commitSeq = 0;
+  for (uint8_t i=0; i<2; i++) {
+    byte* entry = _image + i * _entrySize;
+    if (! checkEntry(entry, true)) continue;
+    if (cslot < 0 || getSeq(entry, true) > _commitSeq) {
+      cslot = i;
+      _commitSeq = getSeq(entry, true);
+    }
+  }
+  if (cslot < 0) {
+    if (_debug) sp("レコードストアがフォーマットされていません");
+    return false;
+  }
+  _commitSlot = cslot;
+  _nextSeq = _commitSeq + 1;
+
+  // キーごとにコミット済みの最新の版を探す（コミットより新しいものは中断した書き込み）
+  int16_t latest[256];
+  for (int i=0; i<256; i++) latest[i] = -1;
+  memset(_state, RS_FREE, _slotNum);
+  for (uint16_t slot=2; slot<_slotNum; slot++) {
+    byte* entry = _image + slot * _entrySize;
+    if (! checkEntry(entry, false)) continue;
+    uint32_t seq = getSeq(entry);
+    if (seq > _commitSeq) {
+      _state[slot] = RS_ABORTED;
+      continue;
+    }
+    int16_t& l = latest[entry[0]];
+    if (l < 0 || seq > getSeq(_image + l * _entrySize)) l = slot;
+  }
+  for (int i=0; i<256; i++) {
+    if (latest[i] >= 0) _state[latest[i]] = RS_LIVE;
+  }
+  if (_debug) spf("レコードストア commit=%u 空き=%d\n", _commitSeq, freeEntries());
+
+  _cursor = 2;
+  _uid = nfc.mfrc522.uid;
+  _loaded = true;
+  return true;
+}
+
+// マウント中のカードから読み込み済みか？
+bool NfcRecordStore::isLoaded() {
+  if (! _loaded || ! nfc.isMounted()) return false;
+  return (_uid.size == nfc.mfrc522.uid.size && memcmp(_uid.uidByte, nfc.mfrc522.uid.uidByte, _uid.size) == 0);
+}
+
+// レコードを取得する　戻り値はレコードの長さ、無ければ-1
+int NfcRecordStore::get(uint8_t key, void* data, size_t dataSize) {
+  if (! isLoaded()) return -1;
+  int16_t slot = findEntry(key);
+  if (slot < 0) return -1;
+  byte* entry = _image + slot * _entrySize;
+  if (entry[1] == NFC_RECORD_TOMBSTONE) return -1;
+  memcpy(data, &entry[6], (entry[1] < dataSize) ? entry[1] : dataSize);
+  return entry[1];
+}
+
+// レコードを書き込む（1レコードの最大長は maxRecordSize()）
+bool NfcRecordStore::put(uint8_t key, const void* data, size_t dataSize, ProtectMode mode) {
+  if (! isLoaded()) return false;
+  if (dataSize > maxRecordSize()) return false;
+  _writeCount = 0;
+
+  // 新しいキーは空きを1つ残せる場合だけ追加する（既存のレコードをいつでも更新できるようにする）
+  uint16_t need = (data != nullptr && findEntry(key) < 0) ? 2 : 1;
+  if (freeEntries() < need) compact(mode);
+  int16_t slot = (freeEntries() >= need) ? allocEntry() : -1;
+  if (slot < 0) {
+    if (_debug) sp("レコードストアに空きがありません");
+    return false;
+  }
+
+  // エントリを作る
+  byte entry[NFC_RECORD_MAX_ENTRY];
+  memset(entry, 0, _entrySize);
+  entry[0] = key;
+  entry[1] = (data == nullptr) ? NFC_RECORD_TOMBSTONE : dataSize;
+  for (int i=0; i<4; i++) entry[2+i] = (_nextSeq >> (i * 8)) & 0xFF;
+  if (data != nullptr) memcpy(&entry[6], data, dataSize);
+  MFRC522_I2C_Extend::calcCrcA(entry, _entrySize - 2, &entry[_entrySize - 2]);
+
+  // 追記する（同じキーの未コミットの版は不要になる）
+  int16_t old = findEntry(key);
+  if (! writeEntry(slot, entry, mode)) return false;
+  _nextSeq++;
+  if (old >= 0 && _state[old] == RS_PENDING) _state[old] = RS_FREE;
+  _state[slot] = RS_PENDING;
+  _cursor = slot + 1;
+  if (_debug) spf("レコードストア key=%d slot=%d seq=%u\n", key, slot, getSeq(entry));
+
+  return (_autoCommit) ? commit(mode) : true;
+}
+
+// レコードを削除する
+bool NfcRecordStore::remove(uint8_t key, ProtectMode mode) {
+  if (! isLoaded()) return false;
+  if (findEntry(key) < 0) return true;
+  return put(key, nullptr, 0, mode);
+}
+
+// 未コミットの書き込みを確定する
+bool NfcRecordStore::commit(ProtectMode mode) {
+  if (! isLoaded()) return false;
+  if (_nextSeq == _commitSeq + 1) return true;  // 未コミットの書き込みはない
+  if (! _autoCommit) _writeCount = 0;
+
+  // 前回と反対のコミットスロットに書き込む（書き込み中に離れても、もう一方に前回のコミットが残る）
+  uint8_t cslot = 1 - _commitSlot;
+  uint32_t seq = _nextSeq - 1;
+  byte entry[NFC_RECORD_MAX_ENTRY];
+  memset(entry, 0, _entrySize);
+  memcpy(entry, recordMagic, 4);
+  entry[3] = _entrySize;
+  for (int i=0; i<4; i++) entry[4+i] = (seq >> (i * 8)) & 0xFF;
+  MFRC522_I2C_Extend::calcCrcA(entry, _entrySize - 2, &entry[_entrySize - 2]);
+  if (! writeEntry(cslot, entry, mode)) return false;
+  _commitSlot = cslot;
+  _commitSeq = seq;
+
+  // 未コミットの版を最新にして、古い版を空きにする
+  for (uint16_t slot=2; slot<_slotNum; slot++) {
+    if (_state[slot] != RS_PENDING) continue;
+    uint8_t key = _image[slot * _entrySize];
+    for (uint16_t s=2; s<_slotNum; s++) {
+      if (_state[s] == RS_LIVE && _image[s * _entrySize] == key) _state[s] = RS_FREE;
+    }
+    _state[slot] = RS_LIVE;
+  }
+  return true;
+}
+
+// 削除したレコードの古い版を消して、削除の記録に使っているエントリを空ける
+bool NfcRecordStore::compact(ProtectMode mode) {
+  if (! isLoaded()) return false;
+  bool found = false;
+  byte zero[NFC_RECORD_MAX_ENTRY];
+  memset(zero, 0, _entrySize);
+  for (uint16_t slot=2; slot<_slotNum; slot++) {
+    byte* tomb = _image + slot * _entrySize;
+    if (_state[slot] != RS_LIVE || tomb[1] != NFC_RECORD_TOMBSTONE) continue;
+
+    // 古い版が残っていると、削除の記録を上書きした後に復活してしまうので先に消す
+    for (uint16_t s=2; s<_slotNum; s++) {
+      byte* entry = _image + s * _entrySize;
+      if (s == slot || _state[s] != RS_FREE || entry[0] != tomb[0]) continue;
+      if (! checkEntry(entry, false) || getSeq(entry) > _commitSeq) continue;
+      if (! writeEntry(s, zero, mode)) return false;
+    }
+    _state[slot] = RS_FREE;
+    found = true;
+  }
+  if (_debug && found) spf("レコードストアを整理しました 空き=%d\n", freeEntries());
+  return found;
+}
+
+// 空きエントリの数
+uint16_t NfcRecordStore::freeEntries() {
+  uint16_t num = 0;
+  for (uint16_t slot=2; slot<_slotNum; slot++) {
+    if (_state[slot] == RS_FREE || _state[slot] == RS_ABORTED) num++;
+  }
+  return num;
+}
+
+// エントリのCRCと形式を確認する
+bool NfcRecordStore::checkEntry(const byte* entry, bool commitSlot) {
+  byte crc[2];
+  MFRC522_I2C_Extend::calcCrcA(entry, _entrySize - 2, crc);
+  if (entry[_entrySize - 2] != crc[0] || entry[_entrySize - 1] != crc[1]) return false;
+  if (commitSlot) return (memcmp(entry, recordMagic, 3) == 0 && entry[3] == (_entrySize & 0xFF));
+  return (entry[1] == NFC_RECORD_TOMBSTONE || entry[1] <= maxRecordSize());
+}
+
+// エントリのシーケンス番号
+uint32_t NfcRecordStore::getSeq(const byte* entry, bool commitSlot) {
+  uint8_t pos = (commitSlot) ? 4 : 2;
+  uint32_t seq = 0;
+  for (int i=3; i>=0; i--) seq = (seq << 8) | entry[pos + i];
+  return seq;
+}
+
+// キーの最新の版（未コミットを優先）のエントリを探す　無ければ-1
+int16_t NfcRecordStore::findEntry(uint8_t key) {
+  int16_t found = -1;
+  for (uint16_t slot=2; slot<_slotNum; slot++) {
+    if (_image[slot * _entrySize] != key) continue;
+    if (_state[slot] == RS_PENDING) return slot;
+    if (_state[slot] == RS_LIVE) found = slot;
+  }
+  return found;
+}
+
+// 書き込むエントリを選ぶ　無ければ-1
+int16_t NfcRecordStore::allocEntry() {
+  // 中断した書き込みがあれば、シーケンス番号の小さい順に上書きする
+  // （次のコミットより大きいシーケンス番号の残骸しか残らないので、コミット済みと誤認しない）
+  int16_t found = -1;
+  for (uint16_t slot=2; slot<_slotNum; slot++) {
+    if (_state[slot] != RS_ABORTED) continue;
+    if (found < 0 || getSeq(_image + slot * _entrySize) < getSeq(_image + found * _entrySize)) found = slot;
+  }
+  if (found >= 0) return found;
+
+  // 前回書き込んだ次から空きを探す（同じ場所ばかり書き込まないようにする）
+  for (uint16_t i=0; i<_slotNum-2; i++) {
+    uint16_t slot = 2 + (_cursor - 2 + i) % (_slotNum - 2);
+    if (_state[slot] == RS_FREE) return slot;
+  }
+  return -1;
+}
+
+// エントリを書き込む（失敗したら読み込み直すまで使えなくする）
+bool NfcRecordStore::writeEntry(uint16_t slot, byte* entry, ProtectMode mode) {
+  bool res = nfc.writeData(_vaddr + slot * _entrySize, entry, _entrySize, mode);
+  if (res && nfc._shadowEnabled) res = nfc.flush(mode);   // 書き込む順番を守る
+  if (! res) {
+    if (_debug) spf("レコードストア slot=%d 書き込み失敗\n", slot);
+    _loaded = false;
+    return false;
+  }
+  memcpy(_image + slot * _entrySize, entry, _entrySize);
+  _writeCount++;
+  return true;
+}
+
+
+//
+// 中断しても続きから書き込めるジョブ
+//
+
+// マウント中のカードへの書き込みを準備する（書き込みはrun()で行う）
+bool NfcWriteJob::begin(uint16_t vaddr, const void* data, size_t dataSize, ProtectMode mode) {
+  cancel();
+  if (! nfc.isMounted() || data == nullptr) return false;
+  if (mode == PRT_AUTO) mode = nfc._lastProtectMode;   // 再マウント後も同じモードで書き込む
+  if (! nfc.raiseHighWater(vaddr + dataSize, mode)) return false;   // 書き込み単位ごとに記録を更新しないように、先に範囲全体にする
+  _vaddr = vaddr;
+  _data = reinterpret_cast<const byte *>(data);
+  _size = dataSize;
+  _done = 0;
+  _mode = mode;
+  _uid = nfc.mfrc522.uid;
+  _retryCount = 0;
+  _resumeCount = 0;
+  return true;
+}
+
+// 書き込む（中断していれば続きから。同じカードをマウントし直してから呼ぶ）　全て書き込めたらtrue
+bool NfcWriteJob::run() {
+  if (_data == nullptr || ! isSameCard()) return false;
+  if (_done > 0 && _done < _size) _resumeCount++;
+  uint16_t unit = (nfc.isClassic()) ? nfc._writeLengthCL : nfc._writeLengthUL;
+  uint8_t retry = 0;
+  bool res = true;
+
+  // やり直しはこのジョブで行うので、writeData()の中では選択し直して待ったり、やり直したりしない
+  bool retryOnError = nfc._retryOnError;
+  uint32_t reselectTimeout = nfc._reselectTimeout;
+  nfc._retryOnError = false;
+  nfc._reselectTimeout = 0;
+  while (_done < _size) {
+    // 書き込み単位の境界までを1回で書き込んで、書き終わった位置を進める
+    // 完全性チェックの範囲はタグの領域の境界までまとめる（単位ごとに前後を読んでタグを書き込まない）
+    uint16_t vaddr = _vaddr + _done;
+    size_t len = unit - vaddr % unit;
+    uint16_t spanEnd = nfc._tagVaddr + nfc._tagSize;
+    if (nfc._integrity && nfc._tagCount > 0 && vaddr >= nfc._tagVaddr && vaddr < spanEnd) {
+      uint16_t end = nfc._tagVaddr + ((vaddr - nfc._tagVaddr) / nfc._tagRegion + 1) * nfc._tagRegion;
+      len = ((end < spanEnd) ? end : spanEnd) - vaddr;
+    }
+    if (len > _size - _done) len = _size - _done;
+    // RAMシャドウを使っている場合は、flush()でカードまで書き込めてから書き終わった位置を進める
+    bool wres = nfc.writeData(vaddr, const_cast<byte *>(_data + _done), len, _mode);
+    if (wres && nfc._shadowEnabled && nfc.checkShadow()) wres = nfc.flush(_mode);
+    if (wres) {
+      _done += len;
+      retry = 0;
+      continue;
+    }
+    // 通信エラーは待ち時間を倍にしながらやり直す（カードが離れて選択し直せなければ中断する）
+    bool abort = (retry >= _maxRetry);
+    if (! abort) {
+      uint32_t wait = (uint32_t)_retryDelay << retry;
+      delay((wait < _maxRetryDelay) ? wait : _maxRetryDelay);
+      abort = ! nfc.reselectCard();
+      retry++;
+      _retryCount++;
+    }
+    if (abort) {
+      if (_debug) spf("書き込みを中断 %d/%dバイト\n", (int)_done, (int)_size);
+      res = false;
+      break;
+    }
+  }
+  nfc._retryOnError = retryOnError;
+  nfc._reselectTimeout = reselectTimeout;
+  if (res && _debug) spf("書き込み完了 %dバイト retry=%d resume=%d\n", (int)_size, (int)_retryCount, _resumeCount);
+  return res;
+}
+
+// ジョブを取り消す
+void NfcWriteJob::cancel() {
+  _data = nullptr;
+  _size = 0;
+  _done = 0;
+}
+
+// マウント中のカードが書き込み先と同じか？
+bool NfcWriteJob::isSameCard() {
+  if (! nfc.isMounted()) return false;
+  return (_uid.size == nfc.mfrc522.uid.size && memcmp(_uid.uidByte, nfc.mfrc522.uid.uidByte, _uid.size) == 0);
+}
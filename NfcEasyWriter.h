@@ -4,7 +4,7 @@
 
   https://github.com/kaz-mac/NfcEasyWriter
 
-  想定するカード: MIFARE Classic 1K, NTAG213/215/216
+  想定するカード: MIFARE Classic 1K/4K, NTAG213/215/216
   想定するリーダー: M5Stack RFID 2 Unit (WS1850S)
   必要なライブラリ: MFRC522_I2C  https://github.com/kkloesener/MFRC522_I2C
 
@@ -40,6 +40,26 @@
 #define spp(k,v) Serial.println(String(k)+"="+String(v))
 #define array_length(x) (sizeof(x) / sizeof(x[0]))
 
+// 使用可能な容量（仮想アドレス換算、初期設定の使用範囲の場合）
+#define NFC_VCAP_CLASSIC1K  720   // セクター1～15
+#define NFC_VCAP_CLASSIC4K  3408  // セクター1～39（セクター32以降は1セクター15ブロック）
+#define NFC_VCAP_NTAG213    140   // ページ5～39
+#define NFC_VCAP_NTAG215    500   // ページ5～129
+#define NFC_VCAP_NTAG216    884   // ページ5～225
+
+// readStream()/writeStream()/fillData()で使うバッファのサイズ（1回の読み書きはClassic 48バイト、Ultralight 60バイト）
+#define NFC_STREAM_CHUNK  64
+
+// 完全性チェックで1つのタグがチェックするサイズの最大値（書き込み時に前後を読み込むバッファのサイズ）
+#define NFC_TAG_MAX_REGION  64
+
+// 圧縮データのヘッダのサイズ（形式1、圧縮後のサイズ12bit、元のサイズ12bit）
+#define NFC_PACK_HEADER  4
+#define NFC_PACK_MAXSIZE 4095  // 圧縮前・圧縮後のサイズの最大値
+
+// FAST_READで一度に読めるページ数（FIFO 64バイトに応答データ+CRC 2バイトが収まる範囲）
+#define NFC_FASTREAD_MAX_PAGES  15
+
 // オプション
 #define NFCOPT_DUMP_NDEF_CLASSIC        1  // dumpAll()でNDEF書き込み済のMifare Classicを読む（NFC Toolsで書き込んだデータを見るときに使う）
 #define NFCOPT_DUMP_AUTHFAIL_CONTINUE   2  // dumpAll()でClassicの認証エラーが出ても続行する
@@ -55,6 +75,24 @@ enum ProtectMode : uint8_t {  // プロテクトモード
   PRT_PASSWD_RW,    // パスワード認証:あり、読み書き可  （KeyBで読み込み可 KeyBで書き込み可）
   PRT_PASSWD_RO,    // パスワード認証:あり、読み込み専用（KeyBで読み込み可 書き込み不可）
 };
+enum AsyncJob : uint8_t { AJ_NONE, AJ_MOUNT, AJ_READ, AJ_WRITE };   // 非同期処理の種類
+enum AsyncState : uint8_t {  // 非同期処理の状態
+  AS_IDLE,      // 何もしていない
+  AS_DETECT,    // カードの検出を待っている
+  AS_SELECT,    // カードを選択する（通信エラーの後は選択し直す）
+  AS_TYPE,      // カードの種類を判定する
+  AS_VERIFY,    // 完全性チェックのタグとチェックする範囲を読み込む（マウント時）
+  AS_AUTH,      // [Classic] セクターを認証する
+  AS_TRANSFER,  // データを読み書きしている
+  AS_DONE,      // 成功した
+  AS_FAILED,    // 失敗した
+};
+enum RecordState : uint8_t {  // レコードストアのエントリの状態
+  RS_FREE,      // 空き（未使用、CRCエラー、古い版）
+  RS_LIVE,      // コミット済みの最新の版
+  RS_PENDING,   // 書き込み済みで未コミット
+  RS_ABORTED,   // コミットされなかった書き込み（次の書き込みで優先して上書きする）
+};
 struct PhyAddr {  // 物理アドレス
   uint16_t sector;
   uint16_t block;
@@ -74,6 +112,111 @@ struct ULConfigEx { // Ultralightの設定情報＋参考値
 struct AuthKey {  // 認証キー（Classicは48bit使用、Ultralightは32bit使用）
   byte keyByte[6];
 };
+struct CardInfo {  // inventory()で検出したカード
+  MFRC522_I2C::Uid uid;   // UIDとSAK
+  CardType cardType;      // カードの種類
+};
+// readStream()/writeStream()で呼ぶ関数（先頭からoffsetバイト目のlenバイトを、buffから受け取る/buffに入れる。falseを返すと中止）
+typedef bool (*NfcStreamFunc)(void* ctx, size_t offset, byte* buff, size_t len);
+struct NfcStats { // 統計情報（MFRC522_I2C_Extendを通した操作の回数と累積時間us）
+  uint32_t selectCount = 0, selectUs = 0;  // カードの選択（アンチコリジョン/SELECT）
+  uint32_t authCount = 0, authUs = 0;      // 認証（Classic: MFAuthent、Ultralight: PWD_AUTH）
+  uint32_t authFailCount = 0;              // 認証の失敗
+  uint32_t readCount = 0, readUs = 0;      // 読み込みコマンド（READ/FAST_READ）
+  uint32_t writeCount = 0, writeUs = 0;    // 書き込みコマンド（ブロック/ページ）
+  uint32_t crcCount = 0, crcUs = 0;        // CRC_Aの計算（MFRC522_I2Cの内部で行う計算は含まない）
+  uint32_t retryCount = 0;                 // 通信エラーで選択し直してやり直した回数
+};
+
+
+//
+// [Classic] セクターの構造（4Kのセクター32～39は16ブロック、それ以外は4ブロック。最後のブロックはセクタートレーラー）
+//
+constexpr uint16_t nfcSectorBlocksCL(uint16_t sector) { return (sector < 32) ? 4 : 16; }
+constexpr uint16_t nfcSectorFirstBlockCL(uint16_t sector) { return (sector < 32) ? sector * 4 : 128 + (sector - 32) * 16; }
+constexpr uint16_t nfcBlockToSectorCL(uint16_t blockAddr) { return (blockAddr < 128) ? blockAddr / 4 : 32 + (blockAddr - 128) / 16; }
+constexpr uint16_t nfcSectorTrailerCL(uint16_t sector) { return nfcSectorFirstBlockCL(sector) + nfcSectorBlocksCL(sector) - 1; }
+
+// [Classic] セクターfirst～lastのデータ領域のサイズ
+constexpr uint16_t nfcDataSizeCL(uint16_t first, uint16_t last) {
+  return ((first < 32) ? ((last < 32 ? last : 31) - first + 1) * 48 : 0)
+       + ((last >= 32) ? (last - (first > 32 ? first : 32) + 1) * 240 : 0);
+}
+
+// [Classic] 仮想アドレスから物理アドレスに変換する（firstは使用するセクターの先頭）
+inline PhyAddr nfcAddrToPhysicalCL(uint16_t vaddr, uint16_t first) {
+  PhyAddr pa;
+  uint16_t smallSize = (first < 32) ? (32 - first) * 48 : 0;   // 4ブロックのセクターのデータ領域の合計
+  if (vaddr < smallSize) {
+    pa.sector = first + vaddr / 48;
+    pa.block = (vaddr % 48) / 16;
+  } else {
+    uint16_t v = vaddr - smallSize;
+    pa.sector = ((first < 32) ? 32 : first) + v / 240;
+    pa.block = (v % 240) / 16;
+  }
+  pa.blockAddr = nfcSectorFirstBlockCL(pa.sector) + pa.block;
+  return pa;
+}
+
+
+//
+// カードのプロファイル（カードの種類ごとに決まっている構造と、初期設定の使用範囲）
+//
+template <uint16_t Last> struct NfcProfileClassic {
+  static constexpr CardType type = Classic;
+  static constexpr NtagType ntagType = NT_UNKNOWN;
+  static constexpr uint16_t writeLength = 16;  // 書き込み単位
+  static constexpr uint16_t first = 1;         // 使用するセクターの先頭
+  static constexpr uint16_t last = Last;       // 使用するセクターの最後
+  static constexpr bool fixed = true;          // 使用範囲が定数
+};
+typedef NfcProfileClassic<15> NfcProfileClassic1K;
+typedef NfcProfileClassic<39> NfcProfileClassic4K;
+template <NtagType Ntag, uint16_t Last> struct NfcProfileNtag {
+  static constexpr CardType type = Ultralight;
+  static constexpr NtagType ntagType = Ntag;
+  static constexpr uint16_t writeLength = 4;   // 書き込み単位
+  static constexpr uint16_t first = 5;         // 使用するページの先頭
+  static constexpr uint16_t last = Last;       // 使用するページの最後
+  static constexpr bool fixed = true;          // 使用範囲が定数
+};
+typedef NfcProfileNtag<NT_NTAG213, 39> NfcProfileNTAG213;
+typedef NfcProfileNtag<NT_NTAG215, 129> NfcProfileNTAG215;
+typedef NfcProfileNtag<NT_NTAG216, 225> NfcProfileNTAG216;
+// 使用範囲を初期設定から変更した場合（範囲はマウント中の_minSectorCL/_lastSectorCL/_minPageUL/_maxPageULを使う）
+template <CardType Type> struct NfcProfileCustom {
+  static constexpr CardType type = Type;
+  static constexpr NtagType ntagType = NT_UNKNOWN;
+  static constexpr uint16_t writeLength = (Type == Classic) ? 16 : 4;
+  static constexpr uint16_t first = 0;
+  static constexpr uint16_t last = 0;
+  static constexpr bool fixed = false;
+};
+typedef NfcProfileCustom<Classic> NfcProfileClassicCustom;
+typedef NfcProfileCustom<Ultralight> NfcProfileUltralightCustom;
+
+// プロファイルごとの値（コンパイル時に計算する。スキーマの容量チェックに使う）
+template <typename P> struct NfcGeometry {
+  // 使用可能な容量（仮想アドレス換算）
+  static constexpr uint16_t capacity() {
+    return (P::type == Classic) ? nfcDataSizeCL(P::first, P::last) : (P::last - P::first + 1) * P::writeLength;
+  }
+};
+static_assert(NfcGeometry<NfcProfileClassic1K>::capacity() == NFC_VCAP_CLASSIC1K, "NFC_VCAP_CLASSIC1K");
+static_assert(NfcGeometry<NfcProfileClassic4K>::capacity() == NFC_VCAP_CLASSIC4K, "NFC_VCAP_CLASSIC4K");
+static_assert(NfcGeometry<NfcProfileNTAG213>::capacity() == NFC_VCAP_NTAG213, "NFC_VCAP_NTAG213");
+static_assert(NfcGeometry<NfcProfileNTAG215>::capacity() == NFC_VCAP_NTAG215, "NFC_VCAP_NTAG215");
+static_assert(NfcGeometry<NfcProfileNTAG216>::capacity() == NFC_VCAP_NTAG216, "NFC_VCAP_NTAG216");
+
+// プロファイルに特化した読み書きの本体（マウント時にカードと使用範囲に合ったものを選ぶ）
+class NfcEasyWriter;
+struct NfcCore {
+  PhyAddr (NfcEasyWriter::*addr)(uint16_t vaddr);
+  bool (NfcEasyWriter::*read)(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+  bool (NfcEasyWriter::*write)(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+  bool (NfcEasyWriter::*protect)(ProtectMode mode, AuthKey* key, uint16_t vaddr, int size, ProtectMode lastmode);
+};
 
 
 //
@@ -81,12 +224,44 @@ struct AuthKey {  // 認証キー（Classicは48bit使用、Ultralightは32bit
 //
 class MFRC522_I2C_Extend : public MFRC522_I2C {
 public:
+  NfcStats _stats;   // 統計情報
+  TwoWire* _wire;    // I2C（MFRC522_I2Cではprivateなので別に保持する）
+  bool _softCrc = true;  // CRC_Aをソフトウェアで計算する（falseならMFRC522のコプロセッサを使う）
   MFRC522_I2C_Extend(byte chipAddress, byte resetPowerDownPin, TwoWire *TwoWireInstance = &Wire)
-    : MFRC522_I2C(chipAddress, resetPowerDownPin, TwoWireInstance) {}
+    : MFRC522_I2C(chipAddress, resetPowerDownPin, TwoWireInstance), _wire(TwoWireInstance) {}
   // MFRC522の初期化（MFRC522_I2CのPCD_Init()からリセットピンのGPIOの動作を除いたもの）
   void PCD_Init_without_resetpin();
   // Mifare Ultralightのパスワード認証を行う
   byte MIFARE_Ultralight_Authenticate(byte* password, byte* passwordLen, byte* pack, byte* packLen);
+  // NTAG21xのFAST_READで指定範囲のページをまとめて読み込む（bufferにはCRCの2バイトを含む）
+  byte MIFARE_Ultralight_FastRead(byte startPage, byte endPage, byte* buffer, byte* bufferSize);
+  // カード検出用の割り込みを設定する（REQAの応答受信とタイマーのタイムアウトでIRQピンをLOWにする）
+  void PCD_EnableCardDetectIrq(bool enable, uint16_t intervalMs=50);
+  // カード検出用のREQAを送信する（応答は待たない。結果はIRQで通知される）
+  void PCD_StartCardDetect();
+  // 割り込み要因を読み込んでクリアする
+  byte PCD_GetIrqAndClear();
+  // I2Cのクロックを設定する（WS1850Sは400kHzまで対応）
+  void PCD_SetI2cClock(uint32_t hz);
+  // FIFOにまとめて書き込む（1回のI2C転送）
+  void PCD_WriteFifo(byte* data, byte length);
+  // FIFOからまとめて読み込む（1回のI2C転送）
+  void PCD_ReadFifo(byte* data, byte length, byte rxAlign=0);
+  // CRC_A（ISO/IEC 14443-3）をソフトウェアで計算する（resultは下位、上位の順）
+  static void calcCrcA(const byte* data, byte length, byte* result);
+
+  // 以下はMFRC522_I2Cの同名の関数を、I2Cの転送回数を減らして実行する（統計情報も取る）
+  byte PCD_CalculateCRC(byte* data, byte length, byte* result);
+  byte PCD_TransceiveData(byte* sendData, byte sendLen, byte* backData, byte* backLen, byte* validBits=NULL, byte rxAlign=0, bool checkCRC=false);
+  byte PCD_CommunicateWithPICC(byte command, byte waitIRq, byte* sendData, byte sendLen, byte* backData=NULL, byte* backLen=NULL, byte* validBits=NULL, byte rxAlign=0, bool checkCRC=false);
+  byte PCD_MIFARE_Transceive(byte* sendData, byte sendLen, bool acceptTimeout=false);
+  byte PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key* key, Uid* uid);
+  byte MIFARE_Read(byte blockAddr, byte* buffer, byte* bufferSize);
+  byte MIFARE_Write(byte blockAddr, byte* buffer, byte bufferSize);
+  byte MIFARE_Ultralight_Write(byte page, byte* buffer, byte bufferSize);
+  // 以下はMFRC522_I2Cの同名の関数を、統計情報を取りながら実行する
+  byte PICC_Select(Uid* uid, byte validBits=0);
+  bool PICC_ReadCardSerial();
 };
 
 
@@ -98,8 +273,8 @@ public:
   MFRC522_I2C_Extend& mfrc522;  // MFRC522_I2C オブジェクトの参照を保持
   bool _debug = false;  // Serialにデバッグ出力
   uint16_t _dbgopt = 0;   // デバッグオプション
-  uint16_t _minSectorCL = 1;   // Classicで使用するセクタの先頭
-  uint16_t _maxSectorCL = 15;  // Classicで使用するセクタの最後
+  uint16_t _minSectorCL = 1;   // Classicで使用するセクタの先頭（使用範囲はマウント前に設定する）
+  uint16_t _maxSectorCL = 39;  // Classicで使用するセクタの最後（カードより大きければカードの最後まで。1Kは15、4Kは39）
   uint16_t _minPageUL = 5;     // Ultralightで使用するページの先頭（4以上指定可）
   uint16_t _maxPageUL = 39;    // Ultralightで使用するページの最後 39/129/225
   uint16_t _configPageUL = 0;  // Ultralightの設定ページ 41/131/227
@@ -111,13 +286,86 @@ public:
   MFRC522_I2C::MIFARE_Key _authKeyBDefault = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };  // KeyBのデフォルト値（プロテクト解除時に使う）
   MFRC522_I2C::MIFARE_Key _authKeyNdefClassic0 = { 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5 };  // NDEF書込済Classicの初期値 sector0
   MFRC522_I2C::MIFARE_Key _authKeyNdefClassic1 = { 0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7 };  // NDEF書込済Classicの初期値 sector1以降
-  bool _authedUL = true;    // 認証済みフラグ
+  bool _authedUL = false;      // [Ultralight] 選択中のカードでPWD_AUTH済み（HALT、選択し直し、認証エラーで解除される）
+  MFRC522_I2C::MIFARE_Key _authKeyUL;  // [Ultralight] PWD_AUTHで使用したパスワードとPACK
+  uint32_t _authSkipCountUL = 0;  // [Ultralight] 認証済みのため認証を省略した回数（統計用）
+  int16_t _authSectorCL = -1;  // [Classic] 認証済みのセクター（-1=未認証）
+  byte _authCmdCL = 0;         // [Classic] 認証済みセクターで使用した認証コマンド（KeyA/KeyB）
+  MFRC522_I2C::MIFARE_Key _authKeyCL;  // [Classic] 認証済みセクターで使用したキー
+  uint32_t _authSkipCountCL = 0;  // [Classic] 同じセクターのため認証を省略した回数（統計用）
+  bool _fastReadUL = true;     // [Ultralight] FAST_READを使う
+  bool _fastReadNgUL = false;  // [Ultralight] マウント中のカードはFAST_READ非対応（READで読む）
+  bool _configCacheUL = true;  // [Ultralight] マウント時に設定ページを読み込んでおく（readConfigDataUL()はカードを読まない）
+  bool _configValidUL = false; // [Ultralight] _configULがマウント中のカードの設定情報
+  ULConfig _configUL;          // [Ultralight] 設定ページのコピー（writeConfigDataUL()で書き込んだ内容も反映する。PWD/PACKはカードと同じく0）
+  byte _ccUL[4] = { 0 };       // [Ultralight] CC（ページ3）マウント時に読み込む
+  bool _diffWrite = false;     // 差分書き込み（カードの内容と同じブロック/ページは書き込まない）
+  uint16_t _diffSkipCount = 0; // 差分書き込みで省略した書き込み回数（直前のwriteData()/flush()）
+  bool _highWater = false;         // ハイウォーターマーク（書き込んだ範囲の最後）をカードに記録して、format()や読み込みを使用中の範囲だけにする（使用範囲の最後の1ブロック/1ページを記録に使う）
+  int32_t _highWaterMark = -1;     // マウント中のカードのハイウォーターマーク（-1=記録なし、全領域を使用中とみなす）
+  bool _highWaterLoaded = false;   // _highWaterMarkをカードから読み込み済み
+
+  // 完全性チェック（領域ごとのCRC-32をタグとしてカードに記録して、書き込みの中断やデータの破損を検出する）
+  bool _integrity = false;      // 完全性チェックを使う（beginIntegrity()で設定する）
+  bool _tagVerify = true;       // 書き込んだ後にタグだけ読み直して確認する（データは読み直さない）
+  bool _tagLoaded = false;      // マウント中のカードのタグを読み込み済み
+  bool _corrupted = false;      // 直前のreadData()/verifyIntegrity()で壊れたデータを検出した
+  uint16_t _tagVaddr = 0;       // チェックする範囲の先頭
+  uint16_t _tagSpan = 0;        // チェックする範囲のサイズ（0=タグの記録場所を除いた残り全部）
+  uint16_t _tagRegionSet = 0;   // 1つのタグでチェックするサイズ（0=Classic 48、Ultralight 60）
+  uint16_t _tagRegion = 0;      // マウント中のカードで1つのタグがチェックするサイズ
+  uint16_t _tagSize = 0;        // マウント中のカードでチェックする範囲のサイズ
+  uint16_t _tagAddr = 0;        // タグの記録場所（チェックする範囲の直後）
+  uint16_t _tagCount = 0;       // タグの数
+  uint32_t* _tags = nullptr;    // タグ（CRC-32、0=未記録なのでチェックしない）
+  uint8_t* _tagBad = nullptr;   // 壊れていた領域（ビットマップ）
   ProtectMode _lastProtectMode = PRT_NOPASS_RW;  // 最後に設定したプロテクトモード 内部参照用
 
+  // RAMシャドウ（マウント中のカードの使用領域をRAMにキャッシュする）
+  bool _shadowEnabled = false;      // RAMシャドウを使う
+  byte* _shadow = nullptr;          // 使用領域のコピー（仮想アドレス順）
+  uint8_t* _shadowValid = nullptr;  // カードから読み込み済みの単位（ビットマップ）
+  uint8_t* _shadowDirty = nullptr;  // カードに未書き込みの単位（ビットマップ）
+  uint16_t _shadowSize = 0;         // RAMシャドウのサイズ
+  uint16_t _shadowUnit = 16;        // RAMシャドウの管理単位 Classic=16 Ultralight=4
+  MFRC522_I2C::Uid _shadowUid;      // RAMシャドウの元のカードのUID
+
   // マウント時のカード情報
   bool _mounted = false;
+  bool _selected = false;          // カードが選択(ACTIVE)状態か（通信エラーでfalseになり、次の読み書き時に選択し直す）
+  uint32_t _reselectTimeout = 1000;  // 選択し直すときのタイムアウト(ms)
+  bool _retryOnError = true;       // readData()/writeData()で通信エラーになったら選択し直して1回だけやり直す
   CardType _cardType = UnknownCard;
   NtagType _ntagType = NT_UNKNOWN;
+  bool _classic4K = false;         // [Classic] 4Kのカード（セクター0～39）
+  uint16_t _lastSectorCL = 15;     // [Classic] マウント中のカードで使用するセクタの最後（_maxSectorCLとカードの最後の小さい方）
+  const NfcCore* _core = nullptr;  // マウント中のカードの読み書きの本体（mountDetected()で選ぶ）
+
+  // IRQによるカード検出
+  int8_t _irqPin = -1;               // MFRC522のIRQピン（-1=自前の割り込み処理からnotifyIrq()を呼ぶ）
+  bool _irqDetect = false;           // waitCard()でIRQによるカード検出を使う
+  bool _irqArmed = false;            // カード検出用のREQAを送信済み
+  volatile bool _irqFlag = false;    // IRQが発生した（割り込み処理でtrueにする）
+  uint16_t _irqInterval = 50;        // カード検出のREQAを送り直す間隔(ms) MFRC522のタイマーで計る 最大1638
+  static NfcEasyWriter* _irqInstance;  // IRQピンの割り込み処理から通知するインスタンス
+
+  // 非同期処理（poll()を呼ぶたびに1ステップずつ進める）
+  AsyncJob _asyncJob = AJ_NONE;        // 実行中の処理
+  AsyncState _asyncState = AS_IDLE;    // 状態
+  ProtectMode _asyncMode = PRT_AUTO;   // プロテクトモード
+  uint16_t _asyncVaddr = 0;            // 読み書きする仮想アドレス
+  byte* _asyncData = nullptr;          // 読み書きするデータ
+  size_t _asyncSize = 0;               // 読み書きするバイト数
+  size_t _asyncDone = 0;               // 読み書きが終わったバイト数
+  uint32_t _asyncTimeout = 0;          // マウントのタイムアウト(ms) 0=無期限
+  uint32_t _asyncStart = 0;            // 開始した時刻、または選択し直しを始めた時刻(ms)
+  uint32_t _asyncLastTry = 0;          // 最後にカードの検出を試した時刻(ms)
+  bool _asyncRetried = false;          // 通信エラーで選択し直した
+  bool _asyncMarked = false;           // 書き込む範囲全体でハイウォーターマークを更新した
+  uint32_t _asyncCrc = 0;              // [完全性チェック] マウント時に計算中の領域のCRC-32
+  bool _asyncBad = false;              // [完全性チェック] マウント時に壊れた領域があった
+  uint16_t _detectInterval = 100;      // カードの検出を試す間隔(ms)
+  void (*_asyncCallback)(AsyncJob job, bool success) = nullptr;  // 完了時に呼ぶ関数
 
   // コンストラクタ　MFRC522_I2C の参照を受け取る
   NfcEasyWriter(MFRC522_I2C_Extend& ref) : mfrc522(ref) {}
@@ -125,20 +373,88 @@ public:
   // 初期化
   void init();
 
+  // I2Cのクロックを設定する（初期値はWire.begin()の100kHz。400kHzにすると読み書きが速くなる）
+  void setI2cClock(uint32_t hz) { mfrc522.PCD_SetI2cClock(hz); }
+
   // 読み書きできる状態になるまで待つ
   bool waitCard(uint32_t timeout=5000);
 
+  // マウント中のカードと通信できる状態にする（選択中なら何もしない、通信エラー後は同じカードを選択し直す）
+  bool selectCard();
+
+  // マウント中のカードを選択し直す（待たずに1回だけ試す）
+  bool reselectCard();
+
+  // IRQによるカード検出を使う（irqPin=-1の場合は自前の割り込み処理からnotifyIrq()を呼ぶ）
+  bool beginIrqDetect(int8_t irqPin=-1);
+
+  // IRQによるカード検出をやめる
+  void endIrqDetect();
+
+  // IRQが発生したことを通知する（割り込み処理から呼ぶ）
+  void notifyIrq() { _irqFlag = true; }
+
+  // IRQピンの割り込み処理
+  static void irqHandler();
+
+  // 統計情報を取得する
+  NfcStats& getStats() { return mfrc522._stats; }
+
+  // 統計情報をリセットする
+  void resetStats() { mfrc522._stats = NfcStats(); }
+
+  // 統計情報をシリアルに出力する
+  void printStats();
+
+  // IRQによるカード検出を進める（待たない。カードを検出して選択できたらtrue。マウントしていない間に呼ぶ）
+  bool pollCardIrq();
+
   // カードをマウントする（読み書きできる状態になるまで待つ）
   bool mountCard(uint32_t timeout=0, ProtectMode mode=PRT_AUTO);
 
-  // カードのマウントを解除する
-  void unmountCard();
+  // 検出したカードの種類を判定してマウントする（waitCard()の後に実行する）
+  // async=trueならカード全体を読む完全性チェックを行わない（poll()から呼ぶ）
+  bool mountDetected(ProtectMode mode=PRT_AUTO, bool async=false);
+
+  // カードのマウントを解除する（wait=falseならカードが離れるのを待たない）
+  void unmountCard(bool wait=true);
+
+  // 非同期でカードをマウントする（待たずに戻る。poll()で進める。事前にinit()を実行しておく）
+  bool startMount(uint32_t timeout=0, ProtectMode mode=PRT_AUTO);
+
+  // 非同期でカードからデータを読み込む（待たずに戻る。poll()で進める。dataは完了まで保持すること）
+  bool startRead(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // 非同期でデータをカードに書き込む（待たずに戻る。poll()で進める。dataは完了まで保持すること）
+  bool startWrite(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // 非同期処理を1ステップ進める（delay()は使わない。1回の処理はカードとの通信1～2回分）
+  AsyncState poll();
+
+  // 非同期処理を実行中か？
+  bool isBusy();
+
+  // 非同期処理を中止する
+  void cancelAsync();
+
+  // 非同期処理を終了する（状態を更新してコールバックを呼ぶ）
+  void finishAsync(bool success);
+
+  // 非同期で読み込んだデータを完全性チェックのタグと比べる（readData()と同じ。書き込みは常にtrue）
+  bool checkAsyncRead();
 
   // UIDを文字列で返す
   String getUidString();
 
   // カードの種類を大まかに判定する
   CardType checkCardType(MFRC522_I2C &mfrc522);
+  CardType getCardTypeBySak(byte sak);
+
+  // フィールド内の全てのカードを検出する（検出したカードはHALT状態になる）　戻り値は検出した枚数
+  uint8_t inventory(CardInfo* cards, uint8_t maxCards);
+
+  // UIDを指定してカードをマウントする（inventory()で検出したカードを1枚ずつ読み書きする）
+  bool mountCardByUid(const MFRC522_I2C::Uid& uid, ProtectMode mode=PRT_AUTO);
 
   // カードがマウントされているか？（mountCard()が成功したか見てるだけ）
   bool isMounted();
@@ -167,9 +483,33 @@ public:
   // [Ultralight] 物理アドレス指定　1ページ(4バイト)書き込む
   bool rawWriteUL(byte* data, size_t dataSize, uint8_t page);
 
+  // [Ultralight] 物理アドレス指定　複数ページをまとめて読み込む（FAST_READ、非対応ならREAD）
+  bool readPagesUL(byte* data, uint8_t startPage, uint16_t pageNum, bool protect, uint16_t* readNum=nullptr);
+
+  // [Classic] セクター単位で認証する（同じセクター・同じキーで認証済みなら省略する）
+  bool authSectorCL(uint16_t sector, bool useKeyB, MFRC522_I2C::MIFARE_Key* key);
+
+  // [Classic] 認証を終了する
+  void stopAuthCL();
+
   // 仮想アドレスから物理アドレスに変換する
   PhyAddr addr2PhysicalAddr(uint16_t vaddr, CardType cardtype);
 
+  // カードと使用範囲に合ったプロファイルの読み書きの本体を選ぶ（初期設定の範囲でなければNfcProfileCustom）
+  const NfcCore* selectCore();
+
+  // プロファイルPに特化した読み書きの本体（使用範囲と書き込み単位はPの定数。_coreから呼ぶ）
+  template <typename P> PhyAddr addrCore(uint16_t vaddr);
+  template <typename P> bool readCoreCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+  template <typename P> bool writeCoreCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+  template <typename P> bool protectCoreCL(ProtectMode mode, AuthKey* key, uint16_t vaddr, int size, ProtectMode lastmode);
+  template <typename P> bool readCoreUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+  template <typename P> bool writeCoreUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+  template <typename P> bool protectCoreUL(ProtectMode mode, AuthKey* key, uint16_t vaddr, int size, ProtectMode lastmode);
+
+  // 読み書きの本体（通信エラーなら選択し直して1回だけやり直す。RAMシャドウや完全性チェックは通さない）
+  bool transferData(bool write, uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+
   // カードからデータを読み込む
   bool readData(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);    // 共通
   bool readDataCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode=PRT_AUTO);  // for Classic
@@ -180,6 +520,88 @@ public:
   bool writeDataCL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode=PRT_AUTO);  // for Classic
   bool writeDataUL(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode=PRT_AUTO);  // for Ultralight
 
+  // カードから少しずつ読み込んで、関数やStreamに渡す（データ全体のバッファを用意しなくてよい）
+  bool readStream(uint16_t vaddr, size_t dataSize, NfcStreamFunc func, void* ctx=nullptr, ProtectMode mode=PRT_AUTO);
+  bool readStream(uint16_t vaddr, size_t dataSize, Stream& stream, ProtectMode mode=PRT_AUTO);
+
+  // 関数やStreamから少しずつ受け取って、カードに書き込む（データ全体のバッファを用意しなくてよい）
+  bool writeStream(uint16_t vaddr, size_t dataSize, NfcStreamFunc func, void* ctx=nullptr, ProtectMode mode=PRT_AUTO);
+  bool writeStream(uint16_t vaddr, size_t dataSize, Stream& stream, ProtectMode mode=PRT_AUTO);
+
+  // 指定した範囲を同じ値で埋める
+  bool fillData(uint16_t vaddr, size_t dataSize, byte value=0, ProtectMode mode=PRT_AUTO);
+
+  // readStream()/writeStream()で1回に読み書きするバイト数（Classicは3ブロック、UltralightはFAST_READ 1回分）
+  uint16_t getStreamChunk();
+
+  // 使用中の範囲のサイズ（ハイウォーターマーク）を取得する　使わない場合や記録が無い場合は容量を返す
+  uint16_t getUsedSize(ProtectMode mode=PRT_AUTO);
+
+  // ハイウォーターマークを使うか？
+  bool useHighWater();
+
+  // ハイウォーターマークの記録場所（使用範囲の最後のブロック/ページ。getVCapacities()はこの分を除いた容量になる）
+  PhyAddr getHighWaterAddr();
+
+  // ハイウォーターマークをカードから読み込む/カードに書き込む
+  bool loadHighWater(bool protect);
+  bool storeHighWater(uint16_t used, bool protect);
+
+  // 書き込む範囲がハイウォーターマークを超える場合は、データより先に記録を更新する（書き込みの入口で範囲全体について1回だけ呼ぶ）
+  bool raiseHighWater(uint16_t end, ProtectMode mode=PRT_AUTO);
+
+  // 差分書き込み（カードの内容と同じブロック/ページは書き込まない）　戻り値は省略した書き込み回数、失敗時は-1
+  int writeDataDiff(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // 圧縮してカードに書き込む（先頭4バイトはヘッダ）　戻り値はヘッダを含めて書き込んだバイト数、失敗時は-1
+  int writeCompressed(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // writeCompressed()で書き込んだデータを読み込んで展開する　戻り値は展開したバイト数、失敗時は-1
+  int readCompressed(uint16_t vaddr, void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // データを圧縮する（LZ77＋ゼロの連続）　戻り値は圧縮後のバイト数、dstに収まらなければ0
+  static size_t compressData(const byte* src, size_t srcSize, byte* dst, size_t dstSize);
+
+  // 圧縮したデータを展開する　戻り値は展開したバイト数、壊れたデータやdstに収まらなければ0
+  static size_t decompressData(const byte* src, size_t srcSize, byte* dst, size_t dstSize);
+
+  // RAMシャドウを使用する/使用を止める（止める場合は未書き込みのデータを書き込んでから）
+  bool enableShadow(bool enable=true);
+
+  // RAMシャドウの未書き込みデータをカードに書き込む
+  bool flush(ProtectMode mode=PRT_AUTO);
+
+  // RAMシャドウの内容を破棄する（未書き込みのデータも破棄する）
+  void invalidateShadow();
+
+  // RAMシャドウがマウント中のカードのものか確認する（UIDや容量が違えば作り直す）
+  bool checkShadow();
+
+  // RAMシャドウを経由して読み書きする
+  bool readShadow(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+  bool writeShadow(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // 完全性チェックを使う（vaddrからsizeバイトをregionSizeごとにCRC-32でチェックする。タグはその直後に記録する）
+  bool beginIntegrity(uint16_t vaddr=0, uint16_t size=0, uint16_t regionSize=0);
+
+  // 完全性チェックを止める
+  void endIntegrity();
+
+  // チェックする範囲をまとめて読み込んでタグと比べる（マウント時に自動で行う）　壊れた領域があればfalse
+  bool verifyIntegrity(ProtectMode mode=PRT_AUTO);
+
+  // 指定した範囲に壊れた領域があるか（最後に確認した結果を返す。カードは読まない）
+  bool isCorrupted(uint16_t vaddr, size_t dataSize);
+
+  // CRC-32を計算する（crcに前回の結果を渡すと続きを計算する）
+  static uint32_t calcCrc32(const byte* data, size_t length, uint32_t crc=0);
+
+  // 完全性チェックの内部処理
+  bool prepareIntegrity();
+  bool checkIntegrity(uint16_t vaddr, const byte* data, size_t dataSize);
+  bool scanIntegrity(size_t offset, const byte* data, size_t len, uint32_t* crc);
+  bool writeDataTagged(uint16_t vaddr, byte* data, size_t dataSize, ProtectMode mode);
+
   // 認証キーを設定する（書き込みはしない）
   void setAuthKey(AuthKey* key);
   void setAuthKey(MFRC522_I2C::MIFARE_Key* key);
@@ -192,7 +614,7 @@ public:
   bool writeProtectCL(ProtectMode mode, AuthKey* key, uint16_t vaddr, int size, ProtectMode lastmode=PRT_AUTO); // Classic
   bool writeProtectUL(ProtectMode mode, AuthKey* key, uint16_t vaddr, bool phyaddr=false, ProtectMode lastmode=PRT_AUTO); // Ultralight
 
-  // [Ultralight] パスワード認証を行う
+  // [Ultralight] パスワード認証を行う（選択中のカードで同じパスワードで認証済みなら省略する）
   bool authUL(bool checkPack=true);
 
   // [Ultralight] パスワード認証を無効化にする（アンマウントしてから再マウントする）
@@ -235,3 +657,209 @@ public:
   void printDumpBin(const byte *data, size_t dataSize);
 
 };
+
+//
+// 追記型のレコードストア（書き換えの多い小さなデータを、書き込み中にカードが離れても壊れないように保存する）
+//
+// 領域をエントリ単位に分け、先頭の2つをコミットスロットA/B、残りをレコードのログとして使う。
+// レコードの更新は空きエントリへの追記とコミットスロットの書き込み（Classicなら2ブロック）で行い、同じ場所を上書きしない。
+// 読み込みは領域全体を1回で読んで、コミット済みのシーケンス番号以下でCRCが正しい最新の版を採用する。
+//
+#define NFC_RECORD_OVERHEAD   8     // エントリのヘッダ（キー1、長さ1、シーケンス番号4）とCRC 2バイト
+#define NFC_RECORD_TOMBSTONE  0xFF  // 削除したレコードの長さ
+#define NFC_RECORD_MAX_ENTRY  64    // エントリのサイズの最大値
+
+class NfcRecordStore {
+public:
+  NfcEasyWriter& nfc;   // NfcEasyWriter オブジェクトの参照を保持
+  bool _debug = false;  // Serialにデバッグ出力
+  bool _autoCommit = true;      // put()/remove()の度にコミットする（falseならcommit()でまとめて確定する）
+  uint16_t _vaddr = 0;          // 使用する領域の先頭（仮想アドレス）
+  uint16_t _size = 0;           // 使用する領域のサイズ（0=容量の最後まで）
+  uint16_t _entrySize = 16;     // エントリのサイズ（書き込み単位の倍数）
+  uint16_t _slotNum = 0;        // エントリの数（コミットスロットを含む）
+  byte* _image = nullptr;       // 領域のコピー
+  uint8_t* _state = nullptr;    // エントリの状態 RecordState
+  bool _loaded = false;         // カードから読み込み済み
+  MFRC522_I2C::Uid _uid;        // 読み込んだカードのUID
+  uint32_t _commitSeq = 0;      // コミット済みのシーケンス番号
+  uint32_t _nextSeq = 1;        // 次に書き込むエントリのシーケンス番号
+  uint8_t _commitSlot = 0;      // 最後にコミットを書いたスロット 0=A 1=B
+  uint16_t _cursor = 2;         // 次に空きを探し始めるエントリ（書き込む場所を分散する）
+  uint16_t _writeCount = 0;     // 直前の操作で書き込んだエントリ数
+
+  // コンストラクタ　NfcEasyWriter の参照を受け取る
+  NfcRecordStore(NfcEasyWriter& ref) : nfc(ref) {}
+  ~NfcRecordStore() { end(); }
+
+  // 使用する領域を設定する（vaddrとentrySizeは書き込み単位 Classic=16 Ultralight=4 の倍数、entrySizeは64まで）
+  void begin(uint16_t vaddr=0, uint16_t size=0, uint16_t entrySize=16);
+
+  // メモリを解放する
+  void end();
+
+  // 領域を初期化する（全てのレコードを消す）
+  bool format(ProtectMode mode=PRT_AUTO);
+
+  // カードから領域全体を読み込んで、最後にコミットした状態に戻す（未フォーマットならfalse）
+  bool load(ProtectMode mode=PRT_AUTO);
+
+  // マウント中のカードから読み込み済みか？
+  bool isLoaded();
+
+  // レコードを取得する　戻り値はレコードの長さ、無ければ-1
+  int get(uint8_t key, void* data, size_t dataSize);
+
+  // レコードを書き込む（1レコードの最大長は maxRecordSize()）
+  bool put(uint8_t key, const void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // レコードを削除する
+  bool remove(uint8_t key, ProtectMode mode=PRT_AUTO);
+
+  // 未コミットの書き込みを確定する
+  bool commit(ProtectMode mode=PRT_AUTO);
+
+  // 削除したレコードの古い版を消して、削除の記録に使っているエントリを空ける
+  bool compact(ProtectMode mode=PRT_AUTO);
+
+  // 1レコードの最大長
+  uint16_t maxRecordSize() { return _entrySize - NFC_RECORD_OVERHEAD; }
+
+  // 空きエントリの数
+  uint16_t freeEntries();
+
+  // 以下は内部で使用する
+  bool prepare();
+  bool checkEntry(const byte* entry, bool commitSlot);
+  uint32_t getSeq(const byte* entry, bool commitSlot=false);
+  int16_t findEntry(uint8_t key);
+  int16_t allocEntry();
+  bool writeEntry(uint16_t slot, byte* entry, ProtectMode mode);
+};
+
+//
+// 中断しても続きから書き込めるジョブ（大きなデータを書き込み単位ごとに書き込んで、書き終わった位置を記録する）
+//
+// 通信エラーは待ち時間を倍にしながら_maxRetry回までやり直し、それでも失敗したら中断する。
+// 中断したジョブは、同じUIDのカードをマウントし直してからrun()を呼ぶと、失敗したブロック/ページから再開する。
+// マウントしただけでは再開しないので、アプリでisPending()を確認してrun()を呼ぶ。
+//
+class NfcWriteJob {
+public:
+  NfcEasyWriter& nfc;   // NfcEasyWriter オブジェクトの参照を保持
+  bool _debug = false;  // Serialにデバッグ出力
+  uint8_t _maxRetry = 3;          // 1回の書き込みをやり直す回数
+  uint16_t _retryDelay = 10;      // 最初にやり直すまでの待ち時間(ms)　やり直す度に2倍にする
+  uint16_t _maxRetryDelay = 160;  // 待ち時間の上限(ms)
+  uint16_t _vaddr = 0;            // 書き込む仮想アドレス
+  const byte* _data = nullptr;    // 書き込むデータ（書き終わるまで保持しておくこと）
+  size_t _size = 0;               // 書き込むバイト数
+  size_t _done = 0;               // 書き込みが終わったバイト数（次はここから書き込む）
+  ProtectMode _mode = PRT_AUTO;   // プロテクトモード
+  MFRC522_I2C::Uid _uid;          // 書き込み先のカードのUID
+  uint32_t _retryCount = 0;       // 通信エラーでやり直した回数
+  uint16_t _resumeCount = 0;      // 中断したところから再開した回数
+
+  // コンストラクタ　NfcEasyWriter の参照を受け取る
+  NfcWriteJob(NfcEasyWriter& ref) : nfc(ref) {}
+  ~NfcWriteJob() { cancel(); }
+
+  // マウント中のカードへの書き込みを準備する（書き込みはrun()で行う）
+  bool begin(uint16_t vaddr, const void* data, size_t dataSize, ProtectMode mode=PRT_AUTO);
+
+  // 書き込む（中断していれば続きから。同じカードをマウントし直してから呼ぶ）　全て書き込めたらtrue
+  bool run();
+
+  // ジョブを取り消す
+  void cancel();
+
+  // 書き込みの途中か？
+  bool isPending() { return _data != nullptr && _done < _size; }
+
+  // マウント中のカードが書き込み先と同じか？
+  bool isSameCard();
+};
+
+//
+// 型付きのスキーマ（フィールドを書き込み単位の境界に並べて、仮想アドレスをコンパイル時に計算する）
+//
+// struct Balance : NfcField<int32_t> {};      // フィールドの宣言（型を指定する）
+// struct History : NfcField<uint32_t[8]> {};
+// NfcSchema<Classic, NFC_VCAP_CLASSIC1K, 0, Balance, History> schema(nfc);  // カードの種類、容量、先頭の仮想アドレス、フィールドの並び
+// schema.write<Balance>(balance);  schema.read<History>(history);
+//
+template <typename T> struct NfcField { typedef T type; };
+
+// 書き込み単位の倍数に切り上げる
+constexpr uint16_t nfcAlignSize(size_t size, uint16_t unit) { return (size + unit - 1) / unit * unit; }
+
+// フィールドFの仮想アドレス（Fieldsの中に無ければコンパイルエラー）
+template <uint16_t Unit, uint16_t Addr, typename F, typename... Fields> struct NfcFieldAddr {
+  static_assert(sizeof(F) == 0, "NfcSchema: field is not in the schema");
+};
+template <uint16_t Unit, uint16_t Addr, typename F, typename Head, typename... Rest> struct NfcFieldAddr<Unit, Addr, F, Head, Rest...>
+  : NfcFieldAddr<Unit, Addr + nfcAlignSize(sizeof(typename Head::type), Unit), F, Rest...> {};
+template <uint16_t Unit, uint16_t Addr, typename F, typename... Rest> struct NfcFieldAddr<Unit, Addr, F, F, Rest...> {
+  static constexpr uint16_t value = Addr;
+};
+
+// フィールド全体のサイズ（書き込み単位に切り上げた合計）
+template <uint16_t Unit, typename... Fields> struct NfcFieldsSize {
+  static constexpr uint32_t value = 0;
+};
+template <uint16_t Unit, typename Head, typename... Rest> struct NfcFieldsSize<Unit, Head, Rest...> {
+  static constexpr uint32_t value = nfcAlignSize(sizeof(typename Head::type), Unit) + NfcFieldsSize<Unit, Rest...>::value;
+};
+
+template <CardType Type, uint16_t Capacity, uint16_t Base, typename... Fields>
+class NfcSchema {
+public:
+  NfcEasyWriter& nfc;   // NfcEasyWriter オブジェクトの参照を保持
+
+  static_assert(Type == Classic || Type == Ultralight, "NfcSchema: card type must be Classic or Ultralight");
+  static_assert(Base % ((Type == Classic) ? 16 : 4) == 0, "NfcSchema: base address is not aligned to the write unit");
+  static_assert(Base + NfcFieldsSize<(Type == Classic) ? 16 : 4, Fields...>::value <= Capacity, "NfcSchema: fields exceed the card capacity");
+
+  // コンストラクタ　NfcEasyWriter の参照を受け取る
+  NfcSchema(NfcEasyWriter& ref) : nfc(ref) {}
+
+  // 書き込み単位（Classic=16 Ultralight=4）
+  static constexpr uint16_t unitSize() { return (Type == Classic) ? 16 : 4; }
+
+  // スキーマ全体のサイズ
+  static constexpr uint16_t totalSize() { return NfcFieldsSize<unitSize(), Fields...>::value; }
+
+  // フィールドの仮想アドレス
+  template <typename F> static constexpr uint16_t addr() { return NfcFieldAddr<unitSize(), Base, F, Fields...>::value; }
+
+  // フィールドが使う領域のサイズ（書き込み単位に切り上げたもの）
+  template <typename F> static constexpr uint16_t spanSize() { return nfcAlignSize(sizeof(typename F::type), unitSize()); }
+
+  // フィールドの先頭のブロック/ページ（仮想アドレスを書き込み単位で数えたもの）と、その数
+  template <typename F> static constexpr uint16_t firstBlock() { return addr<F>() / unitSize(); }
+  template <typename F> static constexpr uint16_t blockCount() { return spanSize<F>() / unitSize(); }
+
+  // マウント中のカードでスキーマが使えるか？（カードの種類と容量）
+  bool check() {
+    return (nfc.isMounted() && nfc._cardType == Type && Base + totalSize() <= nfc.getVCapacities());
+  }
+
+  // フィールドを読み込む（フィールドのブロックだけを読む）
+  template <typename F> bool read(typename F::type& value, ProtectMode mode=PRT_AUTO) {
+    if (! check()) return false;
+    return nfc.readData(addr<F>(), &value, sizeof(value), mode);
+  }
+
+  // フィールドを書き込む（フィールドのブロックだけを書き込む。余りは0で埋める）
+  template <typename F> bool write(const typename F::type& value, ProtectMode mode=PRT_AUTO) {
+    if (! check()) return false;
+    byte buff[spanSize<F>()];
+    memcpy(buff, &value, sizeof(value));
+    memset(buff + sizeof(value), 0, sizeof(buff) - sizeof(value));
+    return nfc.writeData(addr<F>(), buff, sizeof(buff), mode);
+  }
+};
+
+// プロファイルを指定するスキーマ（例 NfcSchemaFor<NfcProfileNTAG213, 0, Owner, Balance>）
+template <typename P, uint16_t Base, typename... Fields>
+using NfcSchemaFor = NfcSchema<P::type, NfcGeometry<P>::capacity(), Base, Fields...>;
@@ -0,0 +1,94 @@
+/*
+  NfcEasyWriter Example
+  非同期（ノンブロッキング）での読み書きのテスト
+
+  startMount()/startWrite()/startRead()で処理を開始して、loop()の中でpoll()を呼んで少しずつ進める。
+  poll()はdelay()を使わず、1回の呼び出しはカードとの通信1～2回分で戻るので、画面の更新などの処理と並行して実行できる。
+
+  想定するNFCカード: MIFARE Classic, NTAG213/215/216
+  想定するRFIDリーダー: M5Stack RFID 2 Unit (WS1850S)
+  別途必要なライブラリ: MFRC522_I2C
+*/
+#include <M5Unified.h>
+
+#include "NfcEasyWriter.h"
+MFRC522_I2C_Extend mfrc522(0x28, -1, &Wire); // I2C address, dummy, Wire
+NfcEasyWriter nfc(mfrc522);
+
+// デバッグに便利なマクロ定義 --------
+#define sp(x) Serial.println(x)
+#define spn(x) Serial.print(x)
+#define spf(fmt, ...) Serial.printf(fmt, __VA_ARGS__)
+#define spp(k,v) Serial.println(String(k)+"="+String(v))
+
+byte wdata[64], rdata[64];
+uint32_t otherCount = 0;  // NFCの処理中に他の処理を実行できた回数
+
+// 完了時に呼ばれる
+void onNfcDone(AsyncJob job, bool success) {
+  const char* name[] = { "", "マウント", "読み込み", "書き込み" };
+  spf("%s%s (他の処理 %u回)\n", name[job], (success) ? "成功" : "失敗", otherCount);
+  otherCount = 0;
+}
+
+// NFCの処理と並行して行う処理（画面の更新やセンサーの読み込みなど）
+void otherTask() {
+  M5.update();
+  otherCount++;
+}
+
+// 非同期処理が終わるまで他の処理と並行してpoll()を呼ぶ
+bool runAsync() {
+  while (nfc.isBusy()) {
+    nfc.poll();
+    otherTask();
+  }
+  return (nfc._asyncState == AS_DONE);
+}
+
+void setup() {
+  // M5Stack 初期設定
+  auto cfg = M5.config();
+  M5.begin(cfg);
+  Serial.begin(115200);
+  int8_t pinSda = M5.getPin(m5::pin_name_t::port_a_sda);
+  int8_t pinScl = M5.getPin(m5::pin_name_t::port_a_scl);
+  Wire.begin(pinSda, pinScl);
+
+  // RFIDリーダーの初期化（startMount()はMFRC522をリセットしないので、ここで初期化しておく）
+  nfc.init();
+  nfc._debug = false;  // for debug
+  nfc._asyncCallback = onNfcDone;
+}
+
+void loop() {
+  // マウント
+  sp("\nカードを置いてください");
+  nfc.startMount();
+  if (! runAsync()) return;
+
+  // 書き込み
+  for (int i=0; i<sizeof(wdata); i++) wdata[i] = i+1;
+  nfc.startWrite(0, wdata, sizeof(wdata));
+  if (! runAsync()) return;
+  spn("Write Data: ");
+  nfc.printDump1Line(wdata, sizeof(wdata));
+
+  // 読み込み
+  nfc.startRead(0, rdata, sizeof(rdata));
+  if (! runAsync()) return;
+  spn("Read Data:  ");
+  nfc.printDump1Line(rdata, sizeof(rdata));
+  sp((memcmp(wdata, rdata, sizeof(wdata)) == 0) ? "一致しました" : "一致しません");
+
+  // アンマウント
+  nfc.unmountCard();
+
+  // 終了
+  sp("\n\n\nボタンを押すと繰り返します");
+  while (1) {
+    M5.update();
+    if (M5.BtnA.wasPressed()) break;
+    delay(10);
+  }
+}
@@ -0,0 +1,278 @@
+/*
+  benchmark.ino
+  NfcEasyWriterの処理時間を計測して、CSVまたはJSONで出力する
+
+  full_testと同じ操作（マウント、全領域の読み書き、小さいデータの読み書き、プロテクトの設定と解除、フォーマット）の
+  所要時間、RFの送受信回数、I2Cの転送バイト数、転送速度を計測する。
+  また、CRC_Aの計算をMFRC522のコプロセッサ(crc_hw)とソフトウェア(crc_sw)で100フレームずつ行い比較する。
+  出力をファイルに保存しておけば、リリース間で差分を比較できる。
+
+  想定するNFCカード: MIFARE Classic 1K/4K, NTAG213/215/216（カードを置き換えながら1枚ずつ計測する）
+  想定するRFIDリーダー: M5Stack RFID 2 Unit (WS1850S)
+  別途必要なライブラリ: MFRC522_I2C
+
+  extras/host_sim のシミュレーターでも実行できる（RFの送受信回数とI2Cの転送バイト数はシミュレーターでのみ計測できる）
+    ./build.sh ../../example/benchmark/benchmark.ino /tmp/benchmark
+    printf "1\n" | /tmp/benchmark ntag215
+*/
+#include <M5Unified.h>
+
+#include "NfcEasyWriter.h"
+MFRC522_I2C_Extend mfrc522(0x28, -1, &Wire); // I2C address, dummy, Wire
+NfcEasyWriter nfc(mfrc522);
+
+#ifdef NFC_HOST_SIM
+#include "NfcSim.h"
+#endif
+
+// デバッグに便利なマクロ定義 --------
+#define sp(x) Serial.println(x)
+#define spn(x) Serial.print(x)
+#define spf(fmt, ...) Serial.printf(fmt, __VA_ARGS__)
+#define spp(k,v) Serial.println(String(k)+"="+String(v))
+
+AuthKey passwdDefault = {{ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }};
+AuthKey passwdGood = {{ 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6 }};
+
+// 計測結果
+struct BenchResult {
+  const char* op;     // 操作名
+  uint32_t bytes;     // 読み書きしたバイト数
+  uint32_t us;        // 所要時間
+  int32_t rf;         // RFの送受信回数（計測できない場合は-1）
+  int32_t i2c;        // I2Cの転送バイト数（計測できない場合は-1）
+  bool ok;            // 成功したか
+};
+const int maxResults = 16;
+BenchResult results[maxResults];
+int resultCount = 0;
+
+// 計測の開始時点の値
+uint32_t benchStartUs;
+#ifdef NFC_HOST_SIM
+SimStats benchStartStats;
+#endif
+
+//
+// 計測 ------------------------------------------------------
+//
+
+// 計測開始
+void benchBegin() {
+#ifdef NFC_HOST_SIM
+  benchStartStats = simField.stats;
+#endif
+  benchStartUs = micros();
+}
+
+// 計測終了
+void benchEnd(const char* op, uint32_t bytes, bool ok) {
+  uint32_t us = micros() - benchStartUs;
+  if (resultCount >= maxResults) return;
+  BenchResult& r = results[resultCount++];
+  r.op = op;
+  r.bytes = bytes;
+  r.us = us;
+  r.ok = ok;
+#ifdef NFC_HOST_SIM
+  r.rf = simField.stats.rfFrames - benchStartStats.rfFrames;
+  r.i2c = simField.stats.i2cBytes - benchStartStats.i2cBytes;
+#else
+  r.rf = -1;
+  r.i2c = -1;
+#endif
+}
+
+// 転送速度 bytes/s
+uint32_t bytesPerSec(const BenchResult& r) {
+  if (r.bytes == 0 || r.us == 0) return 0;
+  return (uint32_t)((uint64_t)r.bytes * 1000000 / r.us);
+}
+
+// カードの種類の名前
+String cardName() {
+  if (nfc.isClassic()) return (nfc._classic4K) ? "Classic4K" : "Classic1K";
+  if (nfc._ntagType == NT_NTAG213) return "NTAG213";
+  if (nfc._ntagType == NT_NTAG215) return "NTAG215";
+  if (nfc._ntagType == NT_NTAG216) return "NTAG216";
+  return "Unknown";
+}
+
+//
+// ベンチマーク ------------------------------------------------------
+//
+
+// 計測する操作（full_testのシナリオと同じ）
+void runBenchmark() {
+  bool res;
+  bool classic = nfc.isClassic();
+  uint16_t totalSize = nfc.getVCapacities();
+  const size_t tnum = (classic) ? 32 : 16;
+  const uint16_t pvaddr = (classic) ? 0 : 16;   // プロテクトをかける先頭の仮想アドレス
+  ProtectMode mode = PRT_NOPASS_RW;
+  byte* wdata = (byte*) malloc(totalSize);
+  byte* rdata = (byte*) malloc(totalSize);
+  if (wdata == nullptr || rdata == nullptr) {
+    sp("メモリが確保できません");
+    free(wdata);
+    free(rdata);
+    return;
+  }
+  resultCount = 0;
+  nfc.setAuthKey(&passwdDefault);
+  nfc.setNowProtectMode(mode);
+
+  // マウント（カードの検出、種類の判定を含む）
+  nfc.unmountCard();
+  benchBegin();
+  res = nfc.mountCard(5000, mode);
+  benchEnd("mount", 0, res);
+
+  // 全領域の書き込みと読み込み
+  for (int i=0; i<totalSize; i++) wdata[i] = i;
+  benchBegin();
+  res = nfc.writeData(0, wdata, totalSize, mode);
+  benchEnd("write_all", totalSize, res);
+  benchBegin();
+  res = nfc.readData(0, rdata, totalSize, mode);
+  benchEnd("read_all", totalSize, res && memcmp(wdata, rdata, totalSize) == 0);
+
+  // 小さいデータの書き込みと読み込み
+  for (size_t i=0; i<tnum; i++) wdata[i] = i + 11;
+  benchBegin();
+  res = nfc.writeData(0, wdata, tnum, mode);
+  benchEnd("write_small", tnum, res);
+  benchBegin();
+  res = nfc.readData(0, rdata, tnum, mode);
+  benchEnd("read_small", tnum, res && memcmp(wdata, rdata, tnum) == 0);
+
+  // プロテクトをかける
+  benchBegin();
+  if (classic) {
+    res = nfc.writeProtect(PRT_PASSWD_RW, &passwdGood, pvaddr, tnum, mode);
+  } else {
+    res = nfc.writeProtect(PRT_PASSWD_RW, &passwdGood, pvaddr, 0, mode);
+  }
+  benchEnd("protect", 0, res);
+  mode = nfc._lastProtectMode;
+  nfc.setAuthKey(&passwdGood);
+
+  // パスワード認証して読み込む
+  if (! classic) nfc.unauthUL(mode);   // AUTH0の変更は再マウント後に有効になる
+  benchBegin();
+  res = nfc.readData(pvaddr, rdata, tnum, mode);
+  benchEnd("read_protected", tnum, res && memcmp(wdata + pvaddr, rdata, tnum) == 0);
+
+  // プロテクトを解除する
+  benchBegin();
+  if (classic) {
+    res = nfc.writeProtect(PRT_NOPASS_RW, &passwdDefault, pvaddr, tnum, mode);
+  } else {
+    res = nfc.writeProtectUL(PRT_NOPASS_RW, nullptr, 255, true, mode);
+  }
+  benchEnd("unprotect", 0, res);
+  mode = nfc._lastProtectMode;
+  nfc.setAuthKey(&passwdDefault);
+  if (! classic) nfc.unauthUL(mode);
+
+  // フォーマット
+  benchBegin();
+  res = nfc.format(true);
+  benchEnd("format", totalSize, res);
+
+  // CRC_Aの計算（16バイトのフレームを100回） コプロセッサとソフトウェアの比較
+  const int crcLoops = 100;
+  byte crc[2];
+  bool softCrc = mfrc522._softCrc;
+  for (int k=0; k<2; k++) {
+    mfrc522._softCrc = (k == 1);
+    res = true;
+    benchBegin();
+    for (int i=0; i<crcLoops; i++) {
+      if (mfrc522.PCD_CalculateCRC(wdata, 16, crc) != MFRC522_I2C::STATUS_OK) res = false;
+    }
+    benchEnd((k == 0) ? "crc_hw" : "crc_sw", 16 * crcLoops, res);
+  }
+  mfrc522._softCrc = softCrc;
+
+  free(wdata);
+  free(rdata);
+}
+
+// CSVで出力する
+void printCsv() {
+  String card = cardName();
+  sp("card,op,bytes,time_us,rf_frames,i2c_bytes,bytes_per_sec,result");
+  for (int i=0; i<resultCount; i++) {
+    BenchResult& r = results[i];
+    spf("%s,%s,%u,%u,%d,%d,%u,%s\n", card.c_str(), r.op, r.bytes, r.us, r.rf, r.i2c, bytesPerSec(r), (r.ok ? "ok" : "fail"));
+  }
+}
+
+// JSONで出力する
+void printJson() {
+  String card = cardName();
+  spf("{\"card\":\"%s\",\"capacity\":%d,\"results\":[", card.c_str(), nfc.getVCapacities());
+  for (int i=0; i<resultCount; i++) {
+    BenchResult& r = results[i];
+    spf("%s{\"op\":\"%s\",\"bytes\":%u,\"time_us\":%u,\"rf_frames\":%d,\"i2c_bytes\":%d,\"bytes_per_sec\":%u,\"ok\":%s}",
+      (i > 0 ? "," : ""), r.op, r.bytes, r.us, r.rf, r.i2c, bytesPerSec(r), (r.ok ? "true" : "false"));
+  }
+  sp("]}");
+}
+
+// 初期設定 ------------------------------------------------------
+void setup() {
+  auto cfg = M5.config();
+  M5.begin(cfg);
+  Serial.begin(115200);
+
+  // I2Cの設定
+  int8_t pinSda, pinScl;
+  switch(M5.getBoard()) {
+    case m5gfx::board_t::board_M5Dial:  // M5Dialは内部I2C
+      pinSda = M5.getPin(m5::pin_name_t::in_i2c_sda);
+      pinScl = M5.getPin(m5::pin_name_t::in_i2c_scl);
+      break;
+    default:  // その他はPORT A
+      pinSda = M5.getPin(m5::pin_name_t::port_a_sda);
+      pinScl = M5.getPin(m5::pin_name_t::port_a_scl);
+    break;
+  }
+  Wire.begin(pinSda, pinScl);
+  delay(500);
+
+  // RFIDリーダーの初期化
+  nfc.init();
+  nfc._debug = false;  // デバッグ出力は計測に影響するので使わない
+}
+
+// メイン ------------------------------------------------------
+void loop() {
+  // マウント
+  spn("\nカードを置いてください..");
+  while (!nfc.mountCard(1000)) spn(".");
+  sp("認識しました " + cardName());
+
+  // 出力形式の選択
+  sp("1. CSVで出力");
+  sp("2. JSONで出力");
+  spn("入力してください>> ");
+  while (!Serial.available()) delay(10);
+  String input = Serial.readStringUntil('\n');
+  input.trim();
+  int menu = input.toInt();
+  sp(menu);
+  if (menu != 1 && menu != 2) return;
+
+  // 計測
+  sp("計測中です。カードを動かさないでください");
+  runBenchmark();
+  if (menu == 1) printCsv();
+  else printJson();
+
+  // 次のカード
+  nfc.unmountCard();
+  sp("カードを取り除いてください");
+  delay(3000);
+}
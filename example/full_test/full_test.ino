@@ -535,7 +535,7 @@ void utilShowCardInfo() {
   spf("UID: %s\n", nfc.getUidString().c_str());
   if (nfc.isClassic()) {
     sp("カード種別: MIFARE Classic");
-    spf("使用可能セクタ範囲: %d～%d\n", nfc._minSectorCL, nfc._maxSectorCL);
+    spf("使用可能セクタ範囲: %d～%d\n", nfc._minSectorCL, nfc._lastSectorCL);
   } else if (nfc.isUltralight()) {
     // NTAG種別
     spn("カード種別: MIFARE Ultralight ");
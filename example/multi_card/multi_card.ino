@@ -0,0 +1,81 @@
+/*
+  NfcEasyWriter Example
+  重ねて置いた複数のカードを検出して、1枚ずつ読み書きするテスト
+
+  inventory()でフィールド内の全てのカードのUIDを取得し、mountCardByUid()で順番にマウントして読み書きする。
+  カードを1枚ずつ置き換えなくても、まとめて書き込みができる。
+
+  想定するNFCカード: MIFARE Classic, NTAG213/215/216
+  想定するRFIDリーダー: M5Stack RFID 2 Unit (WS1850S)
+  別途必要なライブラリ: MFRC522_I2C
+
+  extras/host_sim のシミュレーターでは、カードの種類をカンマ区切りで指定すると重ねて置ける
+    /tmp/multi_card ntag215,ntag215,classic1k
+*/
+#include <M5Unified.h>
+
+#include "NfcEasyWriter.h"
+MFRC522_I2C_Extend mfrc522(0x28, -1, &Wire); // I2C address, dummy, Wire
+NfcEasyWriter nfc(mfrc522);
+
+// デバッグに便利なマクロ定義 --------
+#define sp(x) Serial.println(x)
+#define spn(x) Serial.print(x)
+#define spf(fmt, ...) Serial.printf(fmt, __VA_ARGS__)
+#define spp(k,v) Serial.println(String(k)+"="+String(v))
+
+const uint8_t maxCards = 8;
+CardInfo cards[maxCards];
+
+
+void setup() {
+  // M5Stack 初期設定
+  auto cfg = M5.config();
+  M5.begin(cfg);
+  Serial.begin(115200);
+  int8_t pinSda = M5.getPin(m5::pin_name_t::port_a_sda);
+  int8_t pinScl = M5.getPin(m5::pin_name_t::port_a_scl);
+  Wire.begin(pinSda, pinScl);
+
+  // RFIDリーダーの初期化
+  nfc.init();
+  nfc._debug = false;  // for debug
+}
+
+void loop() {
+  // 全てのカードを検出する
+  spn("\nカードを置いてください..");
+  uint8_t num;
+  while ((num = nfc.inventory(cards, maxCards)) == 0) {
+    spn(".");
+    delay(500);
+  }
+  spf("\n%d枚のカードを検出しました\n", num);
+  for (int i=0; i<num; i++) {
+    spf("  %d: %s SAK=%02X UID=", i, (cards[i].cardType == Classic) ? "Classic   " : "Ultralight", cards[i].uid.sak);
+    nfc.printDump1Line(cards[i].uid.uidByte, cards[i].uid.size);
+  }
+
+  // 1枚ずつマウントして、カードの番号を書き込んで読み戻す
+  for (int i=0; i<num; i++) {
+    if (! nfc.mountCardByUid(cards[i].uid)) {
+      spf("%d: マウントできません\n", i);
+      continue;
+    }
+    byte wdata[16], rdata[16];
+    for (int j=0; j<sizeof(wdata); j++) wdata[j] = i * 0x10 + j;
+    bool res = nfc.writeData(0, wdata, sizeof(wdata)) && nfc.readData(0, rdata, sizeof(rdata));
+    spf("%d: %s 書き込み%s\n", i, nfc.getUidString().c_str(), (res && memcmp(wdata, rdata, sizeof(wdata)) == 0) ? "成功" : "失敗");
+  }
+
+  // アンマウント
+  nfc.unmountCard();
+
+  // 終了
+  sp("\n\n\nボタンを押すと繰り返します");
+  while (1) {
+    M5.update();
+    if (M5.BtnA.wasPressed()) break;
+    delay(10);
+  }
+}
@@ -0,0 +1,88 @@
+/*
+  NfcEasyWriter Example
+  レコードストアで残高と利用日時を更新するテスト
+
+  NfcRecordStoreは書き換えの多い小さなデータを追記型のログで保存する。
+  更新は空いている場所への追記とコミットの2回の書き込みで行うので、書き込み中にカードが離れても
+  最後にコミットした状態に戻り、同じブロックばかり書き込むこともない。
+  _autoCommit=falseにすると、複数のレコード（ここでは残高と利用日時）をcommit()でまとめて確定できる。
+
+  想定するNFCカード: MIFARE Classic, NTAG213/215/216
+  想定するRFIDリーダー: M5Stack RFID 2 Unit (WS1850S)
+  別途必要なライブラリ: MFRC522_I2C
+*/
+#include <M5Unified.h>
+
+#include "NfcEasyWriter.h"
+MFRC522_I2C_Extend mfrc522(0x28, -1, &Wire); // I2C address, dummy, Wire
+NfcEasyWriter nfc(mfrc522);
+NfcRecordStore store(nfc);
+
+// デバッグに便利なマクロ定義 --------
+#define sp(x) Serial.println(x)
+#define spn(x) Serial.print(x)
+#define spf(fmt, ...) Serial.printf(fmt, __VA_ARGS__)
+#define spp(k,v) Serial.println(String(k)+"="+String(v))
+
+// レコードのキー
+const uint8_t keyBalance = 1;   // 残高
+const uint8_t keyTime = 2;      // 利用日時
+
+
+void setup() {
+  // M5Stack 初期設定
+  auto cfg = M5.config();
+  M5.begin(cfg);
+  Serial.begin(115200);
+  int8_t pinSda = M5.getPin(m5::pin_name_t::port_a_sda);
+  int8_t pinScl = M5.getPin(m5::pin_name_t::port_a_scl);
+  Wire.begin(pinSda, pinScl);
+
+  // RFIDリーダーの初期化
+  nfc.init();
+  nfc._debug = false;  // for debug
+  store.begin(0, 0, 16);   // 容量の全てを16バイトのエントリで使う
+  store._autoCommit = false;
+}
+
+void loop() {
+  // マウント
+  spn("\nカードを置いてください..");
+  while (!nfc.mountCard(1000)) spn(".");
+  sp("認識しました");
+
+  // 読み込む（初めて使うカードならフォーマットする）
+  if (! store.load()) {
+    sp("レコードストアを初期化します");
+    int32_t balance = 1000;
+    uint32_t time = 0;
+    if (!store.format() || !store.put(keyBalance, &balance, sizeof(balance)) || !store.put(keyTime, &time, sizeof(time)) || !store.commit()) {
+      sp("初期化できません");
+      nfc.unmountCard();
+      return;
+    }
+  }
+  int32_t balance = 0;
+  uint32_t time = 0;
+  store.get(keyBalance, &balance, sizeof(balance));
+  store.get(keyTime, &time, sizeof(time));
+  spf("残高=%d 前回の利用=%u 空きエントリ=%d\n", balance, time, store.freeEntries());
+
+  // 100を引いて、残高と利用日時をまとめて更新する
+  balance -= 100;
+  time = millis();
+  nfc.resetStats();
+  bool res = store.put(keyBalance, &balance, sizeof(balance)) && store.put(keyTime, &time, sizeof(time)) && store.commit();
+  spf("更新%s 残高=%d 書き込み回数=%u\n", (res ? "成功" : "失敗"), balance, nfc.getStats().writeCount);
+
+  // アンマウント
+  nfc.unmountCard();
+
+  // 終了
+  sp("\n\n\nボタンを押すと繰り返します");
+  while (1) {
+    M5.update();
+    if (M5.BtnA.wasPressed()) break;
+    delay(10);
+  }
+}
@@ -0,0 +1,107 @@
+/*
+  NfcEasyWriter Example
+  型付きのスキーマでフィールドごとに読み書きするテスト
+
+  NfcSchemaにフィールドの型と並び順を宣言すると、各フィールドの仮想アドレスが書き込み単位
+  （Classicは16バイト、Ultralightは4バイト）の境界にそろうようにコンパイル時に計算される。
+  容量を超える場合はコンパイルエラーになる。read<フィールド>()/write<フィールド>()は、
+  そのフィールドが使うブロック/ページだけを読み書きする。
+
+  想定するNFCカード: MIFARE Classic 1K, NTAG213/215/216
+  想定するRFIDリーダー: M5Stack RFID 2 Unit (WS1850S)
+  別途必要なライブラリ: MFRC522_I2C
+*/
+#include <M5Unified.h>
+
+#include "NfcEasyWriter.h"
+MFRC522_I2C_Extend mfrc522(0x28, -1, &Wire); // I2C address, dummy, Wire
+NfcEasyWriter nfc(mfrc522);
+
+// デバッグに便利なマクロ定義 --------
+#define sp(x) Serial.println(x)
+#define spn(x) Serial.print(x)
+#define spf(fmt, ...) Serial.printf(fmt, __VA_ARGS__)
+#define spp(k,v) Serial.println(String(k)+"="+String(v))
+
+// フィールドの宣言
+struct Owner : NfcField<char[20]> {};       // 所有者の名前
+struct Balance : NfcField<int32_t> {};      // 残高
+struct History : NfcField<uint16_t[10]> {}; // 利用履歴
+
+// カードの種類ごとのスキーマ（先頭の仮想アドレスは0）
+NfcSchema<Classic, NFC_VCAP_CLASSIC1K, 0, Owner, Balance, History> schemaCL(nfc);
+NfcSchema<Ultralight, NFC_VCAP_NTAG213, 0, Owner, Balance, History> schemaUL(nfc);
+
+// フィールドの配置を表示する
+template <typename S> void printLayout(const char* name) {
+  spf("%s: 合計%dバイト\n", name, S::totalSize());
+  spf("  Owner   addr=%3d size=%2d block=%d-%d\n", S::template addr<Owner>(), S::template spanSize<Owner>(), S::template firstBlock<Owner>(), S::template firstBlock<Owner>() + S::template blockCount<Owner>() - 1);
+  spf("  Balance addr=%3d size=%2d block=%d-%d\n", S::template addr<Balance>(), S::template spanSize<Balance>(), S::template firstBlock<Balance>(), S::template firstBlock<Balance>() + S::template blockCount<Balance>() - 1);
+  spf("  History addr=%3d size=%2d block=%d-%d\n", S::template addr<History>(), S::template spanSize<History>(), S::template firstBlock<History>(), S::template firstBlock<History>() + S::template blockCount<History>() - 1);
+}
+
+// 残高を更新して履歴に追加する
+template <typename S> bool update(S& schema) {
+  char owner[20] = "Zunda";
+  int32_t balance = 1000;
+  uint16_t history[10] = {0};
+  if (! schema.template read<Balance>(balance)) return false;
+  if (! schema.template read<History>(history)) return false;
+  if (balance <= 0 || balance > 1000) {   // 初めて使うカード
+    balance = 1000;
+    memset(history, 0, sizeof(history));
+    if (! schema.template write<Owner>(owner)) return false;
+  }
+  balance -= 120;
+  memmove(&history[1], &history[0], sizeof(history) - sizeof(history[0]));
+  history[0] = 120;
+
+  // 残高と履歴のブロック/ページだけを書き込む
+  nfc.resetStats();
+  if (! schema.template write<Balance>(balance)) return false;
+  if (! schema.template write<History>(history)) return false;
+  spf("残高=%d 書き込み回数=%u\n", balance, nfc.getStats().writeCount);
+  if (! schema.template read<Owner>(owner)) return false;
+  spf("所有者=%s 履歴=%d,%d,%d\n", owner, history[0], history[1], history[2]);
+  return true;
+}
+
+
+void setup() {
+  // M5Stack 初期設定
+  auto cfg = M5.config();
+  M5.begin(cfg);
+  Serial.begin(115200);
+  int8_t pinSda = M5.getPin(m5::pin_name_t::port_a_sda);
+  int8_t pinScl = M5.getPin(m5::pin_name_t::port_a_scl);
+  Wire.begin(pinSda, pinScl);
+
+  // RFIDリーダーの初期化
+  nfc.init();
+  nfc._debug = false;  // for debug
+
+  printLayout<decltype(schemaCL)>("Classic");
+  printLayout<decltype(schemaUL)>("Ultralight");
+}
+
+void loop() {
+  // マウント
+  spn("\nカードを置いてください..");
+  while (!nfc.mountCard(1000)) spn(".");
+  sp("認識しました");
+
+  // 読み書き
+  bool res = (nfc.isClassic()) ? update(schemaCL) : update(schemaUL);
+  if (! res) sp("読み書きに失敗しました");
+
+  // アンマウント
+  nfc.unmountCard();
+
+  // 終了
+  sp("\n\n\nボタンを押すと繰り返します");
+  while (1) {
+    M5.update();
+    if (M5.BtnA.wasPressed()) break;
+    delay(10);
+  }
+}
@@ -0,0 +1,164 @@
+/*
+  Arduino.h (host_sim)
+  Linux上でNfcEasyWriterを動かすためのArduino互換の最小限のスタブ
+
+  時間は仮想クロックで進む（delay()やI2C/RFの通信で進み、実時間とは無関係）
+*/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define BIN 2
+#define OCT 8
+#define DEC 10
+#define HEX 16
+
+#define HIGH 1
+#define LOW  0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+
+class __FlashStringHelper;
+#define F(str) (reinterpret_cast<const __FlashStringHelper *>(str))
+
+//
+// 文字列クラス
+// 本物と同様にprintf()の%sへそのまま渡されても動くよう、ポインタ1個だけを持つ（領域は解放しない）
+//
+class String {
+public:
+  String();
+  String(const char* s);
+  String(const __FlashStringHelper* s);
+  String(char c);
+  String(int v, unsigned char base=DEC);
+  String(unsigned int v, unsigned char base=DEC);
+  String(long v, unsigned char base=DEC);
+  String(unsigned long v, unsigned char base=DEC);
+  String(unsigned char v, unsigned char base=DEC);
+  String(double v, unsigned int decimalPlaces=2);
+  const char* c_str() const { return _buf; }
+  unsigned int length() const { return strlen(_buf); }
+  String& operator+=(const String& s);
+  String& operator+=(const char* s);
+  String& operator+=(char c);
+  bool operator==(const String& s) const { return strcmp(_buf, s._buf) == 0; }
+  bool operator==(const char* s) const { return strcmp(_buf, s) == 0; }
+  bool operator!=(const String& s) const { return !(*this == s); }
+  char operator[](unsigned int i) const { return _buf[i]; }
+  int indexOf(char c) const;
+  void trim();
+  long toInt() const { return atol(_buf); }
+  String substring(unsigned int from, unsigned int to=0xFFFF) const;
+private:
+  const char* _buf;
+  static const char* intern(const std::string& s);
+};
+String operator+(const String& a, const String& b);
+String operator+(const String& a, const char* b);
+String operator+(const char* a, const String& b);
+
+//
+// Print / Stream / Serial
+//
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t size);
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const String& s);
+  size_t print(const char* s);
+  size_t print(const __FlashStringHelper* s);
+  size_t print(char c);
+  size_t print(int v, int base=DEC);
+  size_t print(unsigned int v, int base=DEC);
+  size_t print(long v, int base=DEC);
+  size_t print(unsigned long v, int base=DEC);
+  size_t print(unsigned char v, int base=DEC);
+  size_t print(double v, int digits=2);
+  size_t println();
+  template<typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+  template<typename T> size_t println(const T& v, int base) { size_t n = print(v, base); return n + println(); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  size_t readBytes(uint8_t* buf, size_t len);
+  String readStringUntil(char terminator);
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override { return 1; }  // 標準入力から読む（入力が終わったらプログラムを終了する）
+  int read() override;
+  int peek() override;
+  void flush() {}
+  operator bool() const { return true; }
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+  void restart() { exit(0); }
+  uint32_t getFreeHeap() { return 320000; }
+};
+extern EspClass ESP;
+
+//
+// 時間（仮想クロック）
+//
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+//
+// GPIO / 割り込み
+//
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(int irq, void (*isr)(), int mode);
+void detachInterrupt(int irq);
+void noInterrupts();
+void interrupts();
+
+long random(long max);
+long random(long min, long max);
+
+using std::min;
+using std::max;
+
+// シミュレーター用：GPIOのレベルを変化させる（割り込みハンドラが登録されていれば呼ぶ）
+void simSetPinLevel(uint8_t pin, int level);
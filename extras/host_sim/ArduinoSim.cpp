@@ -0,0 +1,192 @@
+/*
+  ArduinoSim.cpp (host_sim)
+  Arduino.hのスタブの実装
+*/
+#include "Arduino.h"
+#include <vector>
+#include <deque>
+
+uint64_t simNowUs();
+void simAdvanceUs(uint64_t us);
+
+//
+// String（領域はプールに確保して解放しない）
+//
+const char* String::intern(const std::string& s) {
+  static std::deque<std::string> pool;
+  pool.push_back(s);
+  return pool.back().c_str();
+}
+
+static std::string numToStr(unsigned long long v, unsigned char base) {
+  if (base < 2 || base > 16) base = 10;
+  if (v == 0) return "0";
+  std::string s;
+  while (v) {
+    s.insert(s.begin(), "0123456789ABCDEF"[v % base]);
+    v /= base;
+  }
+  return s;
+}
+static std::string snumToStr(long long v, unsigned char base) {
+  if (v < 0 && base == 10) return "-" + numToStr((unsigned long long)(-v), base);
+  return numToStr((unsigned long long)v & (base == 10 ? ~0ULL : 0xFFFFFFFFULL), base);
+}
+
+String::String() : _buf(intern("")) {}
+String::String(const char* s) : _buf(intern(s ? s : "")) {}
+String::String(const __FlashStringHelper* s) : _buf(intern(s ? (const char*)s : "")) {}
+String::String(char c) : _buf(intern(std::string(1, c))) {}
+String::String(int v, unsigned char base) : _buf(intern(snumToStr(v, base))) {}
+String::String(unsigned int v, unsigned char base) : _buf(intern(numToStr(v, base))) {}
+String::String(long v, unsigned char base) : _buf(intern(snumToStr(v, base))) {}
+String::String(unsigned long v, unsigned char base) : _buf(intern(numToStr(v, base))) {}
+String::String(unsigned char v, unsigned char base) : _buf(intern(numToStr(v, base))) {}
+String::String(double v, unsigned int decimalPlaces) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, v);
+  _buf = intern(buf);
+}
+String& String::operator+=(const String& s) { _buf = intern(std::string(_buf) + s._buf); return *this; }
+String& String::operator+=(const char* s) { _buf = intern(std::string(_buf) + (s ? s : "")); return *this; }
+String& String::operator+=(char c) { _buf = intern(std::string(_buf) + c); return *this; }
+int String::indexOf(char c) const {
+  const char* p = strchr(_buf, c);
+  return p ? (int)(p - _buf) : -1;
+}
+void String::trim() {
+  std::string s(_buf);
+  size_t b = s.find_first_not_of(" \t\r\n");
+  size_t e = s.find_last_not_of(" \t\r\n");
+  _buf = intern((b == std::string::npos) ? "" : s.substr(b, e - b + 1));
+}
+String String::substring(unsigned int from, unsigned int to) const {
+  std::string s(_buf);
+  if (from > s.size()) from = s.size();
+  if (to > s.size()) to = s.size();
+  if (to < from) to = from;
+  return String(s.substr(from, to - from).c_str());
+}
+String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+String operator+(const String& a, const char* b) { String r(a); r += b; return r; }
+String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+
+//
+// Print / Stream / Serial
+//
+size_t Print::write(const uint8_t* buf, size_t size) {
+  size_t n = 0;
+  for (size_t i=0; i<size; i++) n += write(buf[i]);
+  return n;
+}
+size_t Print::print(const String& s) { return write(s.c_str()); }
+size_t Print::print(const char* s) { return write(s); }
+size_t Print::print(const __FlashStringHelper* s) { return write((const char*)s); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(int v, int base) { return print(String(v, (unsigned char)base)); }
+size_t Print::print(unsigned int v, int base) { return print(String(v, (unsigned char)base)); }
+size_t Print::print(long v, int base) { return print(String(v, (unsigned char)base)); }
+size_t Print::print(unsigned long v, int base) { return print(String(v, (unsigned char)base)); }
+size_t Print::print(unsigned char v, int base) { return print(String(v, (unsigned char)base)); }
+size_t Print::print(double v, int digits) { return print(String(v, (unsigned int)digits)); }
+size_t Print::println() { return write("\r\n"); }
+size_t Print::printf(const char* fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n < 0) return 0;
+  return write((const uint8_t*)buf, strlen(buf));
+}
+size_t Stream::readBytes(uint8_t* buf, size_t len) {
+  size_t n = 0;
+  while (n < len && available() > 0) {
+    int c = read();
+    if (c < 0) break;
+    buf[n++] = (uint8_t)c;
+  }
+  return n;
+}
+
+String Stream::readStringUntil(char terminator) {
+  std::string s;
+  while (true) {
+    int c = read();
+    if (c < 0 || c == terminator) break;
+    s += (char)c;
+  }
+  return String(s.c_str());
+}
+
+HardwareSerial Serial;
+EspClass ESP;
+int HardwareSerial::read() {
+  int c = getchar();
+  if (c == EOF) exit(0);
+  return c;
+}
+int HardwareSerial::peek() {
+  int c = getchar();
+  if (c == EOF) exit(0);
+  ungetc(c, stdin);
+  return c;
+}
+static bool g_serialQuiet = (getenv("SIM_QUIET") != nullptr);
+size_t HardwareSerial::write(uint8_t c) {
+  if (!g_serialQuiet && c != '\r') fputc(c, stdout);
+  return 1;
+}
+size_t HardwareSerial::write(const uint8_t* buf, size_t size) {
+  for (size_t i=0; i<size; i++) write(buf[i]);
+  return size;
+}
+
+//
+// 時間（仮想クロック）
+//
+unsigned long millis() { return (unsigned long)(simNowUs() / 1000); }
+unsigned long micros() { return (unsigned long)simNowUs(); }
+void delay(unsigned long ms) { simAdvanceUs((uint64_t)ms * 1000); }
+void delayMicroseconds(unsigned int us) { simAdvanceUs(us); }
+void yield() {}
+
+//
+// GPIO / 割り込み
+//
+struct SimPin {
+  int level = HIGH;
+  void (*isr)() = nullptr;
+  int mode = 0;
+};
+static SimPin g_pins[64];
+static bool g_irqEnabled = true;
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+int digitalRead(uint8_t pin) { return (pin < 64) ? g_pins[pin].level : LOW; }
+void digitalWrite(uint8_t pin, uint8_t val) { if (pin < 64) g_pins[pin].level = val; }
+int digitalPinToInterrupt(int pin) { return pin; }
+void attachInterrupt(int irq, void (*isr)(), int mode) {
+  if (irq < 0 || irq >= 64) return;
+  g_pins[irq].isr = isr;
+  g_pins[irq].mode = mode;
+}
+void detachInterrupt(int irq) {
+  if (irq < 0 || irq >= 64) return;
+  g_pins[irq].isr = nullptr;
+}
+void noInterrupts() { g_irqEnabled = false; }
+void interrupts() { g_irqEnabled = true; }
+
+void simSetPinLevel(uint8_t pin, int level) {
+  if (pin >= 64) return;
+  SimPin& p = g_pins[pin];
+  int old = p.level;
+  p.level = level;
+  if (p.isr == nullptr || !g_irqEnabled || old == level) return;
+  bool fire = (p.mode == CHANGE) || (p.mode == FALLING && level == LOW) || (p.mode == RISING && level == HIGH);
+  if (fire) p.isr();
+}
+
+long random(long max) { return max > 0 ? (rand() % max) : 0; }
+long random(long min, long max) { return (max > min) ? min + rand() % (max - min) : min; }
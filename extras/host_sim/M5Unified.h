@@ -0,0 +1,32 @@
+/*
+  M5Unified.h (host_sim)
+  サンプルスケッチをホストで動かすためのM5Unifiedの最小限のスタブ
+*/
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+
+namespace m5gfx {
+  enum board_t : uint8_t { board_unknown, board_M5Stack, board_M5StackCore2, board_M5Dial, board_M5StampS3, board_M5AtomS3 };
+}
+namespace m5 {
+  enum class pin_name_t : uint8_t { port_a_sda, port_a_scl, in_i2c_sda, in_i2c_scl };
+  using board_t = m5gfx::board_t;
+  struct config_t {};
+  struct Button {
+    bool wasPressed() { return true; }   // ボタン待ちのループはすぐに抜ける
+    bool isPressed() { return false; }
+    bool wasReleased() { return true; }
+  };
+  class M5Unified {
+  public:
+    config_t config() { return config_t(); }
+    void begin(const config_t&) {}
+    void update() {}
+    int8_t getPin(pin_name_t) { return -1; }
+    board_t getBoard() { return m5gfx::board_M5Stack; }
+    Button BtnA, BtnB, BtnC;
+  };
+}
+using namespace m5;
+extern m5::M5Unified M5;
@@ -0,0 +1,632 @@
+/*
+  MFRC522_I2C.cpp (host_sim)
+  MFRC522_I2C ライブラリのホスト用代替実装
+
+  本家ライブラリと同じ手順でレジスタを操作するので、I2Cのトランザクション数やRFの往復回数は実機とほぼ同じになる。
+*/
+#include "MFRC522_I2C.h"
+
+MFRC522_I2C::MFRC522_I2C(byte chipAddress, byte resetPowerDownPin, TwoWire *TwoWireInstance)
+  : _chipAddress(chipAddress), _resetPowerDownPin(resetPowerDownPin), _TwoWireInstance(TwoWireInstance) {
+  memset(&uid, 0, sizeof(uid));
+}
+
+//
+// 基本的なレジスタ操作
+//
+void MFRC522_I2C::PCD_WriteRegister(byte reg, byte value) {
+  _TwoWireInstance->beginTransmission(_chipAddress);
+  _TwoWireInstance->write(reg);
+  _TwoWireInstance->write(value);
+  _TwoWireInstance->endTransmission();
+}
+
+void MFRC522_I2C::PCD_WriteRegister(byte reg, byte count, byte *values) {
+  _TwoWireInstance->beginTransmission(_chipAddress);
+  _TwoWireInstance->write(reg);
+  for (byte index = 0; index < count; index++) {
+    _TwoWireInstance->write(values[index]);
+  }
+  _TwoWireInstance->endTransmission();
+}
+
+byte MFRC522_I2C::PCD_ReadRegister(byte reg) {
+  byte value;
+  _TwoWireInstance->beginTransmission(_chipAddress);
+  _TwoWireInstance->write(reg);
+  _TwoWireInstance->endTransmission();
+  _TwoWireInstance->requestFrom(_chipAddress, (size_t)1);
+  value = _TwoWireInstance->read();
+  return value;
+}
+
+void MFRC522_I2C::PCD_ReadRegister(byte reg, byte count, byte *values, byte rxAlign) {
+  if (count == 0) return;
+  byte index = 0;
+  _TwoWireInstance->beginTransmission(_chipAddress);
+  _TwoWireInstance->write(reg);
+  _TwoWireInstance->endTransmission();
+  _TwoWireInstance->requestFrom(_chipAddress, (size_t)count);
+  while (_TwoWireInstance->available()) {
+    if (index == 0 && rxAlign) {
+      byte mask = 0;
+      for (byte i = rxAlign; i <= 7; i++) mask |= (1 << i);
+      byte value = _TwoWireInstance->read();
+      values[0] = (values[index] & ~mask) | (value & mask);
+    } else {
+      values[index] = _TwoWireInstance->read();
+    }
+    index++;
+  }
+}
+
+void MFRC522_I2C::setBitMask(unsigned char reg, unsigned char mask) {
+  PCD_SetRegisterBitMask(reg, mask);
+}
+
+void MFRC522_I2C::PCD_SetRegisterBitMask(byte reg, byte mask) {
+  byte tmp = PCD_ReadRegister(reg);
+  PCD_WriteRegister(reg, tmp | mask);
+}
+
+void MFRC522_I2C::PCD_ClearRegisterBitMask(byte reg, byte mask) {
+  byte tmp = PCD_ReadRegister(reg);
+  PCD_WriteRegister(reg, tmp & (~mask));
+}
+
+byte MFRC522_I2C::PCD_CalculateCRC(byte *data, byte length, byte *result) {
+  PCD_WriteRegister(CommandReg, PCD_Idle);
+  PCD_WriteRegister(DivIrqReg, 0x04);
+  PCD_SetRegisterBitMask(FIFOLevelReg, 0x80);
+  PCD_WriteRegister(FIFODataReg, length, data);
+  PCD_WriteRegister(CommandReg, PCD_CalcCRC);
+  for (uint16_t i = 5000; i > 0; i--) {
+    byte n = PCD_ReadRegister(DivIrqReg);
+    if (n & 0x04) {
+      PCD_WriteRegister(CommandReg, PCD_Idle);
+      result[0] = PCD_ReadRegister(CRCResultRegL);
+      result[1] = PCD_ReadRegister(CRCResultRegH);
+      return STATUS_OK;
+    }
+  }
+  return STATUS_TIMEOUT;
+}
+
+//
+// MFRC522の操作
+//
+void MFRC522_I2C::PCD_Init() {
+  PCD_Reset();
+  PCD_WriteRegister(TModeReg, 0x80);
+  PCD_WriteRegister(TPrescalerReg, 0xA9);
+  PCD_WriteRegister(TReloadRegH, 0x03);
+  PCD_WriteRegister(TReloadRegL, 0xE8);
+  PCD_WriteRegister(TxASKReg, 0x40);
+  PCD_WriteRegister(ModeReg, 0x3D);
+  PCD_AntennaOn();
+}
+
+void MFRC522_I2C::PCD_Reset() {
+  PCD_WriteRegister(CommandReg, PCD_SoftReset);
+  delay(50);
+  while (PCD_ReadRegister(CommandReg) & (1 << 4)) {
+  }
+}
+
+void MFRC522_I2C::PCD_AntennaOn() {
+  byte value = PCD_ReadRegister(TxControlReg);
+  if ((value & 0x03) != 0x03) {
+    PCD_WriteRegister(TxControlReg, value | 0x03);
+  }
+}
+
+void MFRC522_I2C::PCD_AntennaOff() {
+  PCD_ClearRegisterBitMask(TxControlReg, 0x03);
+}
+
+byte MFRC522_I2C::PCD_GetAntennaGain() {
+  return PCD_ReadRegister(RFCfgReg) & (0x07 << 4);
+}
+
+void MFRC522_I2C::PCD_SetAntennaGain(byte mask) {
+  if (PCD_GetAntennaGain() != mask) {
+    PCD_ClearRegisterBitMask(RFCfgReg, (0x07 << 4));
+    PCD_SetRegisterBitMask(RFCfgReg, mask & (0x07 << 4));
+  }
+}
+
+bool MFRC522_I2C::PCD_PerformSelfTest() {
+  return true;
+}
+
+//
+// PICCとの通信
+//
+byte MFRC522_I2C::PCD_TransceiveData(byte *sendData, byte sendLen, byte *backData, byte *backLen, byte *validBits, byte rxAlign, bool checkCRC) {
+  byte waitIRq = 0x30;  // RxIRq and IdleIRq
+  return PCD_CommunicateWithPICC(PCD_Transceive, waitIRq, sendData, sendLen, backData, backLen, validBits, rxAlign, checkCRC);
+}
+
+byte MFRC522_I2C::PCD_CommunicateWithPICC(byte command, byte waitIRq, byte *sendData, byte sendLen, byte *backData, byte *backLen, byte *validBits, byte rxAlign, bool checkCRC) {
+  byte n, _validBits = 0;
+  unsigned int i;
+  byte txLastBits = validBits ? *validBits : 0;
+  byte bitFraming = (rxAlign << 4) + txLastBits;
+
+  PCD_WriteRegister(CommandReg, PCD_Idle);
+  PCD_WriteRegister(ComIrqReg, 0x7F);
+  PCD_SetRegisterBitMask(FIFOLevelReg, 0x80);
+  PCD_WriteRegister(FIFODataReg, sendLen, sendData);
+  PCD_WriteRegister(BitFramingReg, bitFraming);
+  PCD_WriteRegister(CommandReg, command);
+  if (command == PCD_Transceive) {
+    PCD_SetRegisterBitMask(BitFramingReg, 0x80);
+  }
+
+  i = 2000;
+  while (1) {
+    n = PCD_ReadRegister(ComIrqReg);
+    if (n & waitIRq) break;
+    if (n & 0x01) return STATUS_TIMEOUT;
+    if (--i == 0) return STATUS_TIMEOUT;
+  }
+
+  byte errorRegValue = PCD_ReadRegister(ErrorReg);
+  if (errorRegValue & 0x13) return STATUS_ERROR;
+
+  if (backData && backLen) {
+    n = PCD_ReadRegister(FIFOLevelReg);
+    if (n > *backLen) return STATUS_NO_ROOM;
+    *backLen = n;
+    PCD_ReadRegister(FIFODataReg, n, backData, rxAlign);
+    _validBits = PCD_ReadRegister(ControlReg) & 0x07;
+    if (validBits) *validBits = _validBits;
+  }
+
+  if (errorRegValue & 0x08) return STATUS_COLLISION;
+
+  if (backData && backLen && checkCRC) {
+    if (*backLen == 1 && _validBits == 4) return STATUS_MIFARE_NACK;
+    if (*backLen < 2 || _validBits != 0) return STATUS_CRC_WRONG;
+    byte controlBuffer[2];
+    n = PCD_CalculateCRC(&backData[0], *backLen - 2, &controlBuffer[0]);
+    if (n != STATUS_OK) return n;
+    if ((backData[*backLen - 2] != controlBuffer[0]) || (backData[*backLen - 1] != controlBuffer[1])) {
+      return STATUS_CRC_WRONG;
+    }
+  }
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C::PICC_RequestA(byte *bufferATQA, byte *bufferSize) {
+  return PICC_REQA_or_WUPA(PICC_CMD_REQA, bufferATQA, bufferSize);
+}
+
+byte MFRC522_I2C::PICC_WakeupA(byte *bufferATQA, byte *bufferSize) {
+  return PICC_REQA_or_WUPA(PICC_CMD_WUPA, bufferATQA, bufferSize);
+}
+
+byte MFRC522_I2C::PICC_REQA_or_WUPA(byte command, byte *bufferATQA, byte *bufferSize) {
+  byte validBits;
+  byte status;
+  if (bufferATQA == NULL || *bufferSize < 2) return STATUS_NO_ROOM;
+  PCD_ClearRegisterBitMask(CollReg, 0x80);
+  validBits = 7;
+  status = PCD_TransceiveData(&command, 1, bufferATQA, bufferSize, &validBits);
+  if (status != STATUS_OK) return status;
+  if (*bufferSize != 2 || validBits != 0) return STATUS_ERROR;
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C::PICC_Select(Uid *uid, byte validBits) {
+  bool uidComplete;
+  bool selectDone;
+  bool useCascadeTag;
+  byte cascadeLevel = 1;
+  byte result;
+  byte count;
+  byte index;
+  byte uidIndex = 0;
+  int8_t currentLevelKnownBits;
+  byte buffer[9];
+  byte bufferUsed;
+  byte rxAlign;
+  byte txLastBits;
+  byte *responseBuffer = NULL;
+  byte responseLength = 0;
+
+  if (validBits > 80) return STATUS_INVALID;
+  PCD_ClearRegisterBitMask(CollReg, 0x80);
+
+  uidComplete = false;
+  while (!uidComplete) {
+    switch (cascadeLevel) {
+      case 1: buffer[0] = PICC_CMD_SEL_CL1; uidIndex = 0; useCascadeTag = validBits && uid->size > 4; break;
+      case 2: buffer[0] = PICC_CMD_SEL_CL2; uidIndex = 3; useCascadeTag = validBits && uid->size > 7; break;
+      case 3: buffer[0] = PICC_CMD_SEL_CL3; uidIndex = 6; useCascadeTag = false; break;
+      default: return STATUS_INTERNAL_ERROR;
+    }
+
+    currentLevelKnownBits = validBits - (8 * uidIndex);
+    if (currentLevelKnownBits < 0) currentLevelKnownBits = 0;
+    index = 2;
+    if (useCascadeTag) buffer[index++] = PICC_CMD_CT;
+    byte bytesToCopy = currentLevelKnownBits / 8 + (currentLevelKnownBits % 8 ? 1 : 0);
+    if (bytesToCopy) {
+      byte maxBytes = useCascadeTag ? 3 : 4;
+      if (bytesToCopy > maxBytes) bytesToCopy = maxBytes;
+      for (count = 0; count < bytesToCopy; count++) buffer[index++] = uid->uidByte[uidIndex + count];
+    }
+    if (useCascadeTag) currentLevelKnownBits += 8;
+
+    selectDone = false;
+    while (!selectDone) {
+      if (currentLevelKnownBits >= 32) {
+        buffer[1] = 0x70;
+        buffer[6] = buffer[2] ^ buffer[3] ^ buffer[4] ^ buffer[5];
+        result = PCD_CalculateCRC(buffer, 7, &buffer[7]);
+        if (result != STATUS_OK) return result;
+        txLastBits = 0;
+        bufferUsed = 9;
+        responseBuffer = &buffer[6];
+        responseLength = 3;
+      } else {
+        txLastBits = currentLevelKnownBits % 8;
+        count = currentLevelKnownBits / 8;
+        index = 2 + count;
+        buffer[1] = (index << 4) + txLastBits;
+        bufferUsed = index + (txLastBits ? 1 : 0);
+        responseBuffer = &buffer[index];
+        responseLength = sizeof(buffer) - index;
+      }
+      rxAlign = txLastBits;
+      PCD_WriteRegister(BitFramingReg, (rxAlign << 4) + txLastBits);
+      result = PCD_TransceiveData(buffer, bufferUsed, responseBuffer, &responseLength, &txLastBits, rxAlign);
+      if (result == STATUS_COLLISION) {
+        byte valueOfCollReg = PCD_ReadRegister(CollReg);
+        if (valueOfCollReg & 0x20) return STATUS_COLLISION;
+        byte collisionPos = valueOfCollReg & 0x1F;
+        if (collisionPos == 0) collisionPos = 32;
+        if (collisionPos <= currentLevelKnownBits) return STATUS_INTERNAL_ERROR;
+        currentLevelKnownBits = collisionPos;
+        count = currentLevelKnownBits % 8;
+        byte checkBit = (currentLevelKnownBits - 1) % 8;
+        index = 1 + (currentLevelKnownBits / 8) + (count ? 1 : 0);
+        buffer[index] |= (1 << checkBit);
+      } else if (result != STATUS_OK) {
+        return result;
+      } else {
+        if (currentLevelKnownBits >= 32) {
+          selectDone = true;
+        } else {
+          currentLevelKnownBits = 32;
+        }
+      }
+    }
+
+    index = (buffer[2] == PICC_CMD_CT) ? 3 : 2;
+    bytesToCopy = (buffer[2] == PICC_CMD_CT) ? 3 : 4;
+    for (count = 0; count < bytesToCopy; count++) uid->uidByte[uidIndex + count] = buffer[index++];
+
+    if (responseLength != 3 || txLastBits != 0) return STATUS_ERROR;
+    result = PCD_CalculateCRC(responseBuffer, 1, &buffer[2]);
+    if (result != STATUS_OK) return result;
+    if ((buffer[2] != responseBuffer[1]) || (buffer[3] != responseBuffer[2])) return STATUS_CRC_WRONG;
+    if (responseBuffer[0] & 0x04) {
+      cascadeLevel++;
+    } else {
+      uidComplete = true;
+      uid->sak = responseBuffer[0];
+    }
+  }
+  uid->size = 3 * cascadeLevel + 1;
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C::PICC_HaltA() {
+  byte result;
+  byte buffer[4];
+  buffer[0] = PICC_CMD_HLTA;
+  buffer[1] = 0;
+  result = PCD_CalculateCRC(buffer, 2, &buffer[2]);
+  if (result != STATUS_OK) return result;
+  result = PCD_TransceiveData(buffer, sizeof(buffer), NULL, 0);
+  if (result == STATUS_TIMEOUT) return STATUS_OK;
+  if (result == STATUS_OK) return STATUS_ERROR;
+  return result;
+}
+
+//
+// MIFARE
+//
+byte MFRC522_I2C::PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key *key, Uid *uid) {
+  byte waitIRq = 0x10;  // IdleIRq
+  byte sendData[12];
+  sendData[0] = command;
+  sendData[1] = blockAddr;
+  for (byte i = 0; i < MF_KEY_SIZE; i++) sendData[2 + i] = key->keyByte[i];
+  for (byte i = 0; i < 4; i++) sendData[8 + i] = uid->uidByte[i];
+  return PCD_CommunicateWithPICC(PCD_MFAuthent, waitIRq, &sendData[0], sizeof(sendData));
+}
+
+void MFRC522_I2C::PCD_StopCrypto1() {
+  PCD_ClearRegisterBitMask(Status2Reg, 0x08);
+}
+
+byte MFRC522_I2C::MIFARE_Read(byte blockAddr, byte *buffer, byte *bufferSize) {
+  byte result;
+  if (buffer == NULL || *bufferSize < 18) return STATUS_NO_ROOM;
+  buffer[0] = PICC_CMD_MF_READ;
+  buffer[1] = blockAddr;
+  result = PCD_CalculateCRC(buffer, 2, &buffer[2]);
+  if (result != STATUS_OK) return result;
+  return PCD_TransceiveData(buffer, 4, buffer, bufferSize, NULL, 0, true);
+}
+
+byte MFRC522_I2C::MIFARE_Write(byte blockAddr, byte *buffer, byte bufferSize) {
+  byte result;
+  if (buffer == NULL || bufferSize < 16) return STATUS_INVALID;
+  byte cmdBuffer[2];
+  cmdBuffer[0] = PICC_CMD_MF_WRITE;
+  cmdBuffer[1] = blockAddr;
+  result = PCD_MIFARE_Transceive(cmdBuffer, 2);
+  if (result != STATUS_OK) return result;
+  result = PCD_MIFARE_Transceive(buffer, bufferSize);
+  if (result != STATUS_OK) return result;
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C::MIFARE_Ultralight_Write(byte page, byte *buffer, byte bufferSize) {
+  byte result;
+  if (buffer == NULL || bufferSize < 4) return STATUS_INVALID;
+  byte cmdBuffer[6];
+  cmdBuffer[0] = PICC_CMD_UL_WRITE;
+  cmdBuffer[1] = page;
+  memcpy(&cmdBuffer[2], buffer, 4);
+  result = PCD_MIFARE_Transceive(cmdBuffer, 6);
+  if (result != STATUS_OK) return result;
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C::MIFARE_Decrement(byte blockAddr, long delta) {
+  return MIFARE_TwoStepHelper(PICC_CMD_MF_DECREMENT, blockAddr, delta);
+}
+
+byte MFRC522_I2C::MIFARE_Increment(byte blockAddr, long delta) {
+  return MIFARE_TwoStepHelper(PICC_CMD_MF_INCREMENT, blockAddr, delta);
+}
+
+byte MFRC522_I2C::MIFARE_Restore(byte blockAddr) {
+  return MIFARE_TwoStepHelper(PICC_CMD_MF_RESTORE, blockAddr, 0L);
+}
+
+byte MFRC522_I2C::MIFARE_TwoStepHelper(byte command, byte blockAddr, long data) {
+  byte result;
+  byte cmdBuffer[2];
+  cmdBuffer[0] = command;
+  cmdBuffer[1] = blockAddr;
+  result = PCD_MIFARE_Transceive(cmdBuffer, 2);
+  if (result != STATUS_OK) return result;
+  result = PCD_MIFARE_Transceive((byte *)&data, 4, true);
+  if (result != STATUS_OK) return result;
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C::MIFARE_Transfer(byte blockAddr) {
+  byte cmdBuffer[2];
+  cmdBuffer[0] = PICC_CMD_MF_TRANSFER;
+  cmdBuffer[1] = blockAddr;
+  return PCD_MIFARE_Transceive(cmdBuffer, 2);
+}
+
+byte MFRC522_I2C::PCD_NTAG216_AUTH(byte *passWord, byte pACK[]) {
+  byte result;
+  byte cmdBuffer[18];
+  cmdBuffer[0] = 0x1B;
+  for (byte i = 0; i < 4; i++) cmdBuffer[i + 1] = passWord[i];
+  result = PCD_CalculateCRC(cmdBuffer, 5, &cmdBuffer[5]);
+  if (result != STATUS_OK) return result;
+  byte waitIRq = 0x30;
+  byte validBits = 0;
+  byte rxlength = 5;
+  result = PCD_CommunicateWithPICC(PCD_Transceive, waitIRq, cmdBuffer, 7, cmdBuffer, &rxlength, &validBits);
+  pACK[0] = cmdBuffer[0];
+  pACK[1] = cmdBuffer[1];
+  if (result != STATUS_OK) return result;
+  return STATUS_OK;
+}
+
+byte MFRC522_I2C::PCD_MIFARE_Transceive(byte *sendData, byte sendLen, bool acceptTimeout) {
+  byte result;
+  byte cmdBuffer[18];
+  if (sendData == NULL || sendLen > 16) return STATUS_INVALID;
+  memcpy(cmdBuffer, sendData, sendLen);
+  result = PCD_CalculateCRC(cmdBuffer, sendLen, &cmdBuffer[sendLen]);
+  if (result != STATUS_OK) return result;
+  sendLen += 2;
+  byte waitIRq = 0x30;
+  byte cmdBufferSize = sizeof(cmdBuffer);
+  byte validBits = 0;
+  result = PCD_CommunicateWithPICC(PCD_Transceive, waitIRq, cmdBuffer, sendLen, cmdBuffer, &cmdBufferSize, &validBits);
+  if (acceptTimeout && result == STATUS_TIMEOUT) return STATUS_OK;
+  if (result != STATUS_OK) return result;
+  if (cmdBufferSize != 1 || validBits != 4) return STATUS_ERROR;
+  if (cmdBuffer[0] != MF_ACK) return STATUS_MIFARE_NACK;
+  return STATUS_OK;
+}
+
+//
+// その他
+//
+const __FlashStringHelper *MFRC522_I2C::GetStatusCodeName(byte code) {
+  switch (code) {
+    case STATUS_OK:             return F("Success.");
+    case STATUS_ERROR:          return F("Error in communication.");
+    case STATUS_COLLISION:      return F("Collission detected.");
+    case STATUS_TIMEOUT:        return F("Timeout in communication.");
+    case STATUS_NO_ROOM:        return F("A buffer is not big enough.");
+    case STATUS_INTERNAL_ERROR: return F("Internal error in the code. Should not happen.");
+    case STATUS_INVALID:        return F("Invalid argument.");
+    case STATUS_CRC_WRONG:      return F("The CRC_A does not match.");
+    case STATUS_MIFARE_NACK:    return F("A MIFARE PICC responded with NAK.");
+    default:                    return F("Unknown error");
+  }
+}
+
+byte MFRC522_I2C::PICC_GetType(byte sak) {
+  if (sak & 0x04) return PICC_TYPE_NOT_COMPLETE;
+  switch (sak) {
+    case 0x09: return PICC_TYPE_MIFARE_MINI;
+    case 0x08: return PICC_TYPE_MIFARE_1K;
+    case 0x18: return PICC_TYPE_MIFARE_4K;
+    case 0x00: return PICC_TYPE_MIFARE_UL;
+    case 0x10:
+    case 0x11: return PICC_TYPE_MIFARE_PLUS;
+    case 0x01: return PICC_TYPE_TNP3XXX;
+    default: break;
+  }
+  if (sak & 0x20) return PICC_TYPE_ISO_14443_4;
+  if (sak & 0x40) return PICC_TYPE_ISO_18092;
+  return PICC_TYPE_UNKNOWN;
+}
+
+const __FlashStringHelper *MFRC522_I2C::PICC_GetTypeName(byte piccType) {
+  switch (piccType) {
+    case PICC_TYPE_ISO_14443_4:  return F("PICC compliant with ISO/IEC 14443-4");
+    case PICC_TYPE_ISO_18092:    return F("PICC compliant with ISO/IEC 18092 (NFC)");
+    case PICC_TYPE_MIFARE_MINI:  return F("MIFARE Mini, 320 bytes");
+    case PICC_TYPE_MIFARE_1K:    return F("MIFARE 1KB");
+    case PICC_TYPE_MIFARE_4K:    return F("MIFARE 4KB");
+    case PICC_TYPE_MIFARE_UL:    return F("MIFARE Ultralight or Ultralight C");
+    case PICC_TYPE_MIFARE_PLUS:  return F("MIFARE Plus");
+    case PICC_TYPE_TNP3XXX:      return F("MIFARE TNP3XXX");
+    case PICC_TYPE_NOT_COMPLETE: return F("SAK indicates UID is not complete.");
+    case PICC_TYPE_UNKNOWN:
+    default:                     return F("Unknown type");
+  }
+}
+
+void MFRC522_I2C::PICC_DumpToSerial(Uid *uid) {
+  MIFARE_Key key;
+  Serial.print(F("Card UID:"));
+  for (byte i = 0; i < uid->size; i++) Serial.printf(" %02X", uid->uidByte[i]);
+  Serial.println();
+  byte piccType = PICC_GetType(uid->sak);
+  Serial.print(F("PICC type: "));
+  Serial.println(PICC_GetTypeName(piccType));
+  switch (piccType) {
+    case PICC_TYPE_MIFARE_MINI:
+    case PICC_TYPE_MIFARE_1K:
+    case PICC_TYPE_MIFARE_4K:
+      for (byte i = 0; i < 6; i++) key.keyByte[i] = 0xFF;
+      PICC_DumpMifareClassicToSerial(uid, piccType, &key);
+      break;
+    case PICC_TYPE_MIFARE_UL:
+      PICC_DumpMifareUltralightToSerial();
+      break;
+    default:
+      Serial.println(F("Dumping memory contents not implemented for that PICC type."));
+      break;
+  }
+  Serial.println();
+  PICC_HaltA();
+}
+
+void MFRC522_I2C::PICC_DumpMifareClassicToSerial(Uid *uid, byte piccType, MIFARE_Key *key) {
+  byte no_of_sectors = 0;
+  switch (piccType) {
+    case PICC_TYPE_MIFARE_MINI: no_of_sectors = 5; break;
+    case PICC_TYPE_MIFARE_1K:   no_of_sectors = 16; break;
+    case PICC_TYPE_MIFARE_4K:   no_of_sectors = 40; break;
+    default: break;
+  }
+  if (no_of_sectors) {
+    Serial.println(F("Sector Block   0  1  2  3   4  5  6  7   8  9 10 11  12 13 14 15  AccessBits"));
+    for (int8_t i = no_of_sectors - 1; i >= 0; i--) {
+      PICC_DumpMifareClassicSectorToSerial(uid, key, i);
+    }
+  }
+  PICC_HaltA();
+  PCD_StopCrypto1();
+}
+
+void MFRC522_I2C::PICC_DumpMifareClassicSectorToSerial(Uid *uid, MIFARE_Key *key, byte sector) {
+  byte firstBlock, no_of_blocks;
+  if (sector < 32) {
+    no_of_blocks = 4;
+    firstBlock = sector * no_of_blocks;
+  } else if (sector < 40) {
+    no_of_blocks = 16;
+    firstBlock = 128 + (sector - 32) * no_of_blocks;
+  } else {
+    return;
+  }
+  byte buffer[18];
+  byte byteCount;
+  for (int8_t blockOffset = no_of_blocks - 1; blockOffset >= 0; blockOffset--) {
+    byte blockAddr = firstBlock + blockOffset;
+    if (blockOffset == no_of_blocks - 1) {
+      byte status = PCD_Authenticate(PICC_CMD_MF_AUTH_KEY_A, firstBlock, key, uid);
+      if (status != STATUS_OK) {
+        Serial.print(F("PCD_Authenticate() failed: "));
+        Serial.println(GetStatusCodeName(status));
+        return;
+      }
+    }
+    byteCount = sizeof(buffer);
+    byte status = MIFARE_Read(blockAddr, buffer, &byteCount);
+    Serial.printf("%6d %5d ", (blockOffset == no_of_blocks - 1) ? sector : 0, blockAddr);
+    if (status != STATUS_OK) {
+      Serial.print(F("MIFARE_Read() failed: "));
+      Serial.println(GetStatusCodeName(status));
+      continue;
+    }
+    for (byte index = 0; index < 16; index++) {
+      Serial.printf(" %02X", buffer[index]);
+      if ((index % 4) == 3) Serial.print(" ");
+    }
+    Serial.println();
+  }
+}
+
+void MFRC522_I2C::PICC_DumpMifareUltralightToSerial() {
+  byte status;
+  byte byteCount;
+  byte buffer[18];
+  Serial.println(F("Page  0  1  2  3"));
+  for (byte page = 0; page < 16; page += 4) {
+    byteCount = sizeof(buffer);
+    status = MIFARE_Read(page, buffer, &byteCount);
+    if (status != STATUS_OK) {
+      Serial.print(F("MIFARE_Read() failed: "));
+      Serial.println(GetStatusCodeName(status));
+      break;
+    }
+    for (byte offset = 0; offset < 4; offset++) {
+      Serial.printf("%3d ", page + offset);
+      for (byte index = 0; index < 4; index++) Serial.printf(" %02X", buffer[4 * offset + index]);
+      Serial.println();
+    }
+  }
+}
+
+void MFRC522_I2C::MIFARE_SetAccessBits(byte *accessBitBuffer, byte g0, byte g1, byte g2, byte g3) {
+  byte c1 = ((g3 & 4) << 1) | ((g2 & 4) << 0) | ((g1 & 4) >> 1) | ((g0 & 4) >> 2);
+  byte c2 = ((g3 & 2) << 2) | ((g2 & 2) << 1) | ((g1 & 2) << 0) | ((g0 & 2) >> 1);
+  byte c3 = ((g3 & 1) << 3) | ((g2 & 1) << 2) | ((g1 & 1) << 1) | ((g0 & 1) << 0);
+  accessBitBuffer[0] = (~c2 & 0xF) << 4 | (~c1 & 0xF);
+  accessBitBuffer[1] = c1 << 4 | (~c3 & 0xF);
+  accessBitBuffer[2] = c3 << 4 | c2;
+}
+
+bool MFRC522_I2C::PICC_IsNewCardPresent() {
+  byte bufferATQA[2];
+  byte bufferSize = sizeof(bufferATQA);
+  byte result = PICC_RequestA(bufferATQA, &bufferSize);
+  return (result == STATUS_OK || result == STATUS_COLLISION);
+}
+
+bool MFRC522_I2C::PICC_ReadCardSerial() {
+  byte result = PICC_Select(&uid);
+  return (result == STATUS_OK);
+}
@@ -0,0 +1,916 @@
+/*
+  NfcSim.cpp (host_sim)
+  MFRC522(WS1850S)とNFCカードのシミュレーター
+*/
+#include "NfcSim.h"
+
+// 定義順で初期化されるように、フィールド、チップ、Wireはこのファイルで定義する
+SimField simField;
+SimChip simChip(&simField);
+TwoWire Wire;
+TwoWire Wire1;
+static struct SimInit {
+  SimInit() { Wire.simAttach(0x28, &simChip); }
+} simInit;
+
+//
+// 仮想クロック
+//
+static uint64_t g_nowUs = 0;
+uint64_t simNowUs() { return g_nowUs; }
+void simAdvanceUs(uint64_t us) {
+  g_nowUs += us;
+  simChip.sync();
+}
+
+// CRC_A (ISO/IEC 14443-3) 初期値0x6363
+void simCrcA(const byte* data, size_t len, byte* out) {
+  uint16_t crc = 0x6363;
+  for (size_t i=0; i<len; i++) {
+    byte b = data[i] ^ (byte)(crc & 0xFF);
+    b ^= (b << 4);
+    crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ ((uint16_t)b >> 4);
+  }
+  out[0] = crc & 0xFF;
+  out[1] = crc >> 8;
+}
+
+//
+// I2C（Wireのスタブ）
+//
+static uint32_t i2cCostUs(size_t bytes) {
+  uint32_t clk = Wire._clock ? Wire._clock : 100000;
+  return simField.latency.i2cTxnOverheadUs + (uint32_t)((uint64_t)bytes * 9 * 1000000 / clk);
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  _txAddr = address;
+  _txLen = 0;
+}
+
+size_t TwoWire::write(uint8_t c) {
+  if (_txLen >= sizeof(_txBuf)) return 0;
+  _txBuf[_txLen++] = c;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t* buf, size_t size) {
+  size_t n = 0;
+  for (size_t i=0; i<size; i++) n += write(buf[i]);
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+  simField.stats.i2cTransactions++;
+  simField.stats.i2cBytes += 1 + _txLen;
+  simAdvanceUs(i2cCostUs(1 + _txLen));
+  if (_simDev == nullptr || _txAddr != _simAddr) return 2;  // NACK on address
+  _simDev->i2cWrite(_txBuf, _txLen);
+  return 0;
+}
+
+size_t TwoWire::requestFrom(uint8_t address, size_t quantity, bool sendStop) {
+  if (quantity > sizeof(_rxBuf)) quantity = sizeof(_rxBuf);
+  simField.stats.i2cTransactions++;
+  simField.stats.i2cBytes += 1 + quantity;
+  simAdvanceUs(i2cCostUs(1 + quantity));
+  _rxPos = 0;
+  _rxLen = 0;
+  if (_simDev == nullptr || address != _simAddr) return 0;
+  _rxLen = _simDev->i2cRead(_rxBuf, quantity);
+  return _rxLen;
+}
+
+//
+// カード共通
+//
+void SimCard::levelFrame(uint8_t lv, byte out[5]) {
+  if (uidSize == 4) {
+    memcpy(out, uid, 4);
+  } else if (uidSize == 7) {
+    if (lv == 1) { out[0] = 0x88; memcpy(&out[1], uid, 3); }
+    else { memcpy(out, &uid[3], 4); }
+  } else {
+    if (lv == 1) { out[0] = 0x88; memcpy(&out[1], uid, 3); }
+    else if (lv == 2) { out[0] = 0x88; memcpy(&out[1], &uid[3], 3); }
+    else { memcpy(out, &uid[6], 4); }
+  }
+  out[4] = out[0] ^ out[1] ^ out[2] ^ out[3];
+}
+
+void SimCard::nak(SimResponse& resp, byte code) {
+  resp.data[0] = code;
+  resp.len = 1;
+  resp.lastBits = 4;
+}
+
+void SimCard::ack(SimResponse& resp) {
+  resp.data[0] = 0x0A;
+  resp.len = 1;
+  resp.lastBits = 4;
+}
+
+bool SimCard::checkCrc(const byte* data, size_t len) {
+  if (len < 3) return false;
+  byte crc[2];
+  simCrcA(data, len - 2, crc);
+  return (crc[0] == data[len - 2] && crc[1] == data[len - 1]);
+}
+
+void SimCard::appendCrc(SimResponse& resp) {
+  simCrcA(resp.data, resp.len, &resp.data[resp.len]);
+  resp.len += 2;
+  resp.lastBits = 0;
+}
+
+//
+// MIFARE Classic 1K/4K
+//
+SimClassic::SimClassic(bool is4k_, const byte* uid4) : is4k(is4k_) {
+  static const byte defUid[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+  uidSize = 4;
+  memcpy(uid, uid4 ? uid4 : defUid, 4);
+  atqa[0] = is4k ? 0x02 : 0x04;
+  atqa[1] = 0x00;
+  sak = is4k ? 0x18 : 0x08;
+  blockCount = is4k ? 256 : 64;
+  memset(mem, 0, sizeof(mem));
+  // ブロック0（製造者ブロック）
+  memcpy(mem[0], uid, 4);
+  mem[0][4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+  mem[0][5] = sak;
+  mem[0][6] = atqa[0];
+  mem[0][7] = atqa[1];
+  // セクタートレーラーの初期値（トランスポート設定）
+  static const byte trailer[16] = { 0xFF,0xFF,0xFF,0xFF,0xFF,0xFF, 0xFF,0x07,0x80,0x69, 0xFF,0xFF,0xFF,0xFF,0xFF,0xFF };
+  for (uint16_t s=0; s<sectorCount(); s++) {
+    memcpy(mem[firstBlockOf(s) + blocksIn(s) - 1], trailer, 16);
+  }
+}
+
+uint16_t SimClassic::sectorOf(uint16_t block) {
+  return (block < 128) ? block / 4 : 32 + (block - 128) / 16;
+}
+
+uint16_t SimClassic::firstBlockOf(uint16_t sector) {
+  return (sector < 32) ? sector * 4 : 128 + (sector - 32) * 16;
+}
+
+uint16_t SimClassic::blocksIn(uint16_t sector) {
+  return (sector < 32) ? 4 : 16;
+}
+
+// ブロックのアクセス条件 c1c2c3 を返す
+uint8_t SimClassic::accessOf(uint16_t block) {
+  uint16_t sector = sectorOf(block);
+  uint16_t first = firstBlockOf(sector);
+  uint16_t n = blocksIn(sector);
+  const byte* tr = mem[first + n - 1];
+  uint16_t idx = block - first;
+  uint8_t g = (idx == n - 1) ? 3 : (n == 4 ? idx : idx / 5);
+  uint8_t c1 = (tr[7] >> (4 + g)) & 1;
+  uint8_t c2 = (tr[8] >> g) & 1;
+  uint8_t c3 = (tr[8] >> (4 + g)) & 1;
+  return (c1 << 2) | (c2 << 1) | c3;
+}
+
+bool SimClassic::keyBReadable(uint16_t sector) {
+  uint16_t trailerBlock = firstBlockOf(sector) + blocksIn(sector) - 1;
+  uint8_t acc = accessOf(trailerBlock);
+  return (acc == 0b000 || acc == 0b010 || acc == 0b001);
+}
+
+bool SimClassic::canRead(uint16_t block) {
+  uint16_t sector = sectorOf(block);
+  if (authSector != (int16_t)sector) return false;
+  uint16_t trailerBlock = firstBlockOf(sector) + blocksIn(sector) - 1;
+  if (block == trailerBlock) return true;   // トレーラーは何らかの形で読める（マスクして返す）
+  if (authKeyB && keyBReadable(sector)) return false;
+  switch (accessOf(block)) {
+    case 0b000: case 0b010: case 0b100: case 0b110: case 0b001: return true;
+    case 0b011: case 0b101: return authKeyB;
+    default: return false;
+  }
+}
+
+bool SimClassic::canWrite(uint16_t block) {
+  uint16_t sector = sectorOf(block);
+  if (block == 0) return false;
+  if (authSector != (int16_t)sector) return false;
+  uint16_t trailerBlock = firstBlockOf(sector) + blocksIn(sector) - 1;
+  uint8_t acc = accessOf(block);
+  if (block == trailerBlock) {
+    // いずれかのフィールドが書き込めるならOK
+    switch (acc) {
+      case 0b000: case 0b001: return !authKeyB;
+      case 0b100: case 0b011: case 0b101: return authKeyB;
+      default: return false;
+    }
+  }
+  if (authKeyB && keyBReadable(sector)) return false;
+  switch (acc) {
+    case 0b000: return true;
+    case 0b100: case 0b110: case 0b011: return authKeyB;
+    default: return false;
+  }
+}
+
+void SimClassic::writeBlock(uint16_t block, const byte* data) {
+  uint16_t sector = sectorOf(block);
+  uint16_t trailerBlock = firstBlockOf(sector) + blocksIn(sector) - 1;
+  writes++;
+  if (block != trailerBlock) {
+    memcpy(mem[block], data, 16);
+    return;
+  }
+  // セクタートレーラーはフィールドごとに書き込み権限が異なる
+  uint8_t acc = accessOf(block);
+  bool keyAW = false, accW = false, keyBW = false;
+  switch (acc) {
+    case 0b000: keyAW = !authKeyB; accW = false;     keyBW = !authKeyB; break;
+    case 0b010: break;
+    case 0b100: keyAW = authKeyB;  accW = false;     keyBW = authKeyB; break;
+    case 0b110: break;
+    case 0b001: keyAW = !authKeyB; accW = !authKeyB; keyBW = !authKeyB; break;
+    case 0b011: keyAW = authKeyB;  accW = authKeyB;  keyBW = authKeyB; break;
+    case 0b101: accW = authKeyB; break;
+    case 0b111: break;
+  }
+  if (keyAW) memcpy(&mem[block][0], &data[0], 6);
+  if (accW) memcpy(&mem[block][6], &data[6], 4);
+  if (keyBW) memcpy(&mem[block][10], &data[10], 6);
+}
+
+bool SimClassic::authenticate(byte cmd, byte blockAddr, const byte* key, const byte* uid4) {
+  if (state != ST_ACTIVE || blockAddr >= blockCount || memcmp(uid4, uid, 4) != 0) {
+    toIdle();
+    return false;
+  }
+  uint16_t sector = sectorOf(blockAddr);
+  const byte* tr = mem[firstBlockOf(sector) + blocksIn(sector) - 1];
+  const byte* k = (cmd == 0x61) ? &tr[10] : &tr[0];
+  if (memcmp(k, key, 6) != 0) {
+    toIdle();
+    return false;
+  }
+  authSector = sector;
+  authKeyB = (cmd == 0x61);
+  pendingWrite = -1;
+  return true;
+}
+
+bool SimClassic::command(const byte* data, size_t len, bool crypto, SimResponse& resp) {
+  // Crypto1の状態がカードとリーダーで一致しなければ、カードは復号できないので無応答でIDLEに戻る
+  if ((authSector >= 0) != crypto) {
+    toIdle();
+    return false;
+  }
+  if (!checkCrc(data, len)) {
+    toIdle();
+    return false;
+  }
+  // 書き込みの2フェーズ目
+  if (pendingWrite >= 0) {
+    uint16_t block = pendingWrite;
+    pendingWrite = -1;
+    if (len != 18) { nak(resp); toIdle(); return true; }
+    writeBlock(block, data);
+    simField.stats.cardWrites++;
+    resp.processUs = simField.latency.classicWriteUs;
+    ack(resp);
+    return true;
+  }
+  byte cmd = data[0];
+  if (cmd == 0x50 && len == 4) {  // HLTA
+    toIdle();
+    state = ST_HALT;
+    return false;
+  }
+  if ((cmd == 0x30 || cmd == 0xA0) && len == 4) {
+    uint16_t block = data[1];
+    if (block >= blockCount) { nak(resp); toIdle(); return true; }
+    if (cmd == 0x30) {  // READ
+      if (!canRead(block)) { nak(resp); toIdle(); return true; }
+      memcpy(resp.data, mem[block], 16);
+      uint16_t sector = sectorOf(block);
+      if (block == firstBlockOf(sector) + blocksIn(sector) - 1) {
+        memset(resp.data, 0, 6);  // KeyAは常に読めない
+        if (!keyBReadable(sector) || authKeyB) memset(&resp.data[10], 0, 6);
+      }
+      resp.len = 16;
+      resp.processUs = simField.latency.cardReadUs;
+      appendCrc(resp);
+      return true;
+    } else {            // WRITE 1フェーズ目
+      if (!canWrite(block)) { nak(resp); toIdle(); return true; }
+      pendingWrite = block;
+      ack(resp);
+      return true;
+    }
+  }
+  nak(resp);
+  toIdle();
+  return true;
+}
+
+void SimClassic::toIdle() {
+  SimCard::toIdle();
+  authSector = -1;
+  authKeyB = false;
+  pendingWrite = -1;
+}
+
+//
+// NTAG213/215/216
+//
+SimNtag::SimNtag(Model model_, const byte* uid7) : model(model_) {
+  static const byte defUid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+  uidSize = 7;
+  memcpy(uid, uid7 ? uid7 : defUid, 7);
+  atqa[0] = 0x44;
+  atqa[1] = 0x00;
+  sak = 0x00;
+  switch (model) {
+    case NTAG213: pageCount = 45;  cfgPage = 41;  break;
+    case NTAG215: pageCount = 135; cfgPage = 131; break;
+    default:      pageCount = 231; cfgPage = 227; break;
+  }
+  memset(mem, 0, sizeof(mem));
+  mem[0][0] = uid[0]; mem[0][1] = uid[1]; mem[0][2] = uid[2];
+  mem[0][3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+  memcpy(mem[1], &uid[3], 4);
+  mem[2][0] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+  mem[2][1] = 0x48;
+  mem[3][0] = 0xE1;
+  mem[3][1] = 0x10;
+  mem[3][2] = (model == NTAG213) ? 0x12 : (model == NTAG215) ? 0x3E : 0x6D;
+  mem[3][3] = 0x00;
+  mem[4][0] = 0x03; mem[4][1] = 0x00; mem[4][2] = 0xFE;  // 空のNDEFメッセージ
+  mem[cfgPage - 1][3] = 0xBD;   // RFUI
+  mem[cfgPage][0] = 0x04;       // MIRROR
+  mem[cfgPage][3] = 0xFF;       // AUTH0
+  mem[cfgPage + 1][1] = 0x05;   // RFUI
+  memset(mem[cfgPage + 2], 0xFF, 4);  // PWD
+  powerOn();
+}
+
+void SimNtag::powerOn() {
+  toIdle();
+  auth0Eff = mem[cfgPage][3];
+  accessEff = mem[cfgPage + 1][0];
+}
+
+void SimNtag::readPage(uint16_t page, byte* out) {
+  page %= pageCount;
+  if (page == cfgPage + 2 || page == cfgPage + 3 || readProtected(page)) {
+    memset(out, 0, 4);   // PWD/PACKは常に00hで読める
+  } else {
+    memcpy(out, mem[page], 4);
+  }
+}
+
+bool SimNtag::writePage(uint16_t page, const byte* data) {
+  if (page < 2 || page >= pageCount) return false;
+  if (writeProtected(page)) return false;
+  if (cfglck() && page >= cfgPage && page <= cfgPage + 1) return false;
+  writes++;
+  if (page == 2) {          // ロックビット（OR書き込み）
+    mem[2][2] |= data[2];
+    mem[2][3] |= data[3];
+  } else if (page == 3) {   // CC（OTP）
+    for (int i=0; i<4; i++) mem[3][i] |= data[i];
+  } else {
+    memcpy(mem[page], data, 4);
+  }
+  return true;
+}
+
+bool SimNtag::command(const byte* data, size_t len, bool crypto, SimResponse& resp) {
+  if (crypto || !checkCrc(data, len)) {
+    toIdle();
+    return false;
+  }
+  // COMPATIBILITY_WRITEの2フェーズ目
+  if (pendingCompat >= 0) {
+    uint16_t page = pendingCompat;
+    pendingCompat = -1;
+    if (len != 18 || !writePage(page, data)) { nak(resp); toIdle(); return true; }
+    simField.stats.cardWrites++;
+    resp.processUs = simField.latency.ntagWriteUs;
+    ack(resp);
+    return true;
+  }
+  byte cmd = data[0];
+  switch (cmd) {
+    case 0x50:  // HLTA
+      toIdle();
+      state = ST_HALT;
+      return false;
+    case 0x60: {  // GET_VERSION
+      static const byte ver[8] = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x0F, 0x03 };
+      memcpy(resp.data, ver, 8);
+      resp.data[6] = (model == NTAG213) ? 0x0F : (model == NTAG215) ? 0x11 : 0x13;
+      resp.len = 8;
+      appendCrc(resp);
+      return true;
+    }
+    case 0x30: {  // READ
+      if (len != 4) break;
+      uint16_t page = data[1];
+      if (page >= pageCount || readProtected(page)) { nak(resp); toIdle(); return true; }
+      for (int i=0; i<4; i++) readPage(page + i, &resp.data[i * 4]);
+      resp.len = 16;
+      resp.processUs = simField.latency.cardReadUs;
+      appendCrc(resp);
+      return true;
+    }
+    case 0x3A: {  // FAST_READ
+      if (len != 5 || !fastReadSupported) break;
+      uint16_t sta = data[1], end = data[2];
+      if (sta > end || end >= pageCount) { nak(resp); toIdle(); return true; }
+      for (uint16_t p=sta; p<=end; p++) {
+        if (readProtected(p)) { nak(resp); toIdle(); return true; }
+      }
+      for (uint16_t p=sta; p<=end; p++) readPage(p, &resp.data[(p - sta) * 4]);
+      resp.len = (end - sta + 1) * 4;
+      resp.processUs = simField.latency.cardReadUs;
+      appendCrc(resp);
+      return true;
+    }
+    case 0xA2: {  // WRITE
+      if (len != 8) break;
+      if (!writePage(data[1], &data[2])) { nak(resp); toIdle(); return true; }
+      simField.stats.cardWrites++;
+      resp.processUs = simField.latency.ntagWriteUs;
+      ack(resp);
+      return true;
+    }
+    case 0xA0: {  // COMPATIBILITY_WRITE
+      if (len != 4) break;
+      if (data[1] < 2 || data[1] >= pageCount) { nak(resp); toIdle(); return true; }
+      pendingCompat = data[1];
+      ack(resp);
+      return true;
+    }
+    case 0x1B: {  // PWD_AUTH
+      if (len != 7) break;
+      if (memcmp(&data[1], mem[cfgPage + 2], 4) != 0) {
+        authFails++;
+        nak(resp);
+        toIdle();
+        return true;
+      }
+      authFails = 0;
+      authed = true;
+      memcpy(resp.data, mem[cfgPage + 3], 2);
+      resp.len = 2;
+      appendCrc(resp);
+      return true;
+    }
+    case 0x39: {  // READ_CNT
+      memset(resp.data, 0, 3);
+      resp.len = 3;
+      appendCrc(resp);
+      return true;
+    }
+    case 0x3C: {  // READ_SIG
+      memset(resp.data, 0, 32);
+      resp.len = 32;
+      appendCrc(resp);
+      return true;
+    }
+    default:
+      break;
+  }
+  nak(resp, 0x00);
+  toIdle();
+  return true;
+}
+
+void SimNtag::toIdle() {
+  SimCard::toIdle();
+  authed = false;
+  pendingCompat = -1;
+}
+
+//
+// RFフィールド
+//
+void SimField::place(SimCard* card, uint64_t arriveAtUs, uint64_t leaveAtUs) {
+  card->toIdle();
+  slots.push_back({ card, arriveAtUs, leaveAtUs, false });
+}
+
+void SimField::remove(SimCard* card) {
+  for (size_t i=0; i<slots.size(); i++) {
+    if (slots[i].card == card) {
+      slots.erase(slots.begin() + i);
+      return;
+    }
+  }
+}
+
+void SimField::retap() {
+  for (auto& s : slots) {
+    s.card->powerOn();
+    s.powered = true;
+  }
+}
+
+// 時刻に応じてカードの出入りを反映する
+void SimField::update() {
+  uint64_t now = simNowUs();
+  for (auto& s : slots) {
+    bool in = (now >= s.arriveAt && now < s.leaveAt);
+    if (in != s.powered) {
+      if (in) s.card->powerOn();   // 電源が入った/切れた
+      else s.card->toIdle();
+      s.powered = in;
+    }
+  }
+}
+
+bool SimField::anticollision(const byte* tx, size_t txLen, uint8_t txLastBits, uint8_t rxAlign, SimResponse& resp) {
+  byte sel = tx[0];
+  uint8_t lv = (sel == 0x93) ? 1 : (sel == 0x95) ? 2 : 3;
+  byte nvb = tx[1];
+  std::vector<SimCard*> targets;
+  for (auto& s : slots) {
+    if (!s.powered) continue;
+    SimCard* c = s.card;
+    if (c->state == SimCard::ST_ACTIVE) {   // 選択済みのカードにとっては想定外のコマンド
+      c->toIdle();
+      continue;
+    }
+    if (c->state == SimCard::ST_READY && c->level == lv) targets.push_back(c);
+  }
+  if (nvb == 0x70) {
+    // SELECT
+    if (txLen != 9 || !SimCard::checkCrc(tx, txLen)) return false;
+    // UIDの前半が同じカードはこのレベルでは全て選択される（次のレベルで絞り込む）
+    SimCard* hit = nullptr;
+    for (auto c : targets) {
+      byte f[5];
+      c->levelFrame(lv, f);
+      if (memcmp(f, &tx[2], 5) != 0) {
+        c->toIdle();
+        continue;
+      }
+      hit = c;
+      if (lv < c->levels()) {
+        c->level++;
+      } else {
+        c->state = SimCard::ST_ACTIVE;
+        c->onSelected();
+      }
+    }
+    if (hit == nullptr) return false;
+    bool more = (lv < hit->levels());
+    resp.data[0] = more ? 0x04 : hit->sak;
+    resp.len = 1;
+    SimCard::appendCrc(resp);
+    return true;
+  }
+  // ANTICOLLISION: 既知のビット数
+  int known = ((nvb >> 4) - 2) * 8 + (nvb & 0x0F);
+  if (known < 0 || known >= 40) return false;
+  std::vector<SimCard*> responders;
+  for (auto c : targets) {
+    byte f[5];
+    c->levelFrame(lv, f);
+    bool match = true;
+    for (int b=0; b<known; b++) {
+      int have = (tx[2 + b / 8] >> (b % 8)) & 1;
+      int want = (f[b / 8] >> (b % 8)) & 1;
+      if (have != want) { match = false; break; }
+    }
+    if (match) responders.push_back(c);
+    else c->toIdle();
+  }
+  if (responders.empty()) return false;
+  // 応答を合成し、最初に衝突したビットを求める
+  byte merged[5] = { 0 };
+  int collBit = -1;
+  byte first[5];
+  responders[0]->levelFrame(lv, first);
+  for (auto c : responders) {
+    byte f[5];
+    c->levelFrame(lv, f);
+    for (int i=0; i<5; i++) merged[i] |= f[i];
+    for (int b=known; b<40; b++) {
+      if (((f[b / 8] ^ first[b / 8]) >> (b % 8)) & 1) {
+        if (collBit < 0 || b < collBit) collBit = b;
+        break;
+      }
+    }
+  }
+  int startByte = known / 8;
+  resp.len = 5 - startByte;
+  for (size_t i=0; i<resp.len; i++) resp.data[i] = merged[startByte + i];
+  resp.data[0] &= (byte)(0xFF << rxAlign);
+  resp.lastBits = 0;
+  if (collBit >= 0) {
+    resp.coll = true;
+    resp.collPos = (collBit + 1) & 0x1F;
+  }
+  return true;
+}
+
+bool SimField::transceive(const byte* tx, size_t txLen, uint8_t txLastBits, uint8_t rxAlign, bool crypto, SimResponse& resp) {
+  update();
+  if (txLen == 0) return false;
+  // REQA/WUPA（7ビットの短いフレーム）
+  if (txLen == 1 && txLastBits == 7 && (tx[0] == 0x26 || tx[0] == 0x52)) {
+    bool wupa = (tx[0] == 0x52);
+    bool any = false;
+    byte atqa[2] = { 0, 0 };
+    bool coll = false;
+    for (auto& s : slots) {
+      if (!s.powered) continue;
+      SimCard* c = s.card;
+      bool wake = (c->state == SimCard::ST_IDLE || c->state == SimCard::ST_READY || (wupa && c->state == SimCard::ST_HALT));
+      if (c->state == SimCard::ST_ACTIVE) {
+        c->toIdle();   // 選択済みの状態では想定外のコマンドなのでIDLEに戻るだけ（応答しない）
+        continue;
+      }
+      if (!wake) continue;
+      c->toIdle();
+      c->state = SimCard::ST_READY;
+      if (any && (atqa[0] != c->atqa[0] || atqa[1] != c->atqa[1])) coll = true;
+      atqa[0] |= c->atqa[0];
+      atqa[1] |= c->atqa[1];
+      any = true;
+    }
+    if (!any) return false;
+    resp.data[0] = atqa[0];
+    resp.data[1] = atqa[1];
+    resp.len = 2;
+    resp.lastBits = 0;
+    if (coll) { resp.coll = true; resp.collPos = 1; }
+    return true;
+  }
+  // アンチコリジョン/セレクト
+  if (txLen >= 2 && (tx[0] == 0x93 || tx[0] == 0x95 || tx[0] == 0x97) && !crypto) {
+    return anticollision(tx, txLen, txLastBits, rxAlign, resp);
+  }
+  // 選択済みのカードへ
+  for (auto& s : slots) {
+    if (!s.powered) continue;
+    if (s.card->state == SimCard::ST_ACTIVE) {
+      return s.card->command(tx, txLen, crypto, resp);
+    }
+  }
+  return false;
+}
+
+bool SimField::authenticate(const byte* data, size_t len) {
+  update();
+  if (len < 12) return false;
+  for (auto& s : slots) {
+    if (!s.powered) continue;
+    if (s.card->state == SimCard::ST_ACTIVE) {
+      return s.card->authenticate(data[0], data[1], &data[2], &data[8]);
+    }
+  }
+  return false;
+}
+
+//
+// MFRC522のモデル
+//
+void SimChip::reset() {
+  memset(_reg, 0, sizeof(_reg));
+  _reg[0x01] = 0x20;  // CommandReg: RcvOff=1
+  _reg[0x02] = 0x80;  // ComIEnReg: IRqInv=1
+  _reg[0x04] = 0x14;  // ComIrqReg
+  _reg[0x0A] = 0x00;
+  _reg[0x0B] = 0x08;
+  _reg[0x0C] = 0x10;
+  _reg[0x11] = 0x3F;
+  _reg[0x14] = 0x80;  // TxControlReg（アンテナOFF）
+  _reg[0x26] = 0x48;
+  _fifoLen = 0;
+  _pend.active = false;
+  updateIrqPin();
+}
+
+uint32_t SimChip::timeoutUs() {
+  uint32_t presc = ((_reg[0x2A] & 0x0F) << 8) | _reg[0x2B];
+  uint32_t reload = (_reg[0x2C] << 8) | _reg[0x2D];
+  // f_timer = 13.56MHz / (2*TPreScaler+1)
+  uint64_t us = (uint64_t)(reload + 1) * (2 * presc + 1) * 1000000ULL / 13560000ULL;
+  if (us == 0) us = 25000;
+  return (uint32_t)us;
+}
+
+void SimChip::sync() {
+  if (!_pend.active || simNowUs() < _pend.at) return;
+  _pend.active = false;
+  _reg[0x04] |= _pend.comIrq;
+  _reg[0x05] |= _pend.divIrq;
+  _reg[0x06] = _pend.error;
+  _reg[0x0C] = (_reg[0x0C] & 0xF8) | (_pend.control & 0x07);
+  _reg[0x0E] = _pend.coll;
+  if (_pend.setCrypto) _reg[0x08] |= 0x08;
+  if (_pend.loadFifo) {
+    memcpy(_fifo, _pend.fifo, _pend.fifoLen);
+    _fifoLen = _pend.fifoLen;
+  }
+  if (_pend.loadCrc) {
+    _reg[0x22] = _pend.crc[0];
+    _reg[0x21] = _pend.crc[1];
+  }
+  updateIrqPin();
+}
+
+void SimChip::updateIrqPin() {
+  if (_irqPin < 0) return;
+  bool irq = ((_reg[0x02] & 0x7F) & (_reg[0x04] & 0x7F)) || ((_reg[0x03] & 0x1F) & (_reg[0x05] & 0x1F));
+  bool inv = _reg[0x02] & 0x80;
+  int level = (irq != inv) ? HIGH : LOW;
+  if (level != _irqLevel) {
+    _irqLevel = level;
+    simSetPinLevel(_irqPin, level);
+  }
+}
+
+void SimChip::i2cWrite(const uint8_t* data, size_t len) {
+  if (len == 0) return;
+  sync();
+  _ptr = data[0] & 0x3F;
+  for (size_t i=1; i<len; i++) {
+    writeReg(_ptr, data[i]);   // アドレスは自動インクリメントしない（FIFOへの連続書き込み用）
+  }
+}
+
+size_t SimChip::i2cRead(uint8_t* data, size_t len) {
+  sync();
+  for (size_t i=0; i<len; i++) {
+    data[i] = readReg(_ptr);
+  }
+  return len;
+}
+
+byte SimChip::readReg(byte reg) {
+  switch (reg) {
+    case 0x09:  // FIFODataReg
+      if (_fifoLen == 0) return 0;
+      {
+        byte v = _fifo[0];
+        memmove(_fifo, _fifo + 1, --_fifoLen);
+        return v;
+      }
+    case 0x0A:  // FIFOLevelReg
+      return (byte)_fifoLen;
+    case 0x37:  // VersionReg
+      return version;
+    default:
+      return _reg[reg];
+  }
+}
+
+void SimChip::writeReg(byte reg, byte value) {
+  bool antenna = (_reg[0x14] & 0x03) == 0x03;
+  writeRegRaw(reg, value);
+  // アンテナがOFFになったらフィールド内のカードは電源が切れてIDLEに戻る
+  if (antenna && (_reg[0x14] & 0x03) != 0x03) _field->retap();
+}
+
+void SimChip::writeRegRaw(byte reg, byte value) {
+  switch (reg) {
+    case 0x01: {  // CommandReg
+      byte cmd = value & 0x0F;
+      _reg[0x01] = value & 0x3F;
+      if (cmd == 0x0F) {          // SoftReset
+        int pin = _irqPin;
+        reset();
+        _irqPin = pin;
+        updateIrqPin();
+      } else if (cmd == 0x00) {   // Idle
+        _pend.active = false;
+      } else if (cmd == 0x03) {   // CalcCRC
+        startCrc();
+      } else if (cmd == 0x0E) {   // MFAuthent
+        startAuth();
+      }
+      break;
+    }
+    case 0x02:  // ComIEnReg
+    case 0x03:  // DivIEnReg
+      _reg[reg] = value;
+      updateIrqPin();
+      break;
+    case 0x04:  // ComIrqReg
+    case 0x05:  // DivIrqReg
+      if (value & 0x80) _reg[reg] |= (value & 0x7F);
+      else _reg[reg] &= ~(value & 0x7F);
+      updateIrqPin();
+      break;
+    case 0x06:  // ErrorReg（読み込み専用）
+      break;
+    case 0x08:  // Status2Reg（MFCrypto1Onはソフトウェアからはクリアのみ可能）
+      _reg[0x08] = (_reg[0x08] & 0x08 & value) | (value & 0xF0);
+      break;
+    case 0x09:  // FIFODataReg
+      if (_fifoLen < sizeof(_fifo)) _fifo[_fifoLen++] = value;
+      else _reg[0x06] |= 0x10;  // BufferOvfl
+      break;
+    case 0x0A:  // FIFOLevelReg
+      if (value & 0x80) {
+        _fifoLen = 0;
+        _reg[0x06] &= ~0x10;
+      }
+      break;
+    case 0x0D:  // BitFramingReg
+      _reg[0x0D] = value;
+      if ((value & 0x80) && (_reg[0x01] & 0x0F) == 0x0C) startTransceive();
+      break;
+    default:
+      _reg[reg] = value;
+      break;
+  }
+}
+
+void SimChip::startCrc() {
+  simField.stats.crcCalcs++;
+  _pend = Pending();
+  _pend.active = true;
+  _pend.at = simNowUs() + simField.latency.crcCalcUs;
+  simCrcA(_fifo, _fifoLen, _pend.crc);
+  _pend.loadCrc = true;
+  _pend.divIrq = 0x04;  // CRCIRq
+  _pend.error = _reg[0x06];
+  _pend.control = _reg[0x0C];
+  _pend.coll = _reg[0x0E];
+  _fifoLen = 0;
+}
+
+void SimChip::startTransceive() {
+  const SimLatency& lat = simField.latency;
+  byte tx[64];
+  size_t txLen = _fifoLen;
+  memcpy(tx, _fifo, txLen);
+  _fifoLen = 0;
+  uint8_t txLastBits = _reg[0x0D] & 0x07;
+  uint8_t rxAlign = (_reg[0x0D] >> 4) & 0x07;
+  bool antenna = (_reg[0x14] & 0x03) == 0x03;
+
+  simField.stats.rfFrames++;
+  simField.stats.rfBytesTx += txLen;
+  uint32_t txBits = (txLen == 0) ? 0 : (txLen - 1) * 9 + (txLastBits ? txLastBits : 9);
+  uint64_t txUs = (uint64_t)txBits * lat.rfBitNs / 1000 + lat.frameOverheadUs;
+
+  SimResponse resp;
+  bool ok = antenna && simField.transceive(tx, txLen, txLastBits, rxAlign, crypto(), resp);
+  _pend = Pending();
+  _pend.active = true;
+  _pend.control = 0;
+  if (ok) {
+    simField.stats.rfBytesRx += resp.len;
+    uint32_t rxBits = (resp.len == 0) ? 0 : (resp.len - 1) * 9 + (resp.lastBits ? resp.lastBits : 9);
+    _pend.at = simNowUs() + txUs + resp.processUs + (uint64_t)rxBits * lat.rfBitNs / 1000;
+    size_t n = resp.len;
+    if (n > sizeof(_pend.fifo)) {
+      n = sizeof(_pend.fifo);
+      _pend.error |= 0x10;   // BufferOvfl
+    }
+    memcpy(_pend.fifo, resp.data, n);
+    _pend.fifoLen = n;
+    _pend.loadFifo = true;
+    _pend.control = resp.lastBits;
+    _pend.comIrq = 0x20 | 0x04;   // RxIRq, HiAlertIRq
+    if (resp.coll) {
+      _pend.error |= 0x08;        // CollErr
+      _pend.coll = resp.collPos & 0x1F;
+    }
+  } else {
+    simField.stats.rfTimeouts++;
+    _pend.at = simNowUs() + txUs + timeoutUs();
+    _pend.comIrq = 0x01;          // TimerIRq
+    _pend.fifoLen = 0;
+    _pend.loadFifo = true;
+  }
+}
+
+void SimChip::startAuth() {
+  const SimLatency& lat = simField.latency;
+  byte data[64];
+  size_t len = _fifoLen;
+  memcpy(data, _fifo, len);
+  _fifoLen = 0;
+  simField.stats.rfFrames++;
+  simField.stats.auths++;
+  bool antenna = (_reg[0x14] & 0x03) == 0x03;
+  bool ok = antenna && simField.authenticate(data, len);
+  _pend = Pending();
+  _pend.active = true;
+  if (ok) {
+    _pend.at = simNowUs() + lat.authUs;
+    _pend.comIrq = 0x10;   // IdleIRq
+    _pend.setCrypto = true;
+  } else {
+    simField.stats.rfTimeouts++;
+    _pend.at = simNowUs() + lat.authUs / 2 + timeoutUs();
+    _pend.comIrq = 0x01;   // TimerIRq
+  }
+}
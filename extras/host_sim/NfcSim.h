@@ -0,0 +1,244 @@
+/*
+  NfcSim.h (host_sim)
+  MFRC522(WS1850S)とNFCカードのシミュレーター
+
+  SimChip  : I2Cに接続されたMFRC522のレジスタ/FIFO/コマンド/割り込みのモデル
+  SimField : RFフィールド（置かれているカードの管理とアンチコリジョン）
+  SimClassic : MIFARE Classic 1K/4K（セクタートレーラー、アクセスビット、KeyA/KeyB、Crypto1セッション）
+  SimNtag    : NTAG213/215/216（CC、設定ページ、AUTH0/PROT/PWD/PACK）
+
+  時間は仮想クロックで管理し、SimLatencyの設定に従ってI2CとRFの通信時間を加算する。
+*/
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+#include <vector>
+
+//
+// 仮想クロック
+//
+uint64_t simNowUs();
+void simAdvanceUs(uint64_t us);
+
+//
+// 遅延モデル（すべて設定変更可能）
+//
+struct SimLatency {
+  uint32_t i2cTxnOverheadUs = 15;  // I2Cトランザクションごとの固定オーバーヘッド（START/STOP、ドライバ処理）
+  uint32_t rfBitNs = 9440;         // RFの1ビットの時間 106kbps
+  uint32_t frameOverheadUs = 100;  // フレームごとのSOF/EOFとFDT
+  uint32_t crcCalcUs = 10;         // CRCコプロセッサの計算時間
+  uint32_t authUs = 1800;          // Crypto1の3パス認証
+  uint32_t classicWriteUs = 2800;  // Classicのブロック書き込み（2フェーズ目）
+  uint32_t ntagWriteUs = 4100;     // NTAGのEEPROM書き込み
+  uint32_t cardReadUs = 0;         // カードの読み込み処理時間
+};
+
+//
+// 統計
+//
+struct SimStats {
+  uint32_t i2cTransactions = 0;  // I2Cトランザクション数
+  uint32_t i2cBytes = 0;         // I2Cの転送バイト数（アドレスバイトを含む）
+  uint32_t rfFrames = 0;         // RFの送受信回数（Transceive/MFAuthent）
+  uint32_t rfTimeouts = 0;       // 応答なしの回数
+  uint32_t rfBytesTx = 0;        // RF送信バイト数
+  uint32_t rfBytesRx = 0;        // RF受信バイト数
+  uint32_t crcCalcs = 0;         // CRCコプロセッサの使用回数
+  uint32_t auths = 0;            // MFAuthentの実行回数
+  uint32_t cardWrites = 0;       // カードの不揮発メモリへの書き込み回数
+  void reset() { *this = SimStats(); }
+};
+
+// CRC_A (ISO/IEC 14443-3)
+void simCrcA(const byte* data, size_t len, byte* out);
+
+// カードの応答
+struct SimResponse {
+  byte data[300];
+  size_t len = 0;         // バイト数
+  uint8_t lastBits = 0;   // 最終バイトの有効ビット数（0=8ビット全て）
+  uint32_t processUs = 0; // カード内部の処理時間
+  bool coll = false;      // ビット衝突
+  uint8_t collPos = 0;    // 衝突位置(CollReg.CollPos)
+};
+
+//
+// カードの基底クラス
+//
+class SimCard {
+public:
+  enum State : uint8_t { ST_IDLE, ST_READY, ST_ACTIVE, ST_HALT };
+  SimCard() {}
+  virtual ~SimCard() {}
+
+  byte uid[10];
+  byte uidSize = 4;
+  byte atqa[2] = { 0x04, 0x00 };
+  byte sak = 0x08;
+  State state = ST_IDLE;
+  uint8_t level = 1;     // アンチコリジョンのカスケードレベル
+  uint32_t writes = 0;   // 不揮発メモリへの書き込み回数
+
+  // カスケードレベルのフレーム（UID CLn 4バイト＋BCC）
+  void levelFrame(uint8_t lv, byte out[5]);
+  uint8_t levels() const { return (uidSize == 4) ? 1 : (uidSize == 7) ? 2 : 3; }
+
+  // 選択済み状態での1フレームの処理。応答するならtrue
+  virtual bool command(const byte* data, size_t len, bool crypto, SimResponse& resp) = 0;
+  // MFAuthent（Classicのみ）
+  virtual bool authenticate(byte cmd, byte blockAddr, const byte* key, const byte* uid4) { toIdle(); return false; }
+  // IDLEに戻る（エラー時、電源断時）
+  virtual void toIdle() { state = ST_IDLE; level = 1; }
+  // 電源投入（フィールドに入った/アンテナON）
+  virtual void powerOn() { toIdle(); }
+  // 選択された
+  virtual void onSelected() {}
+
+  static void nak(SimResponse& resp, byte code=0x04);
+  static void ack(SimResponse& resp);
+  static bool checkCrc(const byte* data, size_t len);
+  static void appendCrc(SimResponse& resp);
+};
+
+//
+// MIFARE Classic 1K/4K
+//
+class SimClassic : public SimCard {
+public:
+  SimClassic(bool is4k=false, const byte* uid4=nullptr);
+  bool is4k;
+  uint16_t blockCount;
+  byte mem[256][16];
+  int16_t authSector = -1;   // 認証済みのセクター
+  bool authKeyB = false;
+  int16_t pendingWrite = -1; // 2フェーズ目の書き込み待ちのブロック
+
+  static uint16_t sectorOf(uint16_t block);
+  static uint16_t firstBlockOf(uint16_t sector);
+  static uint16_t blocksIn(uint16_t sector);
+  uint16_t sectorCount() const { return is4k ? 40 : 16; }
+  uint8_t accessOf(uint16_t block);   // c1c2c3
+  bool keyBReadable(uint16_t sector);
+
+  bool command(const byte* data, size_t len, bool crypto, SimResponse& resp) override;
+  bool authenticate(byte cmd, byte blockAddr, const byte* key, const byte* uid4) override;
+  void toIdle() override;
+private:
+  bool canRead(uint16_t block);
+  bool canWrite(uint16_t block);
+  void writeBlock(uint16_t block, const byte* data);
+};
+
+//
+// NTAG213/215/216
+//
+class SimNtag : public SimCard {
+public:
+  enum Model : uint8_t { NTAG213, NTAG215, NTAG216 };
+  SimNtag(Model model=NTAG213, const byte* uid7=nullptr);
+  Model model;
+  uint16_t pageCount;
+  uint16_t cfgPage;
+  byte mem[231][4];
+  bool authed = false;
+  int16_t pendingCompat = -1;
+  uint8_t authFails = 0;
+  bool fastReadSupported = true;  // falseでFAST_READ非対応のカード（Ultralight EV1以前など）を模擬する
+
+  // AUTH0/ACCESSの変更は次の電源投入時から有効になる
+  byte auth0Eff = 0xFF;
+  byte accessEff = 0x00;
+  byte auth0() const { return auth0Eff; }
+  bool prot() const { return accessEff & 0x80; }
+  bool cfglck() const { return mem[cfgPage + 1][0] & 0x40; }
+  bool readProtected(uint16_t page) const { return prot() && page >= auth0() && !authed; }
+  bool writeProtected(uint16_t page) const { return page >= auth0() && !authed; }
+
+  bool command(const byte* data, size_t len, bool crypto, SimResponse& resp) override;
+  void toIdle() override;
+  void powerOn() override;
+private:
+  void readPage(uint16_t page, byte* out);
+  bool writePage(uint16_t page, const byte* data);
+};
+
+//
+// RFフィールド
+//
+class SimField {
+public:
+  struct Slot {
+    SimCard* card;
+    uint64_t arriveAt;
+    uint64_t leaveAt;
+    bool powered;
+  };
+  std::vector<Slot> slots;
+  SimLatency latency;
+  SimStats stats;
+
+  // カードを置く（時刻指定可）／取り除く
+  void place(SimCard* card, uint64_t arriveAtUs=0, uint64_t leaveAtUs=UINT64_MAX);
+  void remove(SimCard* card);
+  void clear() { slots.clear(); }
+  // 置き直し（全カードの電源を入れ直してIDLEにする）
+  void retap();
+  // 現在フィールド内にあるカード
+  void update();
+
+  // MFRC522から1フレーム送信する。応答があればtrue
+  bool transceive(const byte* tx, size_t txLen, uint8_t txLastBits, uint8_t rxAlign, bool crypto, SimResponse& resp);
+  // MFAuthent
+  bool authenticate(const byte* data, size_t len);
+private:
+  bool anticollision(const byte* tx, size_t txLen, uint8_t txLastBits, uint8_t rxAlign, SimResponse& resp);
+};
+
+//
+// MFRC522のモデル（I2Cデバイス）
+//
+class SimChip : public SimI2CDevice {
+public:
+  SimChip(SimField* field) : _field(field) { reset(); }
+  void writeRegRaw(byte reg, byte value);
+  void reset();
+  void i2cWrite(const uint8_t* data, size_t len) override;
+  size_t i2cRead(uint8_t* data, size_t len) override;
+  // 保留中の処理を現在時刻まで進める
+  void sync();
+  // IRQ出力をGPIOに接続する（-1で未接続）
+  void setIrqPin(int pin) { _irqPin = pin; updateIrqPin(); }
+  byte version = 0x15;   // WS1850S
+  bool crypto() const { return _reg[0x08] & 0x08; }
+private:
+  SimField* _field;
+  byte _reg[64];
+  byte _fifo[64];
+  size_t _fifoLen;
+  byte _ptr = 0;
+  int _irqPin = -1;
+  int _irqLevel = -1;
+  // 実行中のコマンドの完了予定
+  struct Pending {
+    bool active = false;
+    uint64_t at = 0;
+    byte comIrq = 0, divIrq = 0, error = 0, control = 0, coll = 0;
+    bool setCrypto = false;
+    byte fifo[64];
+    size_t fifoLen = 0;
+    bool loadFifo = false;
+    byte crc[2];
+    bool loadCrc = false;
+  } _pend;
+  void writeReg(byte reg, byte value);
+  byte readReg(byte reg);
+  void startTransceive();
+  void startAuth();
+  void startCrc();
+  uint32_t timeoutUs();
+  void updateIrqPin();
+};
+
+extern SimField simField;
+extern SimChip simChip;
@@ -0,0 +1,49 @@
+/*
+  Wire.h (host_sim)
+  Arduino互換のI2Cスタブ　接続されたシミュレーターのデバイスへ転送する
+*/
+#pragma once
+#include "Arduino.h"
+
+#ifndef I2C_BUFFER_LENGTH
+#define I2C_BUFFER_LENGTH 128
+#endif
+
+// I2Cバスにぶら下がるデバイス
+class SimI2CDevice {
+public:
+  virtual ~SimI2CDevice() {}
+  virtual void i2cWrite(const uint8_t* data, size_t len) = 0;  // 1回のトランザクションで書き込まれたバイト列
+  virtual size_t i2cRead(uint8_t* data, size_t len) = 0;       // 1回のトランザクションで読み出すバイト列
+};
+
+class TwoWire : public Stream {
+public:
+  bool begin() { return true; }
+  bool begin(int sda, int scl, uint32_t freq=0) { if (freq) _clock = freq; return true; }
+  void setClock(uint32_t freq) { _clock = freq; }
+  uint32_t getClock() { return _clock; }
+  void beginTransmission(uint8_t address);
+  uint8_t endTransmission(bool sendStop=true);
+  size_t requestFrom(uint8_t address, size_t quantity, bool sendStop=true);
+  size_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (size_t)quantity); }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override { return _rxLen - _rxPos; }
+  int read() override { return (_rxPos < _rxLen) ? _rxBuf[_rxPos++] : -1; }
+  int peek() override { return (_rxPos < _rxLen) ? _rxBuf[_rxPos] : -1; }
+
+  // シミュレーター用
+  void simAttach(uint8_t address, SimI2CDevice* dev) { _simAddr = address; _simDev = dev; }
+  uint32_t _clock = 100000;
+private:
+  uint8_t _txAddr = 0;
+  uint8_t _txBuf[I2C_BUFFER_LENGTH + 1];
+  size_t _txLen = 0;
+  uint8_t _rxBuf[I2C_BUFFER_LENGTH];
+  size_t _rxLen = 0, _rxPos = 0;
+  uint8_t _simAddr = 0;
+  SimI2CDevice* _simDev = nullptr;
+};
+extern TwoWire Wire;
+extern TwoWire Wire1;
@@ -0,0 +1,17 @@
+#!/bin/sh
+# スケッチをシミュレーターと一緒にビルドする
+# 使い方: ./build.sh スケッチ.ino 出力ファイル [追加のコンパイルオプション...]
+D=$(cd "$(dirname "$0")" && pwd)
+ROOT="$D/../.."
+SKETCH="$1"
+OUT="$2"
+if [ -z "$SKETCH" ] || [ -z "$OUT" ]; then
+  echo "usage: $0 sketch.ino output [cxxflags...]" >&2
+  exit 1
+fi
+shift 2
+${CXX:-g++} -std=gnu++17 -O1 -g \
+  -I"$D" -I"$ROOT" -include Arduino.h -DNFC_HOST_SIM "$@" \
+  -x c++ "$SKETCH" -x none \
+  "$D/NfcSim.cpp" "$D/ArduinoSim.cpp" "$D/MFRC522_I2C.cpp" "$D/host_main.cpp" "$ROOT/NfcEasyWriter.cpp" \
+  -o "$OUT"
@@ -0,0 +1,98 @@
+/*
+  host_main.cpp (host_sim)
+  サンプルスケッチ(.ino)をシミュレーター上で実行する
+
+  使い方: ./sketch [カードの種類] [loop()の実行回数]
+    カードの種類: classic1k / classic4k / ntag213 / ntag215 / ntag216 / ntag213nofast（省略時はclassic1k）
+                  カンマ区切りで複数指定すると、UIDの異なるカードを重ねて置く（例: ntag215,ntag215,classic1k）
+  環境変数:
+    SIM_QUIET=1          Serialの出力を表示しない
+    SIM_IRQ_PIN=n        MFRC522のIRQ出力をGPIO nに接続する
+    SIM_LATENCY=k=v,...  遅延モデルの設定を変更する（例: SIM_LATENCY=authUs=2000,ntagWriteUs=5000）
+    SIM_I2C_CLOCK=hz     I2Cのクロックの初期値
+*/
+#include "NfcSim.h"
+#include <M5Unified.h>
+
+m5::M5Unified M5;
+
+void setup();
+void loop();
+
+// カードを作る（index>0ならUIDの最後のバイトを変える）
+SimCard* simCreateCard(const char* name, uint8_t index=0) {
+  byte uid4[4] = { 0xDE, 0xAD, 0xBE, (byte)(0xEF + index) };
+  byte uid7[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, (byte)(0x66 + index) };
+  if (strcmp(name, "classic4k") == 0) return new SimClassic(true, uid4);
+  if (strcmp(name, "ntag213") == 0) return new SimNtag(SimNtag::NTAG213, uid7);
+  if (strcmp(name, "ntag215") == 0) return new SimNtag(SimNtag::NTAG215, uid7);
+  if (strcmp(name, "ntag216") == 0) return new SimNtag(SimNtag::NTAG216, uid7);
+  if (strcmp(name, "ntag213nofast") == 0) { SimNtag* c = new SimNtag(SimNtag::NTAG213, uid7); c->fastReadSupported = false; return c; }
+  if (strcmp(name, "classic1k") == 0) return new SimClassic(false, uid4);
+  return nullptr;
+}
+
+// SIM_LATENCYの "名前=値,..." を遅延モデルに設定する
+static bool parseLatency(const char* str, SimLatency& lat) {
+  struct Item { const char* name; uint32_t* value; } items[] = {
+    { "i2cTxnOverheadUs", &lat.i2cTxnOverheadUs },
+    { "rfBitNs", &lat.rfBitNs },
+    { "frameOverheadUs", &lat.frameOverheadUs },
+    { "crcCalcUs", &lat.crcCalcUs },
+    { "authUs", &lat.authUs },
+    { "classicWriteUs", &lat.classicWriteUs },
+    { "ntagWriteUs", &lat.ntagWriteUs },
+    { "cardReadUs", &lat.cardReadUs },
+  };
+  std::string s(str);
+  size_t pos = 0;
+  while (pos < s.size()) {
+    size_t end = s.find(',', pos);
+    if (end == std::string::npos) end = s.size();
+    std::string kv = s.substr(pos, end - pos);
+    size_t eq = kv.find('=');
+    bool found = false;
+    for (auto& it : items) {
+      if (eq != std::string::npos && kv.compare(0, eq, it.name) == 0 && strlen(it.name) == eq) {
+        *it.value = strtoul(kv.c_str() + eq + 1, nullptr, 10);
+        found = true;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "unknown latency item: %s\n", kv.c_str());
+      return false;
+    }
+    pos = end + 1;
+  }
+  return true;
+}
+
+#ifndef SIM_NO_MAIN
+int main(int argc, char** argv) {
+  const char* cardNames = (argc > 1) ? argv[1] : "classic1k";
+  int loops = (argc > 2) ? atoi(argv[2]) : 1;
+  std::vector<SimCard*> cards;
+  char names[128];
+  strncpy(names, cardNames, sizeof(names) - 1);
+  names[sizeof(names) - 1] = 0;
+  for (char* name = strtok(names, ","); name != nullptr; name = strtok(nullptr, ",")) {
+    SimCard* card = simCreateCard(name, cards.size());
+    if (card == nullptr) {
+      fprintf(stderr, "unknown card type: %s\n", name);
+      return 1;
+    }
+    cards.push_back(card);
+  }
+  if (getenv("SIM_LATENCY") && !parseLatency(getenv("SIM_LATENCY"), simField.latency)) return 1;
+  if (getenv("SIM_IRQ_PIN")) simChip.setIrqPin(atoi(getenv("SIM_IRQ_PIN")));
+  if (getenv("SIM_I2C_CLOCK")) Wire.setClock(strtoul(getenv("SIM_I2C_CLOCK"), nullptr, 10));
+  for (auto card : cards) simField.place(card);
+  setup();
+  for (int i=0; i<loops; i++) {
+    simField.retap();   // loop()の度にカードを置き直す
+    loop();
+  }
+  for (auto card : cards) delete card;
+  return 0;
+}
+#endif
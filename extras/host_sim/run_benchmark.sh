@@ -0,0 +1,14 @@
+#!/bin/sh
+# ベンチマーク(example/benchmark)を各カードで実行して、結果をまとめたCSVを出力する
+# 使い方: ./run_benchmark.sh [出力ファイル]  （省略時は標準出力）
+D=$(cd "$(dirname "$0")" && pwd)
+ROOT="$D/../.."
+BIN=$(mktemp)
+"$D/build.sh" "$ROOT/example/benchmark/benchmark.ino" "$BIN" || exit 1
+{
+  echo "card,op,bytes,time_us,rf_frames,i2c_bytes,bytes_per_sec,result"
+  for c in classic1k ntag213 ntag215 ntag216; do
+    printf "1\n" | "$BIN" $c 1 | grep -E '^[A-Za-z0-9]+,[a-z_]+,' | grep -v '^card,'
+  done
+} > "${1:-/dev/stdout}"
+rm -f "$BIN"
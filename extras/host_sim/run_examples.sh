@@ -0,0 +1,22 @@
+#!/bin/sh
+# サンプルプログラムを各カードでビルドして実行する（結果は出力先ディレクトリに保存）
+# 使い方: ./run_examples.sh [出力先ディレクトリ]
+D=$(cd "$(dirname "$0")" && pwd)
+ROOT="$D/../.."
+OUT=${1:-"$D/out"}
+mkdir -p "$OUT"
+RC=0
+for ex in basic_write_read card_infomation dump_all protected_write_read protected_write_read_missing async_write_read multi_card record_store typed_schema full_test; do
+  "$D/build.sh" "$ROOT/example/$ex/$ex.ino" "$OUT/$ex" || { RC=1; continue; }
+  for c in classic1k classic4k ntag213 ntag215 ntag216; do
+    if [ "$ex" = "full_test" ]; then
+      # 全テスト（メニュー3）を実行して結果の行を表示する
+      printf "3\n" | timeout 120 "$OUT/$ex" $c 100 > "$OUT/${ex}_$c.txt" 2>&1
+      echo "$ex $c: $(grep -E 'テスト終了' "$OUT/${ex}_$c.txt")"
+    else
+      printf "\n\n\n" | timeout 60 "$OUT/$ex" $c 3 > "$OUT/${ex}_$c.txt" 2>&1
+      echo "$ex $c: rc=$?"
+    fi
+  done
+done
+exit $RC